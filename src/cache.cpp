@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "config.hpp"
+#include "git.hpp"
+#include "log.hpp"
+#include "proc.hpp"
+#include "sha1.hpp"
+
+namespace
+{
+	bool is_valid_key(const std::string& key)
+	{
+		return not key.empty() and std::string::npos == key.find('/')
+			and githlpr::cache::stats_file != key and githlpr::cache::stats_lock_file != key
+			and 0 != key.compare(0, githlpr::cache::tmp_prefix.length(), githlpr::cache::tmp_prefix);
+	}
+
+	/*
+	 * A "pack-<sha1>.pack" ends in the sha1 of its content, which names it; a "pack-<sha1>.idx" ends in the pack's
+	 * sha1 and its own. Other keys are not checked.
+	 */
+	bool is_intact(const std::string& key, const std::filesystem::path& file)
+	{
+		constexpr std::string_view prefix{"pack-"}, pack_ext{".pack"}, index_ext{".idx"};
+		const std::string_view name{key};
+		const std::string_view ext{name.substr(std::min(name.size(), prefix.length() + githlpr::git::sha1_hex_len))};
+		if (0 != name.compare(0, prefix.length(), prefix) or (pack_ext != ext and index_ext != ext)) {
+			return true;
+		}
+		std::string named{};
+		try {
+			named = githlpr::sha1::from_hex(name.substr(prefix.length(), githlpr::git::sha1_hex_len));
+		} catch (const std::runtime_error&) {
+			return true;
+		}
+		const std::uintmax_t size{std::filesystem::file_size(file)};
+		const std::uintmax_t ntrailer{pack_ext == ext ? githlpr::sha1::raw_len : 2 * githlpr::sha1::raw_len};
+		if (size < ntrailer) {
+			return false;
+		}
+		std::ifstream strm{file, std::ios::binary};
+		githlpr::sha1::context_t ctx{};
+		std::array<char, 64 * 1024> buf{};
+		for (std::uintmax_t left{size - githlpr::sha1::raw_len}; left > 0;) {
+			const std::size_t n{static_cast<std::size_t>(std::min<std::uintmax_t>(left, buf.size()))};
+			if (not strm.read(buf.data(), static_cast<std::streamsize>(n))) {
+				return false;
+			}
+			ctx.update(std::string_view(buf.data(), n));
+			left -= n;
+		}
+		std::string trailer(githlpr::sha1::raw_len, '\0');
+		if (not strm.read(trailer.data(), static_cast<std::streamsize>(trailer.size()))) {
+			return false;
+		}
+		const githlpr::sha1::digest_t digest{ctx.finish()};
+		if (trailer != std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size())) {
+			return false;
+		} else if (pack_ext == ext) {
+			return named == trailer;
+		}
+		std::string pack_sha1(githlpr::sha1::raw_len, '\0');
+		strm.seekg(static_cast<std::streamoff>(size - ntrailer));
+		return strm.read(pack_sha1.data(), static_cast<std::streamsize>(pack_sha1.size())) and named == pack_sha1;
+	}
+
+	githlpr::cache::stats_t read_stats(const std::filesystem::path& file)
+	{
+		githlpr::cache::stats_t stats{};
+		std::ifstream strm{file};
+		strm >> stats.hits >> stats.misses >> stats.hit_bytes >> stats.inserted_bytes >> stats.evictions;
+		return stats;
+	}
+}
+
+githlpr::cache::cache_t::cache_t(std::filesystem::path dir, const std::uint64_t max_size) : dir(std::move(dir)), max_size(max_size)
+{
+	std::filesystem::create_directories(this->dir);
+	stats = saved = read_stats(this->dir / stats_file);
+}
+
+std::optional<std::filesystem::path> githlpr::cache::cache_t::lookup(const std::string& key)
+{
+	if (not is_enabled()) {
+		return std::nullopt;
+	}
+	const std::filesystem::path entry{dir / key};
+	std::error_code err{};
+	const std::uintmax_t size{std::filesystem::file_size(entry, err)};
+	if (err or not is_valid_key(key)) {
+		stats.misses++;
+		return std::nullopt;
+	}
+	stats.hits++;
+	stats.hit_bytes += size;
+	std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), err); // LRU recency
+	return entry;
+}
+
+std::filesystem::path githlpr::cache::cache_t::get_tmp_path(const std::string& key) const
+{
+	// Concurrent fetches of the same pack each write their own file
+	return dir / (std::string(tmp_prefix) + key + "-" + std::to_string(::getpid()) + "-" + std::to_string(std::random_device{}()));
+}
+
+void githlpr::cache::cache_t::insert(const std::string& key, const std::filesystem::path& file)
+{
+	if (not is_enabled() or not is_valid_key(key)) {
+		std::filesystem::remove(file);
+		return;
+	} else if (not is_intact(key, file)) {
+		LOG_WARN("not caching " + key + ": it does not match its checksum");
+		std::filesystem::remove(file);
+		return;
+	}
+	stats.inserted_bytes += std::filesystem::file_size(file);
+	std::filesystem::rename(file, dir / key);
+	evict();
+}
+
+void githlpr::cache::cache_t::evict()
+{
+	std::vector<std::tuple<std::filesystem::file_time_type, std::uintmax_t, std::filesystem::path>> entries{};
+	std::uintmax_t total{};
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(dir)) {
+		const std::string name{entry.path().filename().string()};
+		if (entry.is_regular_file() and is_valid_key(name)) {
+			entries.emplace_back(entry.last_write_time(), entry.file_size(), entry.path());
+			total += entry.file_size();
+		}
+	}
+	std::sort(entries.begin(), entries.end()); // least recently used first
+	for (auto entry = entries.begin(); total > max_size and entries.end() != entry; entry++) {
+		LOG_DEBUG("evicting " + std::get<2>(*entry).string());
+		std::filesystem::remove(std::get<2>(*entry));
+		total -= std::get<1>(*entry);
+		stats.evictions++;
+	}
+}
+
+void githlpr::cache::cache_t::save_stats()
+{
+	// Concurrent helper runs add to the same file one after another
+	const proc::fd_t lock{::open((dir / stats_lock_file).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)};
+	if (not lock or -1 == ::flock(lock.get(), LOCK_EX)) {
+		return;
+	}
+	const stats_t current{read_stats(dir / stats_file)};
+	stats = {current.hits + stats.hits - saved.hits, current.misses + stats.misses - saved.misses, current.hit_bytes + stats.hit_bytes - saved.hit_bytes,
+		 current.inserted_bytes + stats.inserted_bytes - saved.inserted_bytes, current.evictions + stats.evictions - saved.evictions};
+	const std::filesystem::path tmp{get_tmp_path(std::string(stats_file))};
+	{
+		std::ofstream strm{tmp};
+		strm << stats.hits << ' ' << stats.misses << ' ' << stats.hit_bytes << ' ' << stats.inserted_bytes << ' ' << stats.evictions << '\n';
+	}
+	std::filesystem::rename(tmp, dir / stats_file);
+	saved = stats;
+}
+
+githlpr::cache::cache_t githlpr::cache::open()
+{
+	return cache_t(git::get_helper_dir() / "cache", config::get_size(size_env, default_max_size));
+}
@@ -0,0 +1,65 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace githlpr::cache
+{
+	inline constexpr std::string_view size_env{"GIT_REMOTE_RCLONE_CACHE_SIZE"}; // bytes, K/M/G suffix; 0 disables
+	inline constexpr std::uint64_t default_max_size{1024 * 1024 * 1024};
+	inline constexpr std::string_view stats_file{"stats"};
+	inline constexpr std::string_view stats_lock_file{"stats.lock"};
+	inline constexpr std::string_view tmp_prefix{"tmp-"};
+
+	/* Cumulative over all helper runs, so the cache size can be tuned from them */
+	struct stats_t {
+		std::uint64_t hits{};
+		std::uint64_t misses{};
+		std::uint64_t hit_bytes{};
+		std::uint64_t inserted_bytes{};
+		std::uint64_t evictions{};
+	};
+
+	/*
+	 * Directory of immutable remote objects keyed by their content hash (e.g. "pack-<sha1>.pack").
+	 * Least recently used entries are evicted once the cache grows beyond max_size.
+	 */
+	class cache_t {
+		const std::filesystem::path dir;
+		const std::uint64_t max_size;
+		stats_t stats{};
+		stats_t saved{}; // the stats file when read; other helper runs may have added to it since
+
+		void evict();
+	public:
+		cache_t(std::filesystem::path dir, std::uint64_t max_size);
+
+		bool is_enabled() const
+		{
+			return 0 != max_size;
+		}
+
+		const stats_t& get_stats() const
+		{
+			return stats;
+		}
+
+		/* Counts a hit or miss; a hit becomes the most recently used entry. A disabled cache has no entries and counts nothing */
+		std::optional<std::filesystem::path> lookup(const std::string& key);
+		/* Where to write an entry before insert() publishes it */
+		std::filesystem::path get_tmp_path(const std::string& key) const;
+		/* Moves file into the cache under key, then evicts down to max_size */
+		void insert(const std::string& key, const std::filesystem::path& file);
+		/* Adds the counts of this run to the stats file, under a lock so concurrent helper runs each add theirs */
+		void save_stats();
+	};
+
+	/* Cache of the current repository: $GIT_DIR/rclone/cache, capped by $GIT_REMOTE_RCLONE_CACHE_SIZE */
+	extern cache_t open();
+}
+
+#endif /* CACHE_HPP */
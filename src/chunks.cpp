@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+
+#include <unistd.h>
+
+#include "chunks.hpp"
+#include "config.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "proc.hpp"
+#include "remote.hpp"
+#include "sha1.hpp"
+#include "stats.hpp"
+
+namespace
+{
+	/* splitmix64; the table must never change, or chunks would no longer match those already on remotes */
+	constexpr std::array<std::uint64_t, 256> make_gear()
+	{
+		std::array<std::uint64_t, 256> gear{};
+		std::uint64_t state{};
+		for (std::uint64_t& value : gear) {
+			std::uint64_t z{state += 0x9e3779b97f4a7c15};
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+			value = z ^ (z >> 31);
+		}
+		return gear;
+	}
+
+	constexpr std::array<std::uint64_t, 256> gear{make_gear()};
+
+	/* The hash is shifted left per byte, so its high bits depend on the most bytes */
+	constexpr std::uint64_t high_bits(const unsigned n)
+	{
+		return ~std::uint64_t{} << (64 - n);
+	}
+
+	/* The gear hash at a byte depends only on it and the 63 bytes before it; older ones are shifted out */
+	constexpr std::size_t hash_window{64};
+	/* The lane scan hashes nlanes runs of lane_size bytes side by side */
+	constexpr std::size_t nlanes{4};
+	constexpr std::size_t lane_size{4096};
+
+	/* Gear hash after the bytes [start, end), computed from at most the last hash_window of them */
+	std::uint64_t get_hash(const std::uint8_t *const bytes, const std::size_t start, const std::size_t end)
+	{
+		std::uint64_t hash{};
+		for (std::size_t i{std::max(start, end - std::min(end, hash_window))}; i < end; i++) {
+			hash = (hash << 1) + gear[bytes[i]];
+		}
+		return hash;
+	}
+
+	std::size_t scan_scalar(const std::uint8_t *const bytes, const std::size_t start, const std::size_t begin,
+				const std::size_t end, const std::uint64_t mask)
+	{
+		std::uint64_t hash{get_hash(bytes, start, begin)};
+		for (std::size_t i{begin}; i < end; i++) {
+			hash = (hash << 1) + gear[bytes[i]];
+			if (not (hash & mask)) {
+				return i + 1;
+			}
+		}
+		return 0;
+	}
+
+	/*
+	 * Each lane takes its own run of bytes, so the lanes' shift-and-add chains are independent and the CPU overlaps
+	 * them, where scan_scalar() waits on one chain per byte. A stride that has a candidate is scanned again by
+	 * scan_scalar() for the first one; the tail shorter than a stride is left to it as well.
+	 */
+	std::size_t scan_lanes(const std::uint8_t *const bytes, const std::size_t start, std::size_t begin,
+			       const std::size_t end, const std::uint64_t mask)
+	{
+		constexpr std::size_t stride{nlanes * lane_size};
+		for (; end - begin >= stride; begin += stride) {
+			std::array<std::uint64_t, nlanes> hashes{};
+			for (std::size_t lane{}; lane < nlanes; lane++) {
+				hashes[lane] = get_hash(bytes, start, begin + lane * lane_size);
+			}
+			for (std::size_t i{begin}; i < begin + lane_size; i++) {
+				bool found{};
+#pragma GCC unroll 4 // nlanes; a rolled loop keeps the hashes in memory
+				for (std::size_t lane{}; lane < nlanes; lane++) {
+					hashes[lane] = (hashes[lane] << 1) + gear[bytes[i + lane * lane_size]];
+					found = found or not (hashes[lane] & mask);
+				}
+				if (found) {
+					return scan_scalar(bytes, start, begin, begin + stride, mask);
+				}
+			}
+		}
+		return scan_scalar(bytes, start, begin, end, mask);
+	}
+
+	std::string get_hex(githlpr::sha1::context_t& ctx)
+	{
+		const githlpr::sha1::digest_t digest{ctx.finish()};
+		return githlpr::sha1::to_hex(std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size()));
+	}
+
+	std::string get_path(const githlpr::chunks::chunk_t& chunk)
+	{
+		return std::string(githlpr::chunks::dir) + chunk.sha1;
+	}
+
+	std::string get_list_path(const std::string& pack_name)
+	{
+		return std::string(githlpr::manifest::packs_dir) + githlpr::chunks::get_list_name(pack_name);
+	}
+}
+
+githlpr::chunks::cdc_t::cdc_t(const std::uint64_t avg_size)
+{
+	unsigned bits{};
+	while (bits < 32 and (std::uint64_t{2} << bits) <= std::max(avg_size, min_cdc_size)) {
+		bits++;
+	}
+	this->avg_size = std::size_t{1} << bits;
+	min_size = this->avg_size / 4;
+	max_size = this->avg_size * 4;
+	mask_small = high_bits(bits + 2);
+	mask_large = high_bits(bits - 2);
+}
+
+std::size_t githlpr::chunks::cdc_t::find_cut(const std::string_view data) const
+{
+	return find_cut(data, scan_lanes);
+}
+
+std::size_t githlpr::chunks::cdc_t::find_cut_scalar(const std::string_view data) const
+{
+	return find_cut(data, scan_scalar);
+}
+
+std::size_t githlpr::chunks::cdc_t::find_cut(const std::string_view data, const scan_t scan) const
+{
+	const std::size_t size{std::min(data.size(), max_size)};
+	if (size <= min_size) {
+		return size;
+	}
+	// Cut points closer than min_size are never taken, so hashing starts there
+	const std::uint8_t *const bytes = reinterpret_cast<const std::uint8_t*>(data.data());
+	const std::size_t normal{std::min(size, avg_size)};
+	if (const std::size_t cut{scan(bytes, min_size, min_size, normal, mask_small)}) {
+		return cut;
+	}
+	if (const std::size_t cut{scan(bytes, min_size, normal, size, mask_large)}) {
+		return cut;
+	}
+	return size;
+}
+
+std::uint64_t githlpr::chunks::get_size()
+{
+	return config::get_size(size_env, default_size);
+}
+
+std::uint64_t githlpr::chunks::get_cdc_size()
+{
+	return config::get_size(cdc_size_env, 0);
+}
+
+std::string githlpr::chunks::get_list_name(const std::string_view pack_name)
+{
+	constexpr std::string_view pack_ext{".pack"};
+	std::string name{pack_name};
+	if (name.length() >= pack_ext.length() and 0 == name.compare(name.length() - pack_ext.length(), pack_ext.length(), pack_ext)) {
+		name.resize(name.length() - pack_ext.length());
+	}
+	return name.append(".chunks");
+}
+
+std::string githlpr::chunks::serialize(const std::vector<chunk_t>& chunks)
+{
+	std::string data{};
+	for (const chunk_t& chunk : chunks) {
+		data.append(chunk.sha1).append(" ").append(std::to_string(chunk.size)).append("\n");
+	}
+	return data;
+}
+
+std::vector<githlpr::chunks::chunk_t> githlpr::chunks::parse(const std::string_view data)
+{
+	std::vector<chunk_t> chunks{};
+	std::istringstream strm{std::string(data)};
+	for (chunk_t chunk{}; strm >> chunk.sha1 >> chunk.size;) {
+		(void)sha1::from_hex(chunk.sha1); // throws on anything but a sha1
+		chunks.push_back(chunk);
+	}
+	if (not strm.eof()) {
+		throw std::runtime_error("corrupt chunk list");
+	}
+	return chunks;
+}
+
+std::vector<githlpr::chunks::chunk_t> githlpr::chunks::read_list(remote::storage_t& storage, const std::string& pack_name)
+{
+	const std::optional<std::string> data{remote::read_object(storage, get_list_path(pack_name))};
+	if (not data) {
+		throw std::runtime_error("chunk list missing on remote: " + pack_name);
+	}
+	return parse(*data);
+}
+
+std::uint64_t githlpr::chunks::upload_file(remote::storage_t& storage, const std::string& pack_name, const std::filesystem::path& file, const std::uint64_t chunk_size,
+					   const std::uint64_t cdc_size)
+{
+	const stats::timer_t timer{stats::op_t::PACK_UPLOAD};
+	const std::map<std::string, std::uint64_t> present{storage.list(std::string(dir))};
+	std::optional<cdc_t> cdc{};
+	if (cdc_size) {
+		cdc.emplace(cdc_size);
+	}
+	const std::uint64_t window{cdc ? cdc->get_max_size() : chunk_size};
+	const std::uint64_t size{std::filesystem::file_size(file)};
+	std::ifstream strm{file, std::ios::binary};
+	std::vector<chunk_t> chunks{};
+	std::vector<std::pair<std::uint64_t, std::size_t>> skipped{}; // offset and index of chunks found on the remote
+	std::string buf{}; // the file from offset on, up to the longest chunk
+	for (std::uint64_t offset{}; offset < size;) {
+		const std::size_t nbuffered{buf.size()};
+		buf.resize(static_cast<std::size_t>(std::min(window, size - offset)));
+		if (buf.size() > nbuffered and not strm.read(buf.data() + nbuffered, static_cast<std::streamsize>(buf.size() - nbuffered))) {
+			throw std::runtime_error("cannot read " + file.string());
+		}
+		const std::string_view data{buf.data(), cdc ? cdc->find_cut(buf) : buf.size()};
+		sha1::context_t ctx{};
+		ctx.update(data);
+		const chunk_t& chunk = chunks.emplace_back(chunk_t{get_hex(ctx), data.size()});
+		if (const auto it = present.find(chunk.sha1); present.end() != it and it->second == chunk.size) {
+			LOG_DEBUG("chunk " + chunk.sha1 + " is on the remote already");
+			skipped.emplace_back(offset, chunks.size() - 1);
+		} else {
+			remote::write_object(storage, get_path(chunk), data);
+		}
+		offset += chunk.size;
+		buf.erase(0, static_cast<std::size_t>(chunk.size));
+	}
+	// The pack only exists once its list does; until then a retry finds the chunks uploaded so far
+	remote::write_object(storage, get_list_path(pack_name), serialize(chunks));
+	// Compactions delete chunks no list refers to; one may have deleted a found chunk before the list was written
+	if (not skipped.empty()) {
+		const std::map<std::string, std::uint64_t> listed{storage.list(std::string(dir))};
+		for (const auto& [offset, i] : skipped) {
+			if (listed.count(chunks[i].sha1)) {
+				continue;
+			}
+			LOG_DEBUG("chunk " + chunks[i].sha1 + " is gone from the remote");
+			std::string data(static_cast<std::size_t>(chunks[i].size), '\0');
+			strm.clear();
+			if (not strm.seekg(static_cast<std::streamoff>(offset)) or not strm.read(data.data(), static_cast<std::streamsize>(data.size()))) {
+				throw std::runtime_error("cannot read " + file.string());
+			}
+			remote::write_object(storage, get_path(chunks[i]), data);
+		}
+	}
+	return size;
+}
+
+std::uint64_t githlpr::chunks::stream(remote::storage_t& storage, const std::vector<chunk_t>& chunks, const int fd, const int copy)
+{
+	std::uint64_t total{};
+	std::array<char, 64 * 1024> buf{};
+	for (const chunk_t& chunk : chunks) {
+		const std::unique_ptr<remote::source_t> source{storage.open_read(get_path(chunk))};
+		sha1::context_t ctx{};
+		std::uint64_t nbytes{};
+		for (;;) {
+			const ssize_t nread = ::read(source->fd(), buf.data(), buf.size());
+			if (-1 == nread) {
+				if (EINTR == errno) {
+					continue;
+				}
+				proc::throw_errno("cannot read remote chunk " + chunk.sha1);
+			} else if (0 == nread) {
+				break;
+			}
+			const std::string_view data{buf.data(), static_cast<std::size_t>(nread)};
+			ctx.update(data);
+			proc::write_all(fd, data);
+			if (-1 != copy) {
+				proc::write_all(copy, data);
+			}
+			nbytes += data.size();
+		}
+		if (not source->finish()) {
+			throw std::runtime_error("chunk missing on remote: " + chunk.sha1);
+		} else if (chunk.size != nbytes or chunk.sha1 != get_hex(ctx)) {
+			throw std::runtime_error("corrupt chunk: " + chunk.sha1);
+		}
+		total += nbytes;
+	}
+	return total;
+}
+
+std::string githlpr::chunks::read_range(remote::storage_t& storage, const std::vector<chunk_t>& chunks, const std::uint64_t offset, const std::uint64_t count)
+{
+	const std::uint64_t end{offset + count};
+	std::string data{};
+	std::uint64_t start{};
+	for (auto chunk = chunks.begin(); chunks.end() != chunk and start < end; start += chunk->size, ++chunk) {
+		if (start + chunk->size <= offset) {
+			continue;
+		}
+		const std::uint64_t from{std::max(offset, start) - start};
+		data.append(remote::read_range(storage, get_path(*chunk), from, std::min(end - start, chunk->size) - from));
+	}
+	if (count != data.size()) {
+		throw std::runtime_error("chunked pack is shorter than expected");
+	}
+	return data;
+}
+
+std::optional<std::vector<githlpr::chunks::chunk_t>> githlpr::chunks::remove_list(remote::storage_t& storage, const std::string& pack_name)
+{
+	const std::optional<std::string> data{remote::read_object(storage, get_list_path(pack_name))};
+	if (not data) {
+		return std::nullopt;
+	}
+	std::vector<chunk_t> chunks{parse(*data)};
+	storage.remove(get_list_path(pack_name));
+	return chunks;
+}
+
+std::set<std::string> githlpr::chunks::list_referenced(remote::storage_t& storage)
+{
+	constexpr std::string_view suffix{".chunks"};
+	std::set<std::string> sha1s{};
+	for (const auto& object : storage.list(std::string(manifest::packs_dir))) {
+		const std::string& name = object.first;
+		if (name.length() <= suffix.length() or 0 != name.compare(name.length() - suffix.length(), suffix.length(), suffix)) {
+			continue;
+		}
+		// A list removed since the listing refers to nothing any more
+		if (const std::optional<std::string> data{remote::read_object(storage, std::string(manifest::packs_dir) + name)}) {
+			for (const chunk_t& chunk : parse(*data)) {
+				sha1s.insert(chunk.sha1);
+			}
+		}
+	}
+	return sha1s;
+}
@@ -0,0 +1,89 @@
+#ifndef CHUNKS_HPP
+#define CHUNKS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "remote.hpp"
+
+/* Large packs are stored as chunk objects named by their sha1 plus a list of them, so an interrupted upload resumes */
+namespace githlpr::chunks
+{
+	inline constexpr std::string_view dir{"chunks/"};
+	inline constexpr std::string_view size_env{"GIT_REMOTE_RCLONE_UPLOAD_CHUNK_SIZE"};
+	inline constexpr std::string_view cdc_size_env{"GIT_REMOTE_RCLONE_CDC_SIZE"};
+	inline constexpr std::uint64_t default_size{64 * 1024 * 1024};
+	inline constexpr std::uint64_t min_cdc_size{256};
+
+	struct chunk_t {
+		std::string sha1{}; // of the chunk's bytes; also its object name below dir
+		std::uint64_t size{};
+	};
+
+	/*
+	 * Content-defined chunking (FastCDC): a gear hash over the bytes picks the cut points, so chunks of data that
+	 * moved, e.g. when a repack inserts or drops objects before it, stay the same. Chunks are between a quarter and
+	 * four times the average size; normalized chunking makes cuts unlikely before the average and likely after it.
+	 */
+	class cdc_t {
+		std::size_t min_size;
+		std::size_t avg_size;
+		std::size_t max_size;
+		std::uint64_t mask_small; // more bits to match below the average size
+		std::uint64_t mask_large;
+
+		/* Position after the first byte in [begin, end) whose hash from start has no bit of mask set, or 0 */
+		using scan_t = std::size_t (*)(const std::uint8_t *bytes, std::size_t start, std::size_t begin, std::size_t end,
+					      std::uint64_t mask);
+		std::size_t find_cut(std::string_view data, scan_t scan) const;
+	public:
+		/* avg_size is rounded down to a power of 2, and at least min_cdc_size */
+		explicit cdc_t(std::uint64_t avg_size);
+
+		std::size_t get_max_size() const
+		{
+			return max_size;
+		}
+
+		/* Length of the chunk data starts with; all of data if it ends before a cut point */
+		std::size_t find_cut(std::string_view data) const;
+		/* Same as find_cut(), hashing one byte at a time instead of in lanes */
+		std::size_t find_cut_scalar(std::string_view data) const;
+	};
+
+	/* From $GIT_REMOTE_RCLONE_UPLOAD_CHUNK_SIZE; 0 uploads every pack whole */
+	extern std::uint64_t get_size();
+	/* From $GIT_REMOTE_RCLONE_CDC_SIZE; 0 (the default) cuts chunks at fixed sizes */
+	extern std::uint64_t get_cdc_size();
+	/* "pack-<hash>.pack" -> "pack-<hash>.chunks" */
+	extern std::string get_list_name(std::string_view pack_name);
+	/* One "<sha1> <size>" line per chunk, in file order */
+	extern std::string serialize(const std::vector<chunk_t>& chunks);
+	extern std::vector<chunk_t> parse(std::string_view data);
+	/* Chunks of a remote pack; throws if the pack is not chunked */
+	extern std::vector<chunk_t> read_list(remote::storage_t& storage, const std::string& pack_name);
+	/*
+	 * Uploads file as chunk_size byte chunks, or as content-defined chunks of about cdc_size bytes unless it is 0, then their
+	 * list for pack_name. Chunks the remote already has in full, e.g. from an interrupted upload of the same pack or, with
+	 * content-defined chunks, from a pack the objects were in before a repack, are not uploaded again; those that are gone once
+	 * the list refers to them, deleted by a compaction meanwhile, are uploaded after all. Returns the size of file.
+	 */
+	extern std::uint64_t upload_file(remote::storage_t& storage, const std::string& pack_name, const std::filesystem::path& file, std::uint64_t chunk_size,
+					 std::uint64_t cdc_size = 0);
+	/* Writes the chunks to fd, and to copy unless it is -1, as they download; throws once a chunk does not match its sha1 */
+	extern std::uint64_t stream(remote::storage_t& storage, const std::vector<chunk_t>& chunks, int fd, int copy = -1);
+	/* count bytes at offset of the file the chunks make up */
+	extern std::string read_range(remote::storage_t& storage, const std::vector<chunk_t>& chunks, std::uint64_t offset, std::uint64_t count);
+	/* Removes the chunk list of pack_name and returns its chunks, which other packs may share; std::nullopt if the pack is not chunked */
+	extern std::optional<std::vector<chunk_t>> remove_list(remote::storage_t& storage, const std::string& pack_name);
+	/* sha1s of the chunks that any chunk list on the remote refers to, including those of pushes not in the manifest yet */
+	extern std::set<std::string> list_referenced(remote::storage_t& storage);
+}
+
+#endif /* CHUNKS_HPP */
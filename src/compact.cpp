@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include "cache.hpp"
+#include "chunks.hpp"
+#include "compact.hpp"
+#include "config.hpp"
+#include "fetch.hpp"
+#include "git.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "packidx.hpp"
+#include "proc.hpp"
+#include "push.hpp"
+#include "remote.hpp"
+#include "trace.hpp"
+
+namespace
+{
+	struct garbage_t {
+		std::int64_t time{};
+		std::string name{};
+	};
+
+	std::int64_t get_time()
+	{
+		return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	std::vector<garbage_t> read_garbage(githlpr::remote::storage_t& storage)
+	{
+		std::vector<garbage_t> garbage{};
+		std::istringstream strm{githlpr::remote::read_object(storage, std::string(githlpr::compact::garbage_path)).value_or("")};
+		for (garbage_t entry{}; strm >> entry.time >> entry.name;) {
+			garbage.push_back(entry);
+		}
+		return garbage;
+	}
+
+	void write_garbage(githlpr::remote::storage_t& storage, const std::vector<garbage_t>& garbage)
+	{
+		std::string data{};
+		for (const garbage_t& entry : garbage) {
+			data.append(std::to_string(entry.time)).append(" ").append(entry.name).append("\n");
+		}
+		githlpr::remote::write_object(storage, std::string(githlpr::compact::garbage_path), data);
+	}
+
+	/* The grace period of an object already listed starts over: something referred to it until now */
+	void add_garbage(std::vector<garbage_t>& garbage, const std::int64_t now, const std::string& name)
+	{
+		if (const auto entry = std::find_if(garbage.begin(), garbage.end(), [&name](const garbage_t& entry) { return entry.name == name; }); garbage.end() != entry) {
+			entry->time = now;
+		} else {
+			garbage.push_back({now, name});
+		}
+	}
+
+	bool is_chunk(const std::string& name)
+	{
+		return 0 == name.compare(0, githlpr::chunks::dir.length(), githlpr::chunks::dir);
+	}
+
+	/*
+	 * Removes a pack and its index, if it has one, or its chunk list if it is chunked. Its chunks become garbage: a push
+	 * may have found them on the remote and be about to refer to them, so they are only deleted a grace period later.
+	 */
+	void remove_pack(githlpr::remote::storage_t& storage, const std::string& name, std::vector<garbage_t>& garbage, const std::int64_t now)
+	{
+		if (const std::optional<std::vector<githlpr::chunks::chunk_t>> chunks{githlpr::chunks::remove_list(storage, name)}) {
+			for (const githlpr::chunks::chunk_t& chunk : *chunks) {
+				add_garbage(garbage, now, std::string(githlpr::chunks::dir) + chunk.sha1);
+			}
+		} else {
+			storage.remove(std::string(githlpr::manifest::packs_dir) + name);
+		}
+		storage.remove(std::string(githlpr::manifest::packs_dir) + githlpr::packidx::get_index_name(name));
+	}
+
+	/* "tmp-<unix time>-<nonce>.pack" that a push started streaming more than grace seconds ago but never renamed */
+	bool is_abandoned(const std::string& name, const std::int64_t now, const std::int64_t grace)
+	{
+		if (0 != name.compare(0, githlpr::push::tmp_prefix.length(), githlpr::push::tmp_prefix)) {
+			return false;
+		}
+		return now - std::strtoll(name.c_str() + githlpr::push::tmp_prefix.length(), nullptr, 10) >= grace;
+	}
+
+	bool is_listed(const std::vector<githlpr::manifest::pack_t>& packs, const std::string& name)
+	{
+		return packs.end() != std::find_if(packs.begin(), packs.end(), [&name](const githlpr::manifest::pack_t& pack) {
+			return pack.name == name or pack.tree_pack == name;
+		});
+	}
+
+	void add_unique(std::vector<std::string>& names, const std::string& name)
+	{
+		if (names.end() == std::find(names.begin(), names.end(), name)) {
+			names.push_back(name);
+		}
+	}
+
+	/* Downloads packs into a scratch repository and packs their objects into one pack, which is uploaded */
+	githlpr::manifest::pack_t merge_packs(githlpr::remote::storage_t& storage, const std::vector<githlpr::manifest::pack_t>& packs)
+	{
+		const githlpr::trace::span_t span{"merge packs"};
+		const githlpr::git::scratch_repo_t repo{};
+		githlpr::cache::cache_t cache{repo.get_dir() / "cache", 0}; // the scratch repository is gone afterwards
+		const std::vector<std::string> env{repo.get_env()};
+		githlpr::fetch::fetch_packs(storage, cache, packs, false, env);
+
+		githlpr::manifest::pack_t merged{};
+		std::vector<std::string> prereqs{};
+		for (const githlpr::manifest::pack_t& pack : packs) {
+			for (const std::string& tip : pack.tips) {
+				add_unique(merged.tips, tip);
+			}
+			for (const std::string& prereq : pack.prereqs) {
+				add_unique(prereqs, prereq);
+			}
+		}
+		// Prerequisites of newer packs met by older merged packs are now inside the merged pack
+		const std::vector<std::optional<std::string>> present{githlpr::git::resolve(prereqs, env)};
+		for (std::size_t i{}; i < prereqs.size(); i++) {
+			if (not present[i]) {
+				merged.prereqs.push_back(prereqs[i]);
+			}
+		}
+
+		const std::filesystem::path tmp_dir{repo.get_dir() / "tmp"};
+		const std::string hash{githlpr::git::pack_all_objects(tmp_dir, {}, env)};
+		LOG_DEBUG("uploading pack-" + hash + ".pack merging " + std::to_string(packs.size()) + " packs");
+		githlpr::push::upload_pack_files(storage, tmp_dir, hash, merged, env);
+		return merged;
+	}
+}
+
+githlpr::compact::options_t githlpr::compact::get_options()
+{
+	options_t options{config::get_count(factor_env, default_factor), config::get_duration(grace_env, default_grace)};
+	options.factor = std::max(2u, options.factor);
+	return options;
+}
+
+std::size_t githlpr::compact::plan(const std::vector<manifest::pack_t>& packs, const unsigned factor)
+{
+	const std::size_t npacks{packs.size()};
+	if (npacks < 2) {
+		return npacks;
+	}
+	// Packs older than the merged run must already shrink geometrically towards the newest
+	std::size_t first_small{};
+	while (first_small + 1 < npacks and packs[first_small].size >= factor * packs[first_small + 1].size) {
+		first_small++;
+	}
+	// Merge as few of the newest packs as possible such that the next older pack is factor times their total
+	std::uint64_t merged{};
+	for (std::size_t start{npacks - 1}; start > 0; start--) {
+		merged += packs[start].size;
+		if (start <= first_small + 1 and packs[start - 1].size >= factor * merged) {
+			return npacks - 1 == start ? npacks : start;
+		}
+	}
+	return 0;
+}
+
+githlpr::compact::result_t githlpr::compact::compact(remote::storage_t& storage, const options_t& options)
+{
+	result_t result{};
+	const std::int64_t now{get_time()};
+	const manifest::manifest_t manifest{manifest::read(storage)};
+
+	// Superseded packs are deleted once no fetch can still be working from a manifest that lists them
+	std::vector<garbage_t> garbage{};
+	std::vector<std::string> expired{}, expired_chunks{};
+	for (const garbage_t& entry : read_garbage(storage)) {
+		if (now - entry.time < options.grace or is_listed(manifest.packs, entry.name)) {
+			garbage.push_back(entry);
+		} else {
+			(is_chunk(entry.name) ? expired_chunks : expired).push_back(entry.name);
+		}
+	}
+	for (const std::string& name : expired) {
+		LOG_DEBUG("deleting " + name);
+		remove_pack(storage, name, garbage, now);
+		result.deleted++;
+	}
+	// Chunks that packs, listed or being pushed, still or again refer to are kept; they become garbage again with those packs
+	if (not expired_chunks.empty()) {
+		const std::set<std::string> referenced{githlpr::chunks::list_referenced(storage)};
+		for (const std::string& name : expired_chunks) {
+			if (not referenced.count(name.substr(githlpr::chunks::dir.length()))) {
+				LOG_DEBUG("deleting " + name);
+				storage.remove(name);
+				result.deleted_chunks++;
+			}
+		}
+	}
+	for (const auto& object : storage.list(std::string(manifest::packs_dir))) {
+		if (is_abandoned(object.first, now, options.grace)) {
+			LOG_DEBUG("deleting " + object.first);
+			storage.remove(std::string(manifest::packs_dir) + object.first);
+			result.deleted++;
+		}
+	}
+
+	const std::size_t start{plan(manifest.packs, options.factor)};
+	if (start < manifest.packs.size()) {
+		const std::vector<manifest::pack_t> merge{manifest.packs.begin() + static_cast<std::ptrdiff_t>(start), manifest.packs.end()};
+		const manifest::pack_t merged{merge_packs(storage, merge)};
+
+		// Pushes may have added packs in the meantime; those are kept after the merged pack
+		manifest::manifest_t updated{manifest};
+		bool unchanged{true};
+		manifest::update(storage, updated, [&](manifest::manifest_t& latest) {
+			unchanged = latest.packs.size() >= manifest.packs.size() and std::equal(manifest.packs.begin(), manifest.packs.end(), latest.packs.begin(),
+					[](const manifest::pack_t& a, const manifest::pack_t& b) { return a.name == b.name; });
+			if (unchanged) {
+				latest.packs.erase(latest.packs.begin() + static_cast<std::ptrdiff_t>(start), latest.packs.begin() + static_cast<std::ptrdiff_t>(manifest.packs.size()));
+				latest.packs.insert(latest.packs.begin() + static_cast<std::ptrdiff_t>(start), merged);
+			}
+			return unchanged;
+		});
+		if (not unchanged) {
+			remove_pack(storage, merged.name, garbage, now);
+			if (merged.tree_pack != merged.name) {
+				remove_pack(storage, merged.tree_pack, garbage, now);
+			}
+			write_garbage(storage, garbage);
+			throw std::runtime_error("remote packs changed during compaction");
+		}
+		for (const manifest::pack_t& pack : merge) {
+			for (const std::string& name : {pack.name, pack.tree_pack}) {
+				if (not name.empty() and not is_listed(updated.packs, name)) {
+					add_garbage(garbage, now, name);
+				}
+			}
+		}
+		result.merged = merge.size();
+	}
+	if (not expired.empty() or not expired_chunks.empty() or result.merged) {
+		write_garbage(storage, garbage);
+	}
+	result.pruned = manifest::prune(storage);
+	return result;
+}
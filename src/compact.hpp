@@ -0,0 +1,43 @@
+#ifndef COMPACT_HPP
+#define COMPACT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "manifest.hpp"
+#include "remote.hpp"
+
+namespace githlpr::compact
+{
+	inline constexpr std::string_view garbage_path{"garbage"}; // "<unix time> <pack name>" per superseded pack, "<unix time> chunks/<sha1>" per chunk
+	inline constexpr std::string_view factor_env{"GIT_REMOTE_RCLONE_COMPACT_FACTOR"};
+	inline constexpr std::string_view grace_env{"GIT_REMOTE_RCLONE_COMPACT_GRACE"}; // seconds, or config::parse_duration()'s suffixes
+	inline constexpr unsigned default_factor{2};
+	inline constexpr std::int64_t default_grace{24 * 60 * 60};
+
+	struct options_t {
+		unsigned factor{default_factor};
+		std::int64_t grace{default_grace}; // superseded packs stay for fetches that read the previous manifest
+	};
+
+	struct result_t {
+		std::size_t merged{}; // packs replaced by one new pack
+		std::size_t deleted{}; // superseded packs, and packs abandoned by pushes, past their grace period
+		std::size_t deleted_chunks{}; // chunks of deleted packs that no chunk list referred to for the grace period
+		std::size_t pruned{}; // manifests, see manifest::prune()
+	};
+
+	extern options_t get_options();
+	/*
+	 * Index of the oldest pack to merge with all newer ones, packs.size() if nothing needs merging. Afterwards
+	 * every pack is at least factor times the size of the next newer one (like git repack --geometric), so a
+	 * remote holds O(log pushes) packs.
+	 */
+	extern std::size_t plan(const std::vector<manifest::pack_t>& packs, unsigned factor);
+	/* Merges the packs plan() picks, then deletes packs superseded by earlier runs or abandoned by pushes, and old manifests */
+	extern result_t compact(remote::storage_t& storage, const options_t& options);
+}
+
+#endif /* COMPACT_HPP */
@@ -0,0 +1,97 @@
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <cctype>
+#include <cstdlib>
+
+#include "config.hpp"
+
+namespace
+{
+	const char* get_env(const std::string_view name)
+	{
+		return std::getenv(std::string(name).c_str());
+	}
+}
+
+std::uint64_t githlpr::config::parse_size(const std::string_view size)
+{
+	std::size_t pos{};
+	std::uint64_t value{};
+	try {
+		value = std::stoull(std::string(size), &pos);
+	} catch (const std::logic_error&) {
+		throw std::runtime_error("invalid size: " + std::string(size));
+	}
+	const std::string_view suffix{size.substr(pos)};
+	if (suffix.empty()) {
+		return value;
+	} else if ("K" == suffix or "k" == suffix) {
+		return value << 10;
+	} else if ("M" == suffix or "m" == suffix) {
+		return value << 20;
+	} else if ("G" == suffix or "g" == suffix) {
+		return value << 30;
+	}
+	throw std::runtime_error("invalid size: " + std::string(size));
+}
+
+std::uint64_t githlpr::config::get_size(const std::string_view name, const std::uint64_t fallback)
+{
+	const char *const cvalue = get_env(name);
+	return cvalue ? parse_size(cvalue) : fallback;
+}
+
+std::int64_t githlpr::config::parse_duration(const std::string_view duration)
+{
+	std::size_t pos{};
+	std::int64_t value{};
+	try {
+		value = std::stoll(std::string(duration), &pos);
+	} catch (const std::logic_error&) {
+		throw std::runtime_error("invalid duration: " + std::string(duration));
+	}
+	const std::string_view suffix{duration.substr(pos)};
+	std::int64_t unit{};
+	if (suffix.empty() or "s" == suffix) {
+		unit = 1;
+	} else if ("m" == suffix) {
+		unit = 60;
+	} else if ("h" == suffix) {
+		unit = 60 * 60;
+	} else if ("d" == suffix) {
+		unit = 24 * 60 * 60;
+	}
+	if (0 == unit or not std::isdigit(static_cast<unsigned char>(duration.front())) or value > std::numeric_limits<std::int64_t>::max() / unit) {
+		throw std::runtime_error("invalid duration: " + std::string(duration));
+	}
+	return value * unit;
+}
+
+std::int64_t githlpr::config::get_duration(const std::string_view name, const std::int64_t fallback)
+{
+	const char *const cvalue = get_env(name);
+	if (not cvalue) {
+		return fallback;
+	}
+	try {
+		return parse_duration(cvalue);
+	} catch (const std::runtime_error&) {
+		throw std::runtime_error("invalid " + std::string(name) + ": " + std::string(cvalue) + " (seconds, or with an s, m, h or d suffix)");
+	}
+}
+
+unsigned githlpr::config::get_count(const std::string_view name, const unsigned fallback)
+{
+	const char *const cvalue = get_env(name);
+	if (not cvalue) {
+		return fallback;
+	}
+	const std::uint64_t value{parse_size(cvalue)};
+	if (value > std::numeric_limits<unsigned>::max()) {
+		throw std::runtime_error("invalid count: " + std::string(cvalue));
+	}
+	return static_cast<unsigned>(value);
+}
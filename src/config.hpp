@@ -0,0 +1,21 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <cstdint>
+#include <string_view>
+
+/* Tunables are read from GIT_REMOTE_RCLONE_* environment variables */
+namespace githlpr::config
+{
+	/* "512", "64K", "16M", "1G" */
+	extern std::uint64_t parse_size(std::string_view size);
+	/* Value of the environment variable name, or fallback if it is unset */
+	extern std::uint64_t get_size(std::string_view name, std::uint64_t fallback);
+	extern unsigned get_count(std::string_view name, unsigned fallback);
+	/* Seconds of "90", "90s", "15m", "2h", "1d" */
+	extern std::int64_t parse_duration(std::string_view duration);
+	/* As get_size(); an invalid value is reported with name */
+	extern std::int64_t get_duration(std::string_view name, std::int64_t fallback);
+}
+
+#endif /* CONFIG_HPP */
@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.hpp"
+#include "daemon.hpp"
+#include "log.hpp"
+#include "proc.hpp"
+#include "rc.hpp"
+#include "sha1.hpp"
+
+extern char **environ;
+
+namespace
+{
+	constexpr std::size_t max_request_size{1024 * 1024};
+	constexpr std::size_t nstdio{3};
+	constexpr std::chrono::seconds start_timeout{2};
+	constexpr std::chrono::milliseconds start_poll_interval{10};
+	constexpr std::chrono::milliseconds reap_interval{100};
+	constexpr char accepted{'+'};
+
+	/* Names the daemon by user and by build, so a helper is only ever run by the binary it was started as */
+	std::string get_name()
+	{
+		struct stat exe{};
+		if (-1 == ::stat("/proc/self/exe", &exe)) {
+			githlpr::proc::throw_errno("cannot stat /proc/self/exe");
+		}
+		githlpr::sha1::context_t ctx{};
+		ctx.update(std::to_string(exe.st_dev) + ":" + std::to_string(exe.st_ino) + ":" + std::to_string(exe.st_size) + ":" +
+			   std::to_string(exe.st_mtim.tv_sec) + "." + std::to_string(exe.st_mtim.tv_nsec));
+		const githlpr::sha1::digest_t digest{ctx.finish()};
+		return "git-remote-rclone-" + std::to_string(::getuid()) + "-" +
+		       githlpr::sha1::to_hex(std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size())).substr(0, 16);
+	}
+
+	/* Abstract: no file to clean up, gone with the daemon */
+	std::pair<sockaddr_un, socklen_t> get_addr()
+	{
+		const std::string name{get_name()};
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		std::copy(name.begin(), name.end(), addr.sun_path + 1);
+		return {addr, static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.length())};
+	}
+
+	githlpr::proc::fd_t create_socket()
+	{
+		githlpr::proc::fd_t fd{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+		if (not fd) {
+			githlpr::proc::throw_errno("cannot create socket");
+		}
+		return fd;
+	}
+
+	/* Anyone may connect to an abstract socket, so both ends check that the other runs as the same user */
+	bool is_own(const githlpr::proc::fd_t& fd)
+	{
+		ucred cred{};
+		socklen_t len{sizeof(cred)};
+		return 0 == ::getsockopt(fd.get(), SOL_SOCKET, SO_PEERCRED, &cred, &len) and ::getuid() == cred.uid;
+	}
+
+	std::optional<unsigned char> read_byte(const githlpr::proc::fd_t& fd)
+	{
+		unsigned char byte{};
+		for (;;) {
+			const ssize_t nread = ::read(fd.get(), &byte, 1);
+			if (-1 == nread and EINTR == errno) {
+				continue;
+			}
+			return 1 == nread ? std::optional<unsigned char>{byte} : std::nullopt;
+		}
+	}
+
+	/* "<size>\n<request>", with the helper's stdio passed along with its first byte */
+	void send_request(const githlpr::proc::fd_t& fd, const std::string& request)
+	{
+		const std::string frame{std::to_string(request.size()) + "\n" + request};
+		std::array<int, nstdio> fds{{STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO}};
+		alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(fds))> control{};
+		iovec iov{const_cast<char*>(frame.data()), frame.size()};
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+		cmsghdr *const cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(fds));
+		ssize_t nsent{};
+		while (-1 == (nsent = ::sendmsg(fd.get(), &msg, MSG_NOSIGNAL))) {
+			if (EINTR != errno) {
+				githlpr::proc::throw_errno("cannot send request to the daemon");
+			}
+		}
+		githlpr::proc::write_all(fd.get(), std::string_view(frame).substr(static_cast<std::size_t>(nsent)));
+	}
+
+	githlpr::daemon::request_t receive_request(const githlpr::proc::fd_t& fd, std::array<githlpr::proc::fd_t, nstdio>& stdio)
+	{
+		std::array<char, 64 * 1024> buf{};
+		alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int) * nstdio)> control{};
+		iovec iov{buf.data(), buf.size()};
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data();
+		msg.msg_controllen = control.size();
+		ssize_t nread{};
+		while (-1 == (nread = ::recvmsg(fd.get(), &msg, MSG_CMSG_CLOEXEC))) {
+			if (EINTR != errno) {
+				githlpr::proc::throw_errno("cannot receive request");
+			}
+		}
+		for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (SOL_SOCKET == cmsg->cmsg_level and SCM_RIGHTS == cmsg->cmsg_type) {
+				const std::size_t nfds{(cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int)};
+				for (std::size_t i{}; i < nfds; i++) {
+					int passed{};
+					std::memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+					githlpr::proc::fd_t owned{passed};
+					if (i < nstdio) {
+						stdio[i] = std::move(owned);
+					}
+				}
+			}
+		}
+		if (std::any_of(stdio.begin(), stdio.end(), [](const githlpr::proc::fd_t& passed) { return not passed; })) {
+			throw std::runtime_error("request without stdio");
+		}
+		std::string frame(buf.data(), static_cast<std::size_t>(nread));
+		std::size_t newline{};
+		while (std::string::npos == (newline = frame.find('\n')) and frame.size() < 32) {
+			if (0 == (nread = ::read(fd.get(), buf.data(), buf.size()))) {
+				throw std::runtime_error("truncated request");
+			} else if (-1 == nread and EINTR != errno) {
+				githlpr::proc::throw_errno("cannot receive request");
+			}
+			frame.append(buf.data(), static_cast<std::size_t>(std::max<ssize_t>(nread, 0)));
+		}
+		const std::size_t size{std::string::npos == newline ? max_request_size + 1 : std::stoul(frame.substr(0, newline))};
+		if (size > max_request_size) {
+			throw std::runtime_error("request too large");
+		}
+		while (frame.size() < newline + 1 + size) {
+			if (0 == (nread = ::read(fd.get(), buf.data(), buf.size()))) {
+				throw std::runtime_error("truncated request");
+			} else if (-1 == nread and EINTR != errno) {
+				githlpr::proc::throw_errno("cannot receive request");
+			}
+			frame.append(buf.data(), static_cast<std::size_t>(std::max<ssize_t>(nread, 0)));
+		}
+		return githlpr::daemon::parse(std::string_view(frame).substr(newline + 1, size));
+	}
+
+	/* The daemon is not a child of the helper that starts it, so git does not wait for it */
+	void start()
+	{
+		const pid_t pid = ::fork();
+		if (0 == pid) {
+			::setsid();
+			if (0 == ::fork()) {
+				const int null = ::open("/dev/null", O_RDWR);
+				for (int fd{}; fd < static_cast<int>(nstdio); fd++) {
+					::dup2(null, fd);
+				}
+				if (0 == ::chdir("/")) {
+					::execl("/proc/self/exe", "git-remote-rclone", "--daemon", nullptr);
+				}
+				::_exit(EXIT_FAILURE);
+			}
+			::_exit(EXIT_SUCCESS);
+		} else if (-1 != pid) {
+			while (-1 == ::waitpid(pid, nullptr, 0) and EINTR == errno) {}
+		}
+	}
+
+	std::optional<githlpr::proc::fd_t> connect_daemon()
+	{
+		const auto [addr, len] = get_addr();
+		githlpr::proc::fd_t fd{create_socket()};
+		if (-1 == ::connect(fd.get(), reinterpret_cast<const sockaddr*>(&addr), len)) {
+			return std::nullopt;
+		}
+		return fd;
+	}
+
+	/* Variables rclone reads its configuration from; a helper may only use the daemon's rcd if they match */
+	std::vector<std::string> get_rclone_env(const std::vector<std::string>& env)
+	{
+		std::vector<std::string> rclone_env{};
+		for (const std::string& var : env) {
+			const std::string_view name{std::string_view(var).substr(0, var.find('='))};
+			if (0 == name.compare(0, 7, "RCLONE_") or "PATH" == name or "HOME" == name or "XDG_CONFIG_HOME" == name or "XDG_CACHE_HOME" == name) {
+				rclone_env.push_back(var);
+			}
+		}
+		std::sort(rclone_env.begin(), rclone_env.end());
+		return rclone_env;
+	}
+
+	std::vector<std::string> get_env()
+	{
+		std::vector<std::string> env{};
+		for (char **var = environ; var and *var; var++) {
+			env.emplace_back(*var);
+		}
+		return env;
+	}
+
+	/* An rcd listening in a directory only this user can enter */
+	struct rcd_t {
+		std::optional<githlpr::proc::child_t> child{};
+		std::filesystem::path socket{};
+		std::vector<std::string> env{};
+	};
+
+	rcd_t start_rcd()
+	{
+		rcd_t rcd{};
+		const char *const cruntime_dir = std::getenv("XDG_RUNTIME_DIR");
+		const std::filesystem::path dir{std::filesystem::path(cruntime_dir and '\0' != *cruntime_dir ? cruntime_dir : "/tmp") /
+						("git-remote-rclone-" + std::to_string(::getuid()))};
+		struct stat st{};
+		if ((-1 == ::mkdir(dir.c_str(), 0700) and EEXIST != errno) or -1 == ::lstat(dir.c_str(), &st) or not S_ISDIR(st.st_mode)
+		    or ::getuid() != st.st_uid or (st.st_mode & 077)) {
+			LOG_WARN("not running rclone rcd: " + dir.string() + " is not a private directory");
+			return rcd;
+		}
+		rcd.socket = dir / ("rcd-" + std::to_string(::getpid()) + ".sock");
+		rcd.env = get_rclone_env(get_env());
+		try {
+			rcd.child = githlpr::rc::start(rcd.socket);
+		} catch (const std::runtime_error& err) {
+			LOG_WARN(std::string("not running rclone rcd: ") + err.what());
+		}
+		return rcd;
+	}
+
+	int exit_code{EXIT_FAILURE};
+	int exit_report_fd{-1};
+
+	/* Registered before the helper runs, so it runs after the helper's own exit handlers, e.g. those writing stats */
+	void report_exit()
+	{
+		const unsigned char code{static_cast<unsigned char>(exit_code)};
+		while (-1 == ::send(exit_report_fd, &code, 1, MSG_NOSIGNAL) and EINTR == errno) {}
+	}
+
+	/* In the forked child: becomes the helper the request came from */
+	[[noreturn]] void run_helper(githlpr::proc::fd_t connection, const githlpr::daemon::helper_t& helper, const rcd_t& rcd)
+	{
+		try {
+			std::array<githlpr::proc::fd_t, nstdio> stdio{};
+			const githlpr::daemon::request_t request{receive_request(connection, stdio)};
+			::clearenv();
+			for (const std::string& var : request.env) {
+				const std::size_t eq{var.find('=')};
+				if (std::string::npos != eq and 0 != eq) {
+					::setenv(var.substr(0, eq).c_str(), var.c_str() + eq + 1, 1);
+				}
+			}
+			if (rcd.child and rcd.env == get_rclone_env(request.env)) {
+				::setenv(std::string(githlpr::rc::socket_env).c_str(), rcd.socket.c_str(), 1);
+			}
+			if (-1 == ::chdir(request.cwd.c_str())) {
+				githlpr::proc::throw_errno("cannot change to " + request.cwd);
+			}
+			for (std::size_t fd{}; fd < nstdio; fd++) {
+				if (-1 == ::dup2(stdio[fd].get(), static_cast<int>(fd))) {
+					githlpr::proc::throw_errno("cannot take over stdio");
+				}
+			}
+			githlpr::proc::write_all(connection.get(), std::string_view(&accepted, 1));
+			exit_report_fd = connection.get();
+			std::atexit(report_exit);
+			exit_code = helper(request.args);
+		} catch (const std::exception& err) {
+			// Before the request was accepted this goes nowhere; the helper then runs in its own process instead
+			std::cerr << "git-remote-rclone: " << err.what() << std::endl;
+		}
+		std::exit(exit_code);
+	}
+}
+
+std::string githlpr::daemon::serialize(const request_t& request)
+{
+	std::string data{request.cwd};
+	data.append(1, '\0').append(std::to_string(request.args.size()));
+	for (const std::string& arg : request.args) {
+		data.append(1, '\0').append(arg);
+	}
+	for (const std::string& var : request.env) {
+		data.append(1, '\0').append(var);
+	}
+	return data;
+}
+
+githlpr::daemon::request_t githlpr::daemon::parse(const std::string_view data)
+{
+	std::vector<std::string> fields{};
+	for (std::size_t start{};;) {
+		const std::size_t end{data.find('\0', start)};
+		fields.emplace_back(data.substr(start, end - start));
+		if (std::string_view::npos == end) {
+			break;
+		}
+		start = end + 1;
+	}
+	if (fields.size() < 2 or fields[1].empty() or std::string::npos != fields[1].find_first_not_of("0123456789")
+	    or std::stoul(fields[1]) > fields.size() - 2) {
+		throw std::runtime_error("invalid request");
+	}
+	const std::size_t nargs{std::stoul(fields[1])};
+	request_t request{};
+	request.cwd = fields[0];
+	request.args.assign(fields.begin() + 2, fields.begin() + 2 + static_cast<std::ptrdiff_t>(nargs));
+	request.env.assign(fields.begin() + 2 + static_cast<std::ptrdiff_t>(nargs), fields.end());
+	return request;
+}
+
+bool githlpr::daemon::is_enabled()
+{
+	const char *const cenabled = std::getenv(std::string(enable_env).c_str());
+	return cenabled and std::string_view("1") == cenabled;
+}
+
+std::optional<int> githlpr::daemon::forward(const std::vector<std::string>& args)
+{
+	try {
+		std::optional<proc::fd_t> fd{connect_daemon()};
+		if (not fd) {
+			start();
+			for (const auto deadline = std::chrono::steady_clock::now() + start_timeout; not fd and std::chrono::steady_clock::now() < deadline;) {
+				std::this_thread::sleep_for(start_poll_interval);
+				fd = connect_daemon();
+			}
+		}
+		if (not fd or not is_own(*fd)) {
+			LOG_WARN("no daemon to hand the helper to");
+			return std::nullopt;
+		}
+		request_t request{};
+		request.cwd = std::filesystem::current_path().string();
+		request.args = args;
+		request.env = get_env();
+		send_request(*fd, serialize(request));
+		if (static_cast<unsigned char>(accepted) != read_byte(*fd)) {
+			LOG_WARN("the daemon did not take the helper");
+			return std::nullopt;
+		}
+		// From here on the daemon owns stdio; running the helper here as well would race it
+		if (const std::optional<unsigned char> code = read_byte(*fd)) {
+			return *code;
+		}
+		std::cerr << "git-remote-rclone: the daemon's helper died" << std::endl;
+		return EXIT_FAILURE;
+	} catch (const std::runtime_error& err) {
+		LOG_WARN(std::string("no daemon to hand the helper to: ") + err.what());
+		return std::nullopt;
+	}
+}
+
+int githlpr::daemon::serve(const helper_t& helper)
+{
+	const auto [addr, len] = get_addr();
+	proc::fd_t listener{create_socket()};
+	if (-1 == ::bind(listener.get(), reinterpret_cast<const sockaddr*>(&addr), len)) {
+		if (EADDRINUSE == errno) {
+			return EXIT_SUCCESS; // another helper started it first
+		}
+		proc::throw_errno("cannot bind daemon socket");
+	} else if (-1 == ::listen(listener.get(), SOMAXCONN)) {
+		proc::throw_errno("cannot listen on daemon socket");
+	}
+	rcd_t rcd{start_rcd()};
+	// Kept well within steady_clock's range, so the idle time compares and subtracts without overflow
+	const std::chrono::seconds idle{std::min(config::get_duration(idle_env, default_idle),
+						 std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::duration::max()).count() / 2)};
+	std::set<pid_t> helpers{};
+	std::chrono::steady_clock::time_point last_active{std::chrono::steady_clock::now()};
+	for (;;) {
+		for (auto it = helpers.begin(); helpers.end() != it;) {
+			if (*it == ::waitpid(*it, nullptr, WNOHANG)) {
+				it = helpers.erase(it);
+				last_active = std::chrono::steady_clock::now();
+			} else {
+				++it;
+			}
+		}
+		const std::chrono::steady_clock::duration idle_for{std::chrono::steady_clock::now() - last_active};
+		if (helpers.empty() and idle_for >= idle) {
+			break;
+		}
+		if (rcd.child and rcd.child->has_exited()) {
+			LOG_WARN("rclone rcd exited with code " + std::to_string(rcd.child->wait()));
+			rcd.child.reset();
+		}
+		pollfd pfd{listener.get(), POLLIN, 0};
+		const auto timeout = helpers.empty() ? std::chrono::duration_cast<std::chrono::milliseconds>(idle - idle_for) + std::chrono::milliseconds(1) : reap_interval;
+		if (-1 == ::poll(&pfd, 1, static_cast<int>(std::min<std::chrono::milliseconds::rep>(timeout.count(), std::numeric_limits<int>::max())))) {
+			if (EINTR == errno) {
+				continue;
+			}
+			proc::throw_errno("cannot poll daemon socket");
+		} else if (not (pfd.revents & POLLIN)) {
+			continue;
+		}
+		proc::fd_t connection{::accept4(listener.get(), nullptr, nullptr, SOCK_CLOEXEC)};
+		if (not connection or not is_own(connection)) {
+			continue;
+		}
+		last_active = std::chrono::steady_clock::now();
+		if (const pid_t pid = ::fork(); 0 == pid) {
+			listener.close();
+			run_helper(std::move(connection), helper, rcd);
+		} else if (-1 != pid) {
+			helpers.insert(pid);
+		}
+	}
+	listener.close(); // helpers that connect from now on start a new daemon
+	if (rcd.child) {
+		rcd.child->kill();
+		std::error_code err{};
+		std::filesystem::remove(rcd.socket, err);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#ifndef DAEMON_HPP
+#define DAEMON_HPP
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Optional per-user daemon that runs the helpers git starts. A helper hands its arguments, environment, working
+ * directory and stdin/stdout/stderr to the daemon over an abstract unix socket and waits for the exit code; the
+ * daemon forks per helper and keeps one `rclone rcd` warm for all of them.
+ */
+namespace githlpr::daemon
+{
+	inline constexpr std::string_view enable_env{"GIT_REMOTE_RCLONE_DAEMON"}; // "1" hands helpers to the daemon, starting it if needed
+	inline constexpr std::string_view idle_env{"GIT_REMOTE_RCLONE_DAEMON_IDLE"}; // time without a helper until the daemon exits, see config::parse_duration()
+	inline constexpr std::int64_t default_idle{600};
+
+	/* What a helper hands to the daemon besides its stdin, stdout and stderr */
+	struct request_t {
+		std::string cwd{};
+		std::vector<std::string> args{}; // without argv[0]
+		std::vector<std::string> env{}; // "NAME=value"
+	};
+
+	/* Runs a helper in the process it is called in; returns its exit code */
+	using helper_t = std::function<int(const std::vector<std::string>& args)>;
+
+	extern std::string serialize(const request_t& request);
+	extern request_t parse(std::string_view data);
+	extern bool is_enabled();
+	/* Runs args in the daemon on this process' stdio and returns the exit code; std::nullopt if no daemon took them */
+	extern std::optional<int> forward(const std::vector<std::string>& args);
+	/* "git-remote-rclone --daemon": runs helper per request until none came for $GIT_REMOTE_RCLONE_DAEMON_IDLE seconds */
+	extern int serve(const helper_t& helper);
+}
+
+#endif /* DAEMON_HPP */
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "chunks.hpp"
+#include "config.hpp"
+#include "download.hpp"
+#include "log.hpp"
+#include "proc.hpp"
+#include "remote.hpp"
+#include "sha1.hpp"
+
+namespace
+{
+	constexpr std::size_t io_buffer_size{1024 * 1024};
+
+	/* Bytes of one remote object written at file_offset; checked against sha1 unless it is empty */
+	struct range_t {
+		std::string path{};
+		std::uint64_t offset{};
+		std::uint64_t count{};
+		std::uint64_t file_offset{};
+		std::string sha1{};
+	};
+
+	/* Shared by the workers; ranges are handed out in order so the file fills front to back */
+	struct job_t {
+		githlpr::remote::storage_t& storage;
+		const std::vector<range_t>& ranges;
+		const int fd;
+		std::atomic<std::size_t> next_range{};
+		std::atomic<bool> failed{};
+		std::atomic<bool> missing{};
+		std::mutex error_mutex{};
+		std::exception_ptr error{};
+	};
+
+	void preallocate(const int fd, const std::uint64_t size)
+	{
+		const int err = ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+		if (EOPNOTSUPP == err or EINVAL == err) {
+			if (-1 == ::ftruncate(fd, static_cast<off_t>(size))) {
+				githlpr::proc::throw_errno("cannot resize download file");
+			}
+		} else if (0 != err) {
+			errno = err;
+			githlpr::proc::throw_errno("cannot allocate download file");
+		}
+	}
+
+	/* Copies the range's bytes to their place in the file, hashing them into ctx unless it is null; returns the number received */
+	std::uint64_t pwrite_range(const int from, const int to, std::uint64_t offset, std::vector<char>& buf, githlpr::sha1::context_t *const ctx)
+	{
+		std::uint64_t total{};
+		for (;;) {
+			const ssize_t nread = ::read(from, buf.data(), buf.size());
+			if (-1 == nread) {
+				if (EINTR == errno) {
+					continue;
+				}
+				githlpr::proc::throw_errno("cannot read remote range");
+			} else if (0 == nread) {
+				return total;
+			}
+			if (ctx) {
+				ctx->update(std::string_view(buf.data(), static_cast<std::size_t>(nread)));
+			}
+			for (std::size_t written{}; written < static_cast<std::size_t>(nread);) {
+				const ssize_t nwritten = ::pwrite(to, buf.data() + written, static_cast<std::size_t>(nread) - written, static_cast<off_t>(offset));
+				if (-1 == nwritten) {
+					if (EINTR == errno) {
+						continue;
+					}
+					githlpr::proc::throw_errno("cannot write download file");
+				}
+				written += static_cast<std::size_t>(nwritten);
+				offset += static_cast<std::uint64_t>(nwritten);
+			}
+			total += static_cast<std::uint64_t>(nread);
+		}
+	}
+
+	void worker(job_t& job)
+	{
+		std::vector<char> buf(io_buffer_size);
+		try {
+			for (std::size_t i{}; not job.failed and (i = job.next_range++) < job.ranges.size();) {
+				const range_t& range = job.ranges[i];
+				const std::unique_ptr<githlpr::remote::source_t> source{job.storage.open_read(range.path, range.offset, range.count)};
+				githlpr::sha1::context_t ctx{};
+				const std::uint64_t received{pwrite_range(source->fd(), job.fd, range.file_offset, buf, range.sha1.empty() ? nullptr : &ctx)};
+				if (not source->finish()) {
+					job.missing = true;
+					job.failed = true;
+				} else if (range.count != received) {
+					throw std::runtime_error("remote object " + range.path + " is shorter than expected");
+				} else if (const githlpr::sha1::digest_t digest{ctx.finish()}; not range.sha1.empty() and
+						range.sha1 != githlpr::sha1::to_hex(std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size()))) {
+					throw std::runtime_error("corrupt remote object " + range.path);
+				}
+			}
+		} catch (...) {
+			const std::lock_guard<std::mutex> lock{job.error_mutex};
+			if (not job.error) {
+				job.error = std::current_exception();
+			}
+			job.failed = true;
+		}
+	}
+
+	bool download_all(githlpr::remote::storage_t& storage, const std::vector<range_t>& ranges, const std::uint64_t size, const std::filesystem::path& file,
+			  const githlpr::download::options_t& options)
+	{
+		const githlpr::proc::fd_t fd{::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+		if (not fd) {
+			githlpr::proc::throw_errno("cannot open " + file.string());
+		}
+		preallocate(fd.get(), size);
+
+		job_t job{storage, ranges, fd.get()};
+		const unsigned nworkers{static_cast<unsigned>(std::min<std::uint64_t>(options.jobs, ranges.size()))};
+		LOG_DEBUG("downloading " + std::to_string(ranges.size()) + " ranges with " + std::to_string(nworkers) + " workers");
+		std::vector<std::thread> workers{};
+		try {
+			for (unsigned i{}; i < nworkers; i++) {
+				workers.emplace_back(worker, std::ref(job));
+			}
+		} catch (const std::system_error&) {
+			job.failed = true; // running workers must not outlive job
+			for (std::thread& thread : workers) {
+				thread.join();
+			}
+			throw;
+		}
+		for (std::thread& thread : workers) {
+			thread.join();
+		}
+		if (job.error) {
+			std::rethrow_exception(job.error);
+		}
+		return not job.missing;
+	}
+}
+
+githlpr::download::options_t githlpr::download::get_options()
+{
+	options_t options{config::get_count(jobs_env, default_jobs), config::get_size(chunk_size_env, default_chunk_size)};
+	options.jobs = std::max(1u, options.jobs);
+	options.chunk_size = std::max<std::uint64_t>(1, options.chunk_size);
+	return options;
+}
+
+bool githlpr::download::is_ranged(const options_t& options, const std::uint64_t size)
+{
+	return options.jobs > 1 and size > options.chunk_size;
+}
+
+bool githlpr::download::download_ranges(remote::storage_t& storage, const std::string& path, const std::uint64_t size, const std::filesystem::path& file, const options_t& options)
+{
+	std::vector<range_t> ranges{};
+	for (std::uint64_t offset{}; offset < size; offset += options.chunk_size) {
+		ranges.push_back({path, offset, std::min(options.chunk_size, size - offset), offset, {}});
+	}
+	return download_all(storage, ranges, size, file, options);
+}
+
+bool githlpr::download::download_parts(remote::storage_t& storage, const std::vector<part_t>& parts, const std::filesystem::path& file, const options_t& options)
+{
+	std::vector<range_t> ranges{};
+	std::uint64_t size{};
+	for (const part_t& part : parts) {
+		ranges.push_back({part.path, part.offset, part.count, size, {}});
+		size += part.count;
+	}
+	return download_all(storage, ranges, size, file, options);
+}
+
+bool githlpr::download::download_chunks(remote::storage_t& storage, const std::vector<chunks::chunk_t>& chunks, const std::filesystem::path& file, const options_t& options)
+{
+	std::vector<range_t> ranges{};
+	std::uint64_t size{};
+	for (const chunks::chunk_t& chunk : chunks) {
+		ranges.push_back({std::string(chunks::dir) + chunk.sha1, 0, chunk.size, size, chunk.sha1});
+		size += chunk.size;
+	}
+	return download_all(storage, ranges, size, file, options);
+}
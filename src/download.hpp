@@ -0,0 +1,47 @@
+#ifndef DOWNLOAD_HPP
+#define DOWNLOAD_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chunks.hpp"
+#include "remote.hpp"
+
+namespace githlpr::download
+{
+	inline constexpr std::string_view jobs_env{"GIT_REMOTE_RCLONE_JOBS"};
+	inline constexpr std::string_view chunk_size_env{"GIT_REMOTE_RCLONE_CHUNK_SIZE"};
+	inline constexpr unsigned default_jobs{4};
+	inline constexpr std::uint64_t default_chunk_size{64 * 1024 * 1024};
+
+	/* count bytes at offset of a remote object */
+	struct part_t {
+		std::string path{};
+		std::uint64_t offset{};
+		std::uint64_t count{};
+	};
+
+	struct options_t {
+		unsigned jobs{default_jobs}; // concurrent range transfers
+		std::uint64_t chunk_size{default_chunk_size};
+	};
+
+	/* From $GIT_REMOTE_RCLONE_JOBS and $GIT_REMOTE_RCLONE_CHUNK_SIZE */
+	extern options_t get_options();
+	/* Objects spanning several chunks are downloaded as ranges; smaller ones are not worth the extra transfers */
+	extern bool is_ranged(const options_t& options, std::uint64_t size);
+	/*
+	 * Downloads the size bytes of path as chunk_size byte ranges, jobs of them at a time, each written in place
+	 * into the preallocated file. Returns false if the object does not exist.
+	 */
+	extern bool download_ranges(remote::storage_t& storage, const std::string& path, std::uint64_t size, const std::filesystem::path& file, const options_t& options);
+	/* Downloads the parts, jobs of them at a time, one after the other into file. Returns false if an object does not exist. */
+	extern bool download_parts(remote::storage_t& storage, const std::vector<part_t>& parts, const std::filesystem::path& file, const options_t& options);
+	/* As download_ranges(), but one chunk object per range, each checked against its sha1 */
+	extern bool download_chunks(remote::storage_t& storage, const std::vector<chunks::chunk_t>& chunks, const std::filesystem::path& file, const options_t& options);
+}
+
+#endif /* DOWNLOAD_HPP */
@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdlib>
+
+#include <fcntl.h>
+
+#include "cache.hpp"
+#include "chunks.hpp"
+#include "download.hpp"
+#include "fetch.hpp"
+#include "git.hpp"
+#include "lazy.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "packidx.hpp"
+#include "proc.hpp"
+#include "remote.hpp"
+#include "sha1.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+namespace
+{
+	/* true if values[first, first + n) are all set */
+	bool all_set(const std::vector<bool>& values, const std::size_t first, const std::size_t n)
+	{
+		return std::all_of(values.begin() + static_cast<std::ptrdiff_t>(first), values.begin() + static_cast<std::ptrdiff_t>(first + n), [](const bool value) { return value; });
+	}
+
+	bool is_sha1(const std::string_view& str)
+	{
+		return githlpr::git::sha1_hex_len == str.length()
+			and std::all_of(str.begin(), str.end(), [](const char c) { return ('0' <= c and c <= '9') or ('a' <= c and c <= 'f'); });
+	}
+
+	githlpr::proc::fd_t open_file(const std::filesystem::path& file, const int flags)
+	{
+		githlpr::proc::fd_t fd{::open(file.c_str(), flags | O_CLOEXEC, 0644)};
+		if (not fd) {
+			githlpr::proc::throw_errno("cannot open " + file.string());
+		}
+		return fd;
+	}
+
+	/*
+	 * rclone's stdout is spliced into index-pack's stdin, so indexing runs while the pack downloads.
+	 * Downloaded packs are teed into the cache; cached packs are indexed without touching the remote.
+	 * Large packs are downloaded as parallel byte ranges into the cache first and indexed from there;
+	 * chunked packs likewise as parallel chunks, or else as one stream of their chunks.
+	 */
+	void stream_pack(githlpr::remote::storage_t& storage, githlpr::cache::cache_t& cache, const githlpr::download::options_t& options, const githlpr::manifest::pack_t& pack,
+			 const bool promisor, const std::vector<std::string>& env)
+	{
+		const githlpr::trace::span_t span{"fetch pack", pack.name};
+		const std::string path{std::string(githlpr::manifest::packs_dir) + pack.name};
+		const std::filesystem::path tmp_file{cache.get_tmp_path(pack.name)};
+		std::vector<std::string> argv{"git", "index-pack", "--stdin", "--fix-thin"};
+		if (promisor) {
+			argv.emplace_back("--promisor"); // objects these refer to may be missing; git fetches them lazily
+		}
+		githlpr::proc::child_t index_pack{githlpr::proc::spawn(argv, githlpr::proc::PIPE_STDIN | githlpr::proc::PIPE_STDOUT, env)};
+		if (const std::optional<std::filesystem::path> cached = cache.lookup(pack.name)) {
+			LOG_DEBUG("cached " + pack.name);
+			githlpr::proc::fd_copy(open_file(*cached, O_RDONLY).get(), index_pack.stdin_fd());
+			index_pack.close_stdin();
+		} else if (pack.chunked) {
+			LOG_DEBUG("fetching " + pack.name + " as chunks");
+			const githlpr::stats::timer_t timer{githlpr::stats::op_t::PACK_DOWNLOAD};
+			const std::vector<githlpr::chunks::chunk_t> chunks{githlpr::chunks::read_list(storage, pack.name)};
+			if (options.jobs > 1 and chunks.size() > 1) {
+				if (not githlpr::download::download_chunks(storage, chunks, tmp_file, options)) {
+					index_pack.kill();
+					std::filesystem::remove(tmp_file);
+					throw std::runtime_error("pack missing on remote: " + pack.name);
+				}
+				githlpr::stats::add_downloaded(pack.size);
+				githlpr::proc::fd_copy(open_file(tmp_file, O_RDONLY).get(), index_pack.stdin_fd());
+			} else {
+				const githlpr::proc::fd_t copy{cache.is_enabled() ? open_file(tmp_file, O_WRONLY | O_CREAT | O_TRUNC) : githlpr::proc::fd_t{}};
+				githlpr::stats::add_downloaded(githlpr::chunks::stream(storage, chunks, index_pack.stdin_fd(), copy.get()));
+			}
+			index_pack.close_stdin();
+			cache.insert(pack.name, tmp_file);
+		} else if (githlpr::download::is_ranged(options, pack.size)) {
+			const githlpr::stats::timer_t timer{githlpr::stats::op_t::PACK_DOWNLOAD};
+			if (not githlpr::download::download_ranges(storage, path, pack.size, tmp_file, options)) {
+				index_pack.kill();
+				std::filesystem::remove(tmp_file);
+				throw std::runtime_error("pack missing on remote: " + pack.name);
+			}
+			githlpr::stats::add_downloaded(pack.size);
+			githlpr::proc::fd_copy(open_file(tmp_file, O_RDONLY).get(), index_pack.stdin_fd());
+			index_pack.close_stdin();
+			cache.insert(pack.name, tmp_file);
+		} else {
+			LOG_DEBUG("fetching " + pack.name);
+			const githlpr::stats::timer_t timer{githlpr::stats::op_t::PACK_DOWNLOAD};
+			const std::unique_ptr<githlpr::remote::source_t> source{storage.open_read(path)};
+			if (cache.is_enabled()) {
+				githlpr::stats::add_downloaded(githlpr::proc::fd_tee(source->fd(), index_pack.stdin_fd(), open_file(tmp_file, O_WRONLY | O_CREAT | O_TRUNC).get()));
+			} else {
+				githlpr::stats::add_downloaded(githlpr::proc::fd_copy(source->fd(), index_pack.stdin_fd()));
+			}
+			index_pack.close_stdin();
+			if (not source->finish()) {
+				index_pack.kill();
+				std::filesystem::remove(tmp_file);
+				throw std::runtime_error("pack missing on remote: " + pack.name);
+			}
+			if (cache.is_enabled()) {
+				cache.insert(pack.name, tmp_file);
+			}
+		}
+		// index-pack reports "pack\t<hash>" on stdout; it must not reach git's protocol stream
+		githlpr::proc::fd_copy(index_pack.stdout_fd(), githlpr::proc::fd_t{::open("/dev/null", O_WRONLY | O_CLOEXEC)}.get());
+		index_pack.check();
+	}
+
+	/*
+	 * The number of packs, oldest first, up to the last one holding one of sha1s; the indexes it reads are kept.
+	 * Without an index a pack and all later ones are counted.
+	 */
+	std::size_t count_needed(githlpr::remote::storage_t& storage, githlpr::cache::cache_t& cache, const std::vector<githlpr::manifest::pack_t>& packs,
+				 const std::vector<std::string>& sha1s, std::vector<std::optional<githlpr::packidx::index_t>>& indexes)
+	{
+		// Packs with a tree pack were uploaded with their index
+		indexes.resize(packs.size());
+		std::vector<std::string> unfound{};
+		for (const std::string& sha1 : sha1s) {
+			unfound.push_back(githlpr::sha1::from_hex(sha1));
+		}
+		std::size_t end{};
+		for (; end < packs.size() and not unfound.empty(); end++) {
+			if (not packs[end].tree_pack.empty()) {
+				indexes[end] = githlpr::packidx::fetch_index(storage, cache, packs[end].name);
+			}
+			if (not indexes[end]) {
+				unfound.clear(); // cannot tell what the pack holds, so all later packs may be needed as well
+				end = packs.size() - 1;
+			}
+			unfound.erase(std::remove_if(unfound.begin(), unfound.end(), [&index = indexes[end]](const std::string& raw) {
+				return index and index->find(raw);
+			}), unfound.end());
+		}
+		return unfound.empty() ? end : packs.size();
+	}
+
+	/*
+	 * The remote cannot trim history, so the packs are indexed into a scratch repository and git fetch-pack
+	 * fetches the wants from there with the history limits; it writes the trimmed objects and $GIT_DIR/shallow.
+	 * Only the packs up to the last one holding a want are indexed. For a plain depth those are their tree packs,
+	 * and the blobs of the commits within the depth are read out of the remote packs by byte range.
+	 */
+	void fetch_shallow(githlpr::remote::storage_t& storage, githlpr::cache::cache_t& cache, const std::vector<githlpr::manifest::pack_t>& packs,
+			   const std::vector<githlpr::fetch::want_t>& wants, const githlpr::fetch::options_t& options)
+	{
+		const githlpr::trace::span_t span{"shallow fetch"};
+		const char *const cgit_dir = std::getenv("GIT_DIR");
+		if (nullptr == cgit_dir) {
+			throw std::runtime_error("GIT_DIR is not set");
+		}
+		std::vector<std::string> argv{"git", "--git-dir=" + std::filesystem::absolute(cgit_dir).string(), "fetch-pack", "-q", "--no-progress"};
+		if (options.depth) {
+			argv.push_back("--depth=" + std::to_string(options.depth));
+		}
+		if (not options.since.empty()) {
+			argv.push_back("--shallow-since=" + options.since);
+		}
+		for (const std::string& exclude : options.excludes) {
+			argv.push_back("--shallow-exclude=" + exclude);
+		}
+		if (options.relative) {
+			argv.push_back("--deepen-relative");
+		}
+		if (not options.filter.empty()) {
+			argv.push_back("--filter=" + options.filter);
+		}
+		if (options.is_partial()) {
+			argv.push_back("--from-promisor");
+		}
+
+		// Wants get refs of their own; deepen-not names remote refs, so those are recreated as well
+		std::string updates{};
+		std::vector<std::string> sha1s{};
+		if (not options.excludes.empty()) {
+			for (const auto& [ref, sha1] : githlpr::manifest::read(storage).refs) {
+				updates.append("update ").append(ref).append(" ").append(sha1).append("\n");
+				sha1s.push_back(sha1);
+			}
+		}
+		for (std::size_t i{}; i < wants.size(); i++) {
+			const std::string ref{"refs/rclone-want/" + std::to_string(i)};
+			updates.append("update ").append(ref).append(" ").append(wants[i].sha1).append("\n");
+			sha1s.push_back(wants[i].sha1);
+		}
+
+		const githlpr::git::scratch_repo_t repo{};
+		const std::vector<std::string> env{repo.get_env()};
+		std::vector<std::optional<githlpr::packidx::index_t>> indexes{};
+		const std::vector<githlpr::manifest::pack_t> needed(packs.begin(), packs.begin() + static_cast<std::ptrdiff_t>(count_needed(storage, cache, packs, sha1s, indexes)));
+		// Deepening needs the history beyond the commits a depth keeps, which only the whole packs have
+		const bool trimmed{0 != options.depth and not options.relative and options.since.empty() and options.excludes.empty()};
+		githlpr::fetch::fetch_packs(storage, cache, needed, options.is_partial() or trimmed, env);
+		if (not options.filter.empty()) {
+			githlpr::proc::spawn({"git", "config", "uploadpack.allowFilter", "true"}, githlpr::proc::PIPE_NONE, env).check();
+		}
+		githlpr::proc::run({"git", "update-ref", "--stdin"}, updates, env);
+		if (trimmed and options.filter.empty()) {
+			std::vector<std::string> revs{githlpr::git::shallow_commits(sha1s, options.depth, env)};
+			revs.insert(revs.end(), sha1s.begin(), sha1s.end()); // tags of trees or blobs
+			if (const std::vector<std::string> blobs{githlpr::git::missing_objects(revs, env)}; not blobs.empty()) {
+				githlpr::lazy::fetch_objects(storage, cache, needed, blobs, env);
+			}
+		}
+		argv.push_back(repo.get_dir().string());
+		for (std::size_t i{}; i < wants.size(); i++) {
+			argv.push_back("refs/rclone-want/" + std::to_string(i));
+		}
+		LOG_DEBUG("fetch-pack of " + std::to_string(wants.size()) + " wants from " + std::to_string(needed.size()) + " of " + std::to_string(packs.size()) + " packs");
+		(void)githlpr::proc::run(argv); // "<sha1> <ref>" lines must not reach git's protocol stream
+	}
+}
+
+bool githlpr::fetch::set_option(options_t& options, const std::string_view name, const std::string_view value)
+{
+	const auto parse_bool = [&name, &value]() {
+		if ("true" != value and "false" != value) {
+			throw std::runtime_error("invalid " + std::string(name) + ": " + std::string(value));
+		}
+		return "true" == value;
+	};
+	if ("depth" == name) {
+		std::size_t pos{};
+		try {
+			options.depth = std::stoul(std::string(value), &pos);
+		} catch (const std::logic_error&) {
+			pos = 0;
+		}
+		if (value.empty() or value.size() != pos) {
+			throw std::runtime_error("invalid depth: " + std::string(value));
+		}
+	} else if ("deepen-since" == name) {
+		options.since = value;
+	} else if ("deepen-not" == name) {
+		options.excludes.emplace_back(value);
+	} else if ("deepen-relative" == name) {
+		options.relative = parse_bool();
+	} else if ("filter" == name and "blob:none" == value) {
+		options.filter = value; // other filters would need the objects' sizes or types
+	} else if ("from-promisor" == name) {
+		options.from_promisor = parse_bool();
+	} else {
+		return false;
+	}
+	return true;
+}
+
+githlpr::fetch::want_t githlpr::fetch::parse_want(const tokenizer::cmd_line_t& cmd_line)
+{
+	if (2 != cmd_line.nargs() or not is_sha1(cmd_line.arg(0))) {
+		throw std::runtime_error("could not parse fetch parameters");
+	}
+	return {std::string(cmd_line.arg(0)), std::string(cmd_line.arg(1))};
+}
+
+void githlpr::fetch::fetch_packs(remote::storage_t& storage, cache::cache_t& cache, const std::vector<manifest::pack_t>& packs, const bool partial,
+				  const std::vector<std::string>& env)
+{
+	const download::options_t options{download::get_options()};
+	// Oldest first: a pack's prerequisites are in the packs before it
+	for (const manifest::pack_t& pack : packs) {
+		if (partial and not pack.tree_pack.empty()) {
+			stream_pack(storage, cache, options, {pack.tree_pack, pack.tree_pack_size, {}, {}, {}, 0, pack.tree_pack_chunked}, true, env);
+		} else {
+			stream_pack(storage, cache, options, pack, partial, env);
+		}
+	}
+}
+
+std::vector<githlpr::manifest::pack_t> githlpr::fetch::plan_packs(remote::storage_t& storage, cache::cache_t& cache, const std::vector<manifest::pack_t>& packs,
+								 const std::vector<std::string>& sha1s, const bool partial)
+{
+	const trace::span_t span{"fetch planning"};
+	std::vector<std::optional<packidx::index_t>> indexes{};
+	const std::size_t end{count_needed(storage, cache, packs, sha1s, indexes)};
+
+	// A pack holds only objects reachable from its tips: one whose tips are all reachable from local refs has nothing new
+	std::vector<std::string> tips{};
+	for (std::size_t i{}; i < end; i++) {
+		tips.insert(tips.end(), packs[i].tips.begin(), packs[i].tips.end());
+	}
+	std::vector<bool> present_tips(tips.size(), true), known_tips(tips.size());
+	if (not partial) {
+		// Checking a partial clone for objects would make git fetch the missing ones lazily; elsewhere it spares most walks
+		const std::vector<std::optional<std::string>> names{git::resolve(tips)};
+		std::transform(names.begin(), names.end(), present_tips.begin(), [](const auto& name) { return name.has_value(); });
+	}
+	if (std::vector<std::string> walked{}; not tips.empty()) {
+		for (std::size_t i{}, tip{}; i < end; tip += packs[i++].tips.size()) {
+			if (all_set(present_tips, tip, packs[i].tips.size())) {
+				walked.insert(walked.end(), packs[i].tips.begin(), packs[i].tips.end());
+			}
+		}
+		const std::vector<bool> reachable{git::reachable(walked)};
+		for (std::size_t i{}, tip{}, walked_tip{}; i < end; tip += packs[i++].tips.size()) {
+			if (all_set(present_tips, tip, packs[i].tips.size())) {
+				std::copy_n(reachable.begin() + static_cast<std::ptrdiff_t>(walked_tip), packs[i].tips.size(), known_tips.begin() + static_cast<std::ptrdiff_t>(tip));
+				walked_tip += packs[i].tips.size();
+			}
+		}
+	}
+
+	// Packs with present but unreachable tips may still be complete; their objects are checked in one batch
+	std::vector<bool> known(end), candidates(end);
+	std::vector<std::string> objects{};
+	for (std::size_t i{}, tip{}; i < end; tip += packs[i++].tips.size()) {
+		known[i] = not packs[i].tips.empty() and all_set(known_tips, tip, packs[i].tips.size());
+		candidates[i] = not partial and not known[i] and indexes[i] and all_set(present_tips, tip, packs[i].tips.size());
+		for (std::size_t obj{}; candidates[i] and obj < indexes[i]->size(); obj++) {
+			objects.push_back(sha1::to_hex(indexes[i]->get_name_at(obj)));
+		}
+	}
+	const std::vector<std::optional<std::string>> present{git::resolve(objects)};
+
+	std::vector<manifest::pack_t> needed{};
+	for (std::size_t i{}, obj{}; i < end; i++) {
+		const std::size_t nobjects{candidates[i] ? indexes[i]->size() : 0};
+		const bool complete{candidates[i] and std::all_of(present.begin() + static_cast<std::ptrdiff_t>(obj),
+				present.begin() + static_cast<std::ptrdiff_t>(obj + nobjects), [](const auto& name) { return name.has_value(); })};
+		obj += nobjects;
+		if (known[i]) {
+			LOG_DEBUG("skipping " + packs[i].name + ": tips reachable locally");
+		} else if (complete) {
+			LOG_DEBUG("skipping " + packs[i].name + ": all objects present");
+		} else {
+			needed.push_back(packs[i]);
+		}
+	}
+	LOG_DEBUG("fetching " + std::to_string(needed.size()) + " of " + std::to_string(packs.size()) + " packs");
+	return needed;
+}
+
+void githlpr::fetch::fetch_batch(remote::storage_t& storage, const std::vector<manifest::pack_t>& packs, const std::vector<want_t>& wants, const options_t& options)
+{
+	if (wants.empty() or packs.empty()) {
+		return;
+	}
+	cache::cache_t cache{cache::open()};
+	std::vector<std::string> objects{}, sha1s{};
+	for (const want_t& want : wants) {
+		if (options.is_partial() and not options.is_shallow() and want.name == want.sha1) {
+			objects.push_back(want.sha1);
+		} else {
+			sha1s.push_back(want.sha1);
+		}
+	}
+	if (not objects.empty()) {
+		lazy::fetch_objects(storage, cache, packs, objects);
+	}
+	if (options.is_shallow()) {
+		fetch_shallow(storage, cache, packs, wants, options);
+	} else if (not sha1s.empty()) {
+		fetch_packs(storage, cache, plan_packs(storage, cache, packs, sha1s, options.is_partial()), options.is_partial());
+	}
+	cache.save_stats();
+}
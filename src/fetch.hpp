@@ -0,0 +1,65 @@
+#ifndef FETCH_HPP
+#define FETCH_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cache.hpp"
+#include "manifest.hpp"
+#include "remote.hpp"
+#include "tokenizer.hpp"
+
+namespace githlpr::fetch
+{
+	/* "fetch <sha1> <name>" */
+	struct want_t {
+		std::string sha1{};
+		std::string name{};
+	};
+
+	/* Set by "option <name> <value>": history limits for shallow fetches and the object filter of partial clones */
+	struct options_t {
+		unsigned long depth{}; // 0: not limited by depth
+		std::string since{};
+		std::vector<std::string> excludes{};
+		bool relative{}; // depth counts from the current shallow boundary
+		std::string filter{}; // only "blob:none"
+		bool from_promisor{};
+
+		bool is_shallow() const
+		{
+			return depth or not since.empty() or not excludes.empty();
+		}
+
+		bool is_partial() const
+		{
+			return not filter.empty() or from_promisor;
+		}
+	};
+
+	/* Applies "option <name> <value>"; false if the option is not supported, throws on an invalid value */
+	extern bool set_option(options_t& options, std::string_view name, std::string_view value);
+	extern want_t parse_want(const tokenizer::cmd_line_t& cmd_line);
+	/*
+	 * Indexes packs, oldest first, into GIT_DIR; cached packs are not downloaded.
+	 * For a partial clone the tree packs are indexed instead where there are any, as promisor packs. git runs with env.
+	 */
+	extern void fetch_packs(remote::storage_t& storage, cache::cache_t& cache, const std::vector<manifest::pack_t>& packs, bool partial = false,
+				const std::vector<std::string>& env = {});
+	/*
+	 * The packs needed for sha1s, oldest first: those up to the last one holding one of them, found through the pack indexes,
+	 * less those whose tips are all reachable from local refs and, unless partial, those whose objects are all present in GIT_DIR.
+	 * Without an index a pack and all later ones are kept, and only its tips tell whether it is needed.
+	 */
+	extern std::vector<manifest::pack_t> plan_packs(remote::storage_t& storage, cache::cache_t& cache, const std::vector<manifest::pack_t>& packs,
+							const std::vector<std::string>& sha1s, bool partial);
+	/*
+	 * A shallow fetch indexes the packs up to the last one holding a want into a scratch repository and lets git fetch-pack
+	 * trim them into GIT_DIR; for a plain depth the tree packs, plus the blobs within the depth read by byte range.
+	 * In a partial clone, wants named by their sha1 are git's lazy fetches of single objects.
+	 */
+	extern void fetch_batch(remote::storage_t& storage, const std::vector<manifest::pack_t>& packs, const std::vector<want_t>& wants, const options_t& options = {});
+}
+
+#endif /* FETCH_HPP */
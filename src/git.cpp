@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "git.hpp"
+#include "proc.hpp"
+#include "sha1.hpp"
+#include "trace.hpp"
+
+std::filesystem::path githlpr::git::get_helper_dir()
+{
+	const char *const cgit_dir = std::getenv("GIT_DIR");
+	if (nullptr == cgit_dir) {
+		throw std::runtime_error("GIT_DIR is not set");
+	}
+	const std::filesystem::path helper_dir{std::filesystem::path(cgit_dir) / "rclone"};
+	std::filesystem::create_directories(helper_dir);
+	return helper_dir;
+}
+
+githlpr::git::scratch_repo_t::scratch_repo_t()
+{
+	std::string tmpl{(std::filesystem::temp_directory_path() / "git-remote-rclone.XXXXXX").string()};
+	if (nullptr == ::mkdtemp(tmpl.data())) {
+		proc::throw_errno("cannot create scratch repository");
+	}
+	dir = tmpl;
+	proc::spawn({"git", "init", "-q", "--bare", dir.string()}).check();
+}
+
+githlpr::git::scratch_repo_t::~scratch_repo_t()
+{
+	std::error_code err{};
+	std::filesystem::remove_all(dir, err);
+}
+
+std::vector<std::optional<std::string>> githlpr::git::resolve(const std::vector<std::string>& revs, const std::vector<std::string>& env)
+{
+	std::string input{};
+	for (const std::string& rev : revs) {
+		input.append(rev).append("\n");
+	}
+	// One "<sha1> <type> <size>" or "<rev> missing" line per rev, in input order
+	std::istringstream output{proc::run({"git", "cat-file", "--batch-check"}, input, env)};
+	std::vector<std::optional<std::string>> names{};
+	std::string name{}, type{};
+	for (std::string line{}; names.size() < revs.size() and std::getline(output, line);) {
+		std::istringstream{line} >> name >> type;
+		if ("missing" == type or "ambiguous" == type) {
+			names.emplace_back(std::nullopt);
+		} else {
+			names.emplace_back(name);
+		}
+	}
+	if (names.size() != revs.size()) {
+		throw std::runtime_error("git cat-file returned fewer objects than requested");
+	}
+	return names;
+}
+
+bool githlpr::git::is_ancestor(const std::string& ancestor, const std::string& descendant)
+{
+	proc::child_t child{proc::spawn({"git", "merge-base", "--is-ancestor", ancestor, descendant})};
+	switch (child.wait()) {
+		case 0:
+			return true;
+		case 1:
+			return false;
+		default:
+			throw std::runtime_error("git merge-base failed for " + ancestor + " " + descendant);
+	}
+}
+
+std::vector<bool> githlpr::git::reachable(const std::vector<std::string>& commits)
+{
+	std::vector<bool> found(commits.size());
+	std::unordered_multimap<std::string_view, std::size_t> pending{};
+	for (std::size_t i{}; i < commits.size(); i++) {
+		pending.emplace(commits[i], i);
+	}
+	if (pending.empty()) {
+		return found;
+	}
+	// Stops walking once every commit was seen
+	proc::child_t list{proc::spawn({"git", "rev-list", "--all"}, proc::PIPE_STDOUT)};
+	std::array<char, 64 * 1024> buf{};
+	std::string line{};
+	for (ssize_t nread{}; not pending.empty() and 0 != (nread = ::read(list.stdout_fd(), buf.data(), buf.size()));) {
+		if (-1 == nread and EINTR != errno) {
+			proc::throw_errno("cannot read output of " + list.get_name());
+		}
+		for (const char c : std::string_view(buf.data(), static_cast<std::size_t>(std::max<ssize_t>(nread, 0)))) {
+			if ('\n' != c) {
+				line.push_back(c);
+				continue;
+			}
+			const auto [first, last] = pending.equal_range(line);
+			std::for_each(first, last, [&found](const auto& entry) { found[entry.second] = true; });
+			pending.erase(first, last);
+			line.clear();
+		}
+	}
+	if (pending.empty()) {
+		list.kill();
+	} else {
+		list.check();
+	}
+	return found;
+}
+
+std::vector<std::string> githlpr::git::boundary(const std::vector<std::string>& tips, const std::vector<std::string>& excludes)
+{
+	if (excludes.empty()) {
+		return {};
+	}
+	std::string input{};
+	for (const std::string& tip : tips) {
+		input.append(tip).append("\n");
+	}
+	for (const std::string& exclude : excludes) {
+		input.append("^").append(exclude).append("\n");
+	}
+	// Boundary commits are printed with a leading '-'
+	std::istringstream output{proc::run({"git", "rev-list", "--boundary", "--stdin"}, input)};
+	std::vector<std::string> commits{};
+	for (std::string line{}; std::getline(output, line);) {
+		if (not line.empty() and '-' == line.front()) {
+			commits.push_back(line.substr(1));
+		}
+	}
+	return commits;
+}
+
+std::vector<std::string> githlpr::git::shallow_commits(const std::vector<std::string>& tips, const std::size_t depth, const std::vector<std::string>& env)
+{
+	std::vector<std::string> peeled{};
+	for (const std::string& tip : tips) {
+		peeled.push_back(tip + "^{commit}");
+	}
+	std::vector<std::string> pending{};
+	for (const std::optional<std::string>& commit : resolve(peeled, env)) {
+		if (commit) {
+			pending.push_back(*commit); // tags of trees or blobs have no history
+		}
+	}
+	if (pending.empty() or 0 == depth) {
+		return {};
+	}
+	std::string input{};
+	for (const std::string& commit : pending) {
+		input.append(commit).append("\n");
+	}
+	// "<commit> <parent>..." lines; breadth first from the tips, so every commit is reached on its shortest path
+	std::istringstream output{proc::run({"git", "rev-list", "--parents", "--stdin"}, input, env)};
+	std::unordered_map<std::string, std::vector<std::string>> parents{};
+	for (std::string line{}; std::getline(output, line);) {
+		std::istringstream strm{line};
+		std::string commit{};
+		strm >> commit;
+		std::vector<std::string>& list{parents[commit]};
+		for (std::string parent{}; strm >> parent;) {
+			list.push_back(parent);
+		}
+	}
+	std::unordered_set<std::string> seen{};
+	std::vector<std::string> commits{};
+	for (std::size_t distance{}; distance < depth and not pending.empty(); distance++) {
+		std::vector<std::string> next{};
+		for (const std::string& commit : pending) {
+			if (not seen.insert(commit).second) {
+				continue;
+			}
+			commits.push_back(commit);
+			if (const auto found = parents.find(commit); parents.end() != found) {
+				next.insert(next.end(), found->second.begin(), found->second.end());
+			}
+		}
+		pending = std::move(next);
+	}
+	return commits;
+}
+
+std::vector<std::string> githlpr::git::missing_objects(const std::vector<std::string>& revs, const std::vector<std::string>& env)
+{
+	if (revs.empty()) {
+		return {};
+	}
+	std::string input{};
+	for (const std::string& rev : revs) {
+		input.append(rev).append("\n");
+	}
+	// Missing objects are printed with a leading '?'; --no-walk lists the trees of revs but not their history
+	std::istringstream output{proc::run({"git", "rev-list", "--objects", "--no-walk", "--missing=print", "--stdin"}, input, env)};
+	std::vector<std::string> objects{};
+	for (std::string line{}; std::getline(output, line);) {
+		if (not line.empty() and '?' == line.front()) {
+			objects.push_back(line.substr(1));
+		}
+	}
+	return objects;
+}
+
+namespace
+{
+	std::string get_pack_hash(std::string output)
+	{
+		output.erase(output.find_last_not_of(" \n") + 1);
+		if (githlpr::git::sha1_hex_len != output.length()) {
+			throw std::runtime_error("git pack-objects returned no pack name");
+		}
+		return output;
+	}
+}
+
+std::string githlpr::git::pack_objects(const std::vector<std::string>& revs, const std::filesystem::path& dir, const std::string_view filter)
+{
+	std::string input{};
+	for (const std::string& rev : revs) {
+		input.append(rev).append("\n");
+	}
+	std::filesystem::create_directories(dir);
+	const trace::span_t span{"pack generation", filter};
+	if (filter.empty()) {
+		return get_pack_hash(proc::run({"git", "pack-objects", "--revs", "--delta-base-offset", "-q", (dir / "pack").string()}, input));
+	}
+
+	// pack-objects only filters into --stdout; the pack is named by its trailing checksum, as git names packs
+	const std::filesystem::path tmp_file{dir / "pack-filtered.tmp"};
+	{
+		const proc::fd_t out{::open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+		if (not out) {
+			proc::throw_errno("cannot open " + tmp_file.string());
+		}
+		proc::child_t pack{proc::spawn({"git", "pack-objects", "--revs", "--delta-base-offset", "-q", "--stdout", "--filter=" + std::string(filter)},
+					       proc::PIPE_STDIN | proc::PIPE_STDOUT)};
+		proc::write_all(pack.stdin_fd(), input); // revs are read completely before the pack is written
+		pack.close_stdin();
+		proc::fd_copy(pack.stdout_fd(), out.get());
+		pack.check();
+	}
+	std::ifstream strm{tmp_file, std::ios::binary};
+	std::string trailer(sha1::raw_len, '\0');
+	if (not strm.seekg(-static_cast<std::streamoff>(trailer.size()), std::ios::end) or not strm.read(trailer.data(), static_cast<std::streamsize>(trailer.size()))) {
+		throw std::runtime_error("git pack-objects wrote no pack");
+	}
+	const std::string hash{sha1::to_hex(trailer)};
+	std::filesystem::rename(tmp_file, dir / ("pack-" + hash + ".pack"));
+	return hash;
+}
+
+std::string githlpr::git::pack_all_objects(const std::filesystem::path& dir, const std::string_view filter, const std::vector<std::string>& env)
+{
+	std::filesystem::create_directories(dir);
+	const trace::span_t span{"pack generation", filter};
+	if ("blob:none" == filter) {
+		// pack-objects only filters objects it walks from revs, and what they build upon may not be here to walk
+		std::istringstream listed{proc::run({"git", "cat-file", "--batch-all-objects", "--batch-check=%(objectname) %(objecttype)"}, {}, env)};
+		std::string input{};
+		bool filtered{};
+		for (std::string line{}; std::getline(listed, line);) {
+			if (0 == line.compare(sha1_hex_len, std::string::npos, " blob")) {
+				filtered = true;
+			} else {
+				input.append(line, 0, sha1_hex_len).append("\n");
+			}
+		}
+		return filtered ? get_pack_hash(proc::run({"git", "pack-objects", "--delta-base-offset", "-q", (dir / "pack").string()}, input, env)) : std::string{};
+	} else if (not filter.empty()) {
+		throw std::runtime_error("unsupported filter " + std::string(filter));
+	}
+	// The object list goes straight from cat-file into pack-objects; pack-objects only prints its hash once it read all of it
+	proc::child_t list{proc::spawn({"git", "cat-file", "--batch-all-objects", "--batch-check=%(objectname)"}, proc::PIPE_STDOUT, env)};
+	proc::child_t pack{proc::spawn({"git", "pack-objects", "--delta-base-offset", "-q", (dir / "pack").string()}, proc::PIPE_STDIN | proc::PIPE_STDOUT, env)};
+	proc::fd_copy(list.stdout_fd(), pack.stdin_fd());
+	pack.close_stdin();
+	list.check();
+	std::string output{};
+	std::array<char, 256> buf{};
+	for (ssize_t nread{}; 0 != (nread = ::read(pack.stdout_fd(), buf.data(), buf.size()));) {
+		if (-1 == nread and EINTR != errno) {
+			proc::throw_errno("cannot read output of " + pack.get_name());
+		} else if (nread > 0) {
+			output.append(buf.data(), static_cast<std::size_t>(nread));
+		}
+	}
+	pack.check();
+	return get_pack_hash(std::move(output));
+}
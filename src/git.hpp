@@ -0,0 +1,66 @@
+#ifndef GIT_HPP
+#define GIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace githlpr::git
+{
+	inline constexpr std::size_t sha1_hex_len{40};
+	inline constexpr std::uintmax_t empty_pack_size{12 + 20}; // header + trailing checksum
+
+	/* $GIT_DIR/rclone; private working directory of the helper, created on demand */
+	extern std::filesystem::path get_helper_dir();
+	/*
+	 * Resolve revs to object names with a single git cat-file; std::nullopt for revs that do not exist.
+	 * Functions taking env run git with it added to the environment, e.g. in a scratch repository.
+	 */
+	extern std::vector<std::optional<std::string>> resolve(const std::vector<std::string>& revs, const std::vector<std::string>& env = {});
+	/* true if ancestor is reachable from descendant, i.e. updating descendant is a fast-forward */
+	extern bool is_ancestor(const std::string& ancestor, const std::string& descendant);
+	/* Whether each commit is reachable from a local ref; walks commits only, so a partial clone fetches nothing */
+	extern std::vector<bool> reachable(const std::vector<std::string>& commits);
+	/* Commits at the edge of tips ^excludes: what a pack of those revs depends on */
+	extern std::vector<std::string> boundary(const std::vector<std::string>& tips, const std::vector<std::string>& excludes);
+	/* The commits a fetch of tips with --depth=depth sends: those fewer than depth parents away from one of them */
+	extern std::vector<std::string> shallow_commits(const std::vector<std::string>& tips, std::size_t depth, const std::vector<std::string>& env = {});
+	/* Objects that revs and their trees refer to but that are missing, e.g. the blobs of commits indexed from tree packs */
+	extern std::vector<std::string> missing_objects(const std::vector<std::string>& revs, const std::vector<std::string>& env = {});
+	/* Temporary bare repository; git runs in it with get_env() in its environment, GIT_DIR of the helper is left alone */
+	class scratch_repo_t {
+		std::filesystem::path dir{};
+	public:
+		scratch_repo_t();
+		scratch_repo_t(const scratch_repo_t&) = delete;
+		scratch_repo_t& operator=(const scratch_repo_t&) = delete;
+		~scratch_repo_t();
+
+		const std::filesystem::path& get_dir() const
+		{
+			return dir;
+		}
+
+		std::vector<std::string> get_env() const
+		{
+			return {"GIT_DIR=" + dir.string()};
+		}
+	};
+
+	/*
+	 * Pack everything reachable from revs ("^<rev>" excludes) into <dir>/pack-<hash>.{pack,idx}; returns <hash>.
+	 * With a filter (e.g. "blob:none") the objects it omits are left out and no .idx is written.
+	 */
+	extern std::string pack_objects(const std::vector<std::string>& revs, const std::filesystem::path& dir, std::string_view filter = {});
+	/*
+	 * As pack_objects(), but packs every object in the repository, reachable or not. The only filter is "blob:none",
+	 * which leaves out blobs by their type; it returns an empty hash and writes nothing if there are none to leave out.
+	 */
+	extern std::string pack_all_objects(const std::filesystem::path& dir, std::string_view filter = {}, const std::vector<std::string>& env = {});
+}
+
+#endif /* GIT_HPP */
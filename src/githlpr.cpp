@@ -1,15 +1,27 @@
 #include <filesystem>
 #include <ios>
+#include <optional>
 #include <iostream>
 #include <string>
 #include <string_view>
-#include <sstream>
 #include <stdexcept>
+#include <vector>
 
 #include <cstdlib>
 
-#include "debug.hpp"
+#include "fetch.hpp"
+#include "git.hpp"
 #include "githlpr.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "mirror.hpp"
+#include "protoio.hpp"
+#include "push.hpp"
+#include "remote.hpp"
+#include "sha1.hpp"
+#include "stats.hpp"
+#include "tokenizer.hpp"
+#include "trace.hpp"
 
 namespace
 {
@@ -17,39 +29,25 @@ namespace
 		CAPABILITIES,
 		PING,
 		PUSH,
+		FETCH,
 		LIST,
+		OPTION,
 		UNKNOWN,
 		BLANK_LINE
 	};
 
-	std::string get_nth_str_word(const std::string_view& str, const size_t n)
-	{
-		std::istringstream cmdstr{std::string(str)};
-		std::string word_n{};
-		for (size_t i{}; i < n; i++) {
-			cmdstr >> std::skipws >> word_n;
-		}
-		return word_n;
-	}
-
-	std::string get_push_dst(const std::string_view& push_args)
-	{
-		size_t colon_pos{push_args.find(':')};
-		if (std::string_view::npos == colon_pos) {
-			throw std::runtime_error("could not parse dst-ref from push argument");
-		}
-		colon_pos += 1;
-		return get_nth_str_word(push_args.substr(colon_pos, push_args.length() - colon_pos), 1);
-	}
-
 	git_cmd_t get_cmd_type(const std::string_view& cmd)
 	{
 		if        (cmd == githlpr::cmds::caps) {
 			return git_cmd_t::CAPABILITIES;
 		} else if (cmd == githlpr::cmds::push) {
 			return git_cmd_t::PUSH;
+		} else if (cmd == githlpr::cmds::fetch) {
+			return git_cmd_t::FETCH;
 		} else if (cmd == githlpr::cmds::list) {
 			return git_cmd_t::LIST;
+		} else if (cmd == githlpr::cmds::option) {
+			return git_cmd_t::OPTION;
 		} else if (cmd == githlpr::cmds::ping) {
 			return git_cmd_t::PING;
 		} else if (cmd.empty()) {
@@ -59,10 +57,91 @@ namespace
 		}
 	}
 
-	void write_caps(std::ostream& reply)
+	githlpr::tokenizer::cmd_line_t parse_cmd(const std::string& cmd)
+	{
+		const githlpr::trace::span_t span{"parse"};
+		return githlpr::tokenizer::tokenize(cmd);
+	}
+
+	void write_reply(githlpr::protoio::writer_t& reply, const std::string_view& line, const std::string_view& arg = {})
+	{
+		LOG_TRACE("<< " + std::string(line) + std::string(arg));
+		reply.write(line);
+		reply.write(arg);
+		reply.write("\n");
+	}
+
+	void write_caps(githlpr::protoio::writer_t& reply)
 	{
 		for (const std::string_view& cap : githlpr::replies::caps) {
-			reply << cap << std::endl;
+			write_reply(reply, cap);
+		}
+	}
+
+	void write_ref(githlpr::protoio::writer_t& reply, const std::string_view& sha1, const std::string_view& ref)
+	{
+		LOG_TRACE("<< " + std::string(sha1) + " " + std::string(ref));
+		reply.write(sha1);
+		reply.write(" ");
+		reply.write(ref);
+		reply.write("\n");
+	}
+
+	void write_head(githlpr::protoio::writer_t& reply, const githlpr::manifest::manifest_t& manifest)
+	{
+		if (not manifest.head.empty()) {
+			write_reply(reply, "@" + manifest.head, " HEAD");
+		}
+	}
+
+	void write_refs(githlpr::protoio::writer_t& reply, const githlpr::manifest::manifest_t& manifest)
+	{
+		for (const auto& [ref, sha1] : manifest.refs) {
+			write_ref(reply, sha1, ref);
+		}
+		write_head(reply, manifest);
+	}
+
+	/* Manifests read from the remote are kept per remote, so fetches that find nothing new only list the remote */
+	std::filesystem::path get_manifest_dir(const githlpr::remote::storage_t& storage)
+	{
+		if (not githlpr::has_valid_git_dir_env()) {
+			return {};
+		}
+		githlpr::sha1::context_t ctx{};
+		ctx.update(storage.get_name());
+		const githlpr::sha1::digest_t digest{ctx.finish()};
+		return githlpr::git::get_helper_dir() / "manifests" / githlpr::sha1::to_hex(std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size()));
+	}
+
+	/* Refs are written out while the manifest is decoded, so listing does not hold them in memory */
+	githlpr::manifest::manifest_t stream_refs(githlpr::protoio::writer_t& reply, githlpr::remote::storage_t& storage, const std::filesystem::path& manifest_dir)
+	{
+		const githlpr::manifest::manifest_t manifest{githlpr::manifest::read(storage, [&reply](const std::string_view ref, const std::string_view sha1) {
+			write_ref(reply, sha1, ref);
+		}, manifest_dir)};
+		write_head(reply, manifest);
+		return manifest;
+	}
+
+	void write_option_reply(githlpr::protoio::writer_t& reply, const githlpr::tokenizer::cmd_line_t& cmd_line, githlpr::fetch::options_t& options)
+	{
+		try {
+			const bool supported{githlpr::fetch::set_option(options, cmd_line.arg(0), cmd_line.rest(1))};
+			write_reply(reply, supported ? githlpr::replies::option_ok : githlpr::replies::option_unsupported);
+		} catch (const std::runtime_error& err) {
+			write_reply(reply, githlpr::replies::option_error, err.what());
+		}
+	}
+
+	void write_push_results(githlpr::protoio::writer_t& reply, const std::vector<githlpr::push::result_t>& results)
+	{
+		for (const githlpr::push::result_t& result : results) {
+			if (result.error.empty()) {
+				write_reply(reply, "ok ", result.dst);
+			} else {
+				write_reply(reply, "error ", result.dst + " " + result.error);
+			}
 		}
 	}
 }
@@ -75,35 +154,93 @@ bool githlpr::has_valid_git_dir_env()
 	return false;
 }
 
-void githlpr::process_git_cmds(std::istream& input, std::ostream& output)
+void githlpr::process_git_cmds(protoio::reader_t& input, protoio::writer_t& output, remote::storage_t& storage, mirror::fanout_t *const fanout)
 {
-	std::string cmd;
-	while(not std::getline(input, cmd).eof()) {
-		std::string cmd_prefix = get_nth_str_word(cmd, 1);
-		std::stringstream reply{};
-		DEBUG_LOG(">> " + cmd);
-		switch(get_cmd_type(cmd_prefix)) {
+	std::string cmd; // line buffer is reused; its capacity settles after the first few lines
+	std::vector<push::spec_t> push_batch{};
+	std::vector<fetch::want_t> fetch_batch{};
+	fetch::options_t fetch_options{};
+	std::optional<manifest::manifest_t> remote_state{}; // as of the last "list for-push", kept current by pushes
+	std::optional<std::vector<manifest::pack_t>> remote_packs{}; // as of the last list
+	const std::filesystem::path manifest_dir{get_manifest_dir(storage)};
+	while (input.getline(cmd)) {
+		const tokenizer::cmd_line_t cmd_line{parse_cmd(cmd)};
+		bool replied{true};
+		LOG_TRACE(">> " + cmd);
+		switch(get_cmd_type(cmd_line.cmd())) {
 			case git_cmd_t::CAPABILITIES:
-				write_caps(reply);
+				write_caps(output);
 				break;
 			case git_cmd_t::PUSH:
-				reply << "ok " << get_push_dst(get_nth_str_word(cmd, 2)) << std::endl;
+				// Replies are sent for the whole batch once git terminates it with a blank line
+				push_batch.push_back(push::parse_spec(cmd_line.arg(0)));
+				replied = false;
 				break;
-			case git_cmd_t::LIST:
-				reply << "2a569a9e9e5a0d8e4ce829bbdd84904633024f86 refs/heads/master" << std::endl;
+			case git_cmd_t::FETCH:
+				// Like push, a fetch batch is only replied to (with a blank line) once it is terminated
+				fetch_batch.push_back(fetch::parse_want(cmd_line));
+				replied = false;
+				break;
+			case git_cmd_t::LIST: {
+				const trace::span_t span{"list", cmd};
+				const stats::timer_t timer{stats::op_t::LIST};
+				if (cmds::for_push == cmd_line.arg(0)) {
+					remote_state = manifest::read(storage, manifest_dir); // pushes need the remote refs
+					write_refs(output, *remote_state);
+					remote_packs = remote_state->packs;
+				} else {
+					remote_state.reset();
+					remote_packs = stream_refs(output, storage, manifest_dir).packs;
+				}
+				break;
+			}
+			case git_cmd_t::OPTION:
+				// The reply is a single line without a terminating blank line
+				write_option_reply(output, cmd_line, fetch_options);
+				if (not input.has_buffered()) {
+					output.flush();
+				}
+				replied = false;
 				break;
 			case git_cmd_t::PING:
-				reply << replies::ping_reply << std::endl;
+				write_reply(output, replies::ping_reply);
 				break;
 			case git_cmd_t::BLANK_LINE:
+				replied = not (push_batch.empty() and fetch_batch.empty());
+				if (not push_batch.empty()) {
+					const trace::span_t span{"push batch"};
+					if (not remote_state) {
+						remote_state = manifest::read(storage, manifest_dir);
+					}
+					write_push_results(output, push::push_batch(storage, push_batch, *remote_state, fanout));
+					remote_packs = remote_state->packs;
+					push_batch.clear();
+				}
+				if (not fetch_batch.empty()) {
+					const trace::span_t span{"fetch batch"};
+					if (not remote_packs) {
+						remote_packs = manifest::read(storage, manifest_dir).packs;
+					}
+					fetch::fetch_batch(storage, *remote_packs, fetch_batch, fetch_options);
+					fetch_batch.clear();
+				}
 				break;
 			default:
-				DEBUG_LOG("unknown cmd");
 				throw std::runtime_error("unknown command: " + cmd);
 		}
-		DEBUG_LOG("<< " + reply.str());
-		if (std::stringstream::traits_type::eof() != reply.peek()) {
-			output << reply.str() << std::endl;
+		if (replied) {
+			output.write("\n"); // blank line terminates the reply
+			if (not input.has_buffered()) {
+				output.flush(); // git waits for this reply before it sends more
+			}
 		}
 	}
+	output.flush();
+}
+
+void githlpr::process_git_cmds(std::istream& input, std::ostream& output, remote::storage_t& storage, mirror::fanout_t *const fanout)
+{
+	protoio::stream_reader_t reader{input};
+	protoio::stream_writer_t writer{output};
+	process_git_cmds(reader, writer, storage, fanout);
 }
@@ -5,6 +5,10 @@
 #include <iostream>
 #include <string>
 
+#include "mirror.hpp"
+#include "protoio.hpp"
+#include "remote.hpp"
+
 namespace githlpr
 {
 	namespace cmds
@@ -12,18 +16,25 @@ namespace githlpr
 		inline constexpr std::string_view caps{"capabilities"};
 		inline constexpr std::string_view push{"push"};
 		inline constexpr std::string_view list{"list"};
+		inline constexpr std::string_view for_push{"for-push"};
 		inline constexpr std::string_view fetch{"fetch"};
+		inline constexpr std::string_view option{"option"};
 		inline constexpr std::string_view ping{"ping"}; // not a git helper cmd; implemented for testing
 	}
 
 	namespace replies
 	{
-		inline constexpr std::array<std::string_view, 2> caps{{"push", "fetch"}};
+		inline constexpr std::array<std::string_view, 3> caps{{"push", "fetch", "option"}};
+		inline constexpr std::string_view option_ok{"ok"};
+		inline constexpr std::string_view option_unsupported{"unsupported"};
+		inline constexpr std::string_view option_error{"error "};
 		inline constexpr std::string_view ping_reply{"pong"};
 	}
 
 	extern bool has_valid_git_dir_env();
-	extern void process_git_cmds(std::istream&, std::ostream&);
+	/* Pushes are replicated to fanout's mirrors unless it is null */
+	extern void process_git_cmds(protoio::reader_t&, protoio::writer_t&, remote::storage_t&, mirror::fanout_t* fanout = nullptr);
+	extern void process_git_cmds(std::istream&, std::ostream&, remote::storage_t&, mirror::fanout_t* fanout = nullptr);
 }
 
 #endif /* GITHLPR_HPP */
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "chunks.hpp"
+#include "download.hpp"
+#include "git.hpp"
+#include "lazy.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "packidx.hpp"
+#include "proc.hpp"
+#include "remote.hpp"
+#include "sha1.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+/*
+ * A pack entry is <type:3 bits, size:varint> followed by, for an OFS_DELTA, the base's distance back from the entry,
+ * for a REF_DELTA the base's sha1, and then the zlib stream. Entries are copied as they are, except that
+ * OFS_DELTAs become REF_DELTAs, since their bases move in the new pack.
+ */
+
+namespace
+{
+	constexpr unsigned ofs_delta{6};
+	constexpr unsigned ref_delta{7};
+	constexpr std::uint64_t max_gap{256 * 1024}; // objects this close together are read as one range; a transfer costs more
+
+	[[noreturn]] void throw_corrupt(const std::string& pack_name)
+	{
+		throw std::runtime_error("corrupt pack entry in " + pack_name);
+	}
+
+	/* An object to copy: its entry at offset in pack */
+	struct wanted_t {
+		const githlpr::manifest::pack_t* pack{};
+		const githlpr::packidx::index_t* index{};
+		std::uint64_t offset{};
+	};
+
+	class pack_builder_t {
+		githlpr::remote::storage_t& storage;
+		githlpr::cache::cache_t& cache;
+		const githlpr::download::options_t options{githlpr::download::get_options()};
+		std::map<std::string, std::optional<githlpr::packidx::index_t>> indexes{}; // by pack name
+		std::map<std::string, std::vector<githlpr::chunks::chunk_t>> chunk_lists{}; // by pack name, for chunked packs
+		std::map<std::string, std::map<std::uint64_t, std::string>> fetched{}; // by pack name: bytes read by their offset
+		std::map<std::string, std::string, std::less<>> entries{}; // raw sha1 -> entry
+		std::vector<wanted_t> pending{};
+
+		/* The bytes of the entry at offset, if a range read so far covers them */
+		std::optional<std::string_view> find_fetched(const wanted_t& wanted) const
+		{
+			const auto ranges = fetched.find(wanted.pack->name);
+			if (fetched.end() == ranges) {
+				return std::nullopt;
+			}
+			auto range = ranges->second.upper_bound(wanted.offset);
+			if (ranges->second.begin() == range) {
+				return std::nullopt;
+			}
+			--range;
+			const std::uint64_t end{wanted.index->get_end(wanted.offset, wanted.pack->size)};
+			if (end > range->first + range->second.size()) {
+				return std::nullopt;
+			}
+			return std::string_view(range->second).substr(wanted.offset - range->first, end - wanted.offset);
+		}
+
+		/* Parts of the remote objects that hold count bytes at offset of pack */
+		void add_parts(const githlpr::manifest::pack_t& pack, const std::uint64_t offset, const std::uint64_t count, std::vector<githlpr::download::part_t>& parts)
+		{
+			if (not pack.chunked) {
+				parts.push_back({std::string(githlpr::manifest::packs_dir) + pack.name, offset, count});
+				return;
+			}
+			auto it = chunk_lists.find(pack.name);
+			if (chunk_lists.end() == it) {
+				it = chunk_lists.emplace(pack.name, githlpr::chunks::read_list(storage, pack.name)).first;
+			}
+			const std::uint64_t end{offset + count};
+			std::uint64_t start{};
+			for (auto chunk = it->second.begin(); it->second.end() != chunk and start < end; start += chunk->size, ++chunk) {
+				if (start + chunk->size > offset) {
+					const std::uint64_t from{std::max(offset, start) - start};
+					parts.push_back({std::string(githlpr::chunks::dir) + chunk->sha1, from, std::min(end - start, chunk->size) - from});
+				}
+			}
+		}
+
+		/* Reads the entries not covered yet, merging those close together in a pack into one range, jobs ranges at a time */
+		void fetch(std::vector<wanted_t> missing)
+		{
+			std::sort(missing.begin(), missing.end(), [](const wanted_t& a, const wanted_t& b) {
+				return a.pack->name < b.pack->name or (a.pack->name == b.pack->name and a.offset < b.offset);
+			});
+			std::vector<std::pair<const githlpr::manifest::pack_t*, std::pair<std::uint64_t, std::uint64_t>>> ranges{}; // [begin, end) per pack
+			for (const wanted_t& wanted : missing) {
+				const std::uint64_t end{wanted.index->get_end(wanted.offset, wanted.pack->size)};
+				if (not ranges.empty() and ranges.back().first == wanted.pack and wanted.offset <= ranges.back().second.second + max_gap
+						and end - ranges.back().second.first <= options.chunk_size) {
+					ranges.back().second.second = std::max(ranges.back().second.second, end);
+				} else {
+					ranges.push_back({wanted.pack, {wanted.offset, end}});
+				}
+			}
+			std::vector<githlpr::download::part_t> parts{};
+			for (const auto& [pack, range] : ranges) {
+				add_parts(*pack, range.first, range.second - range.first, parts);
+			}
+			LOG_DEBUG("reading " + std::to_string(missing.size()) + " objects as " + std::to_string(ranges.size()) + " ranges");
+			const std::filesystem::path dir{githlpr::git::get_helper_dir() / "tmp"};
+			std::filesystem::create_directories(dir);
+			const std::filesystem::path file{dir / ("lazy-" + std::to_string(::getpid()) + ".ranges")};
+			const bool found{githlpr::download::download_parts(storage, parts, file, options)};
+			std::ifstream strm{file, std::ios::binary};
+			for (const auto& [pack, range] : ranges) {
+				std::string data(range.second - range.first, '\0');
+				if (not found or not strm.read(data.data(), static_cast<std::streamsize>(data.size()))) {
+					std::filesystem::remove(file);
+					throw std::runtime_error("pack missing on remote: " + pack->name);
+				}
+				githlpr::stats::add_downloaded(data.size());
+				fetched[pack->name].emplace(range.first, std::move(data));
+			}
+			std::filesystem::remove(file);
+		}
+
+		/* Copies the entry of wanted out of the bytes read; returns its delta base, which it needs as well, if it has one */
+		std::optional<wanted_t> copy_entry(const wanted_t& wanted, const std::string_view bytes)
+		{
+			const githlpr::manifest::pack_t& pack = *wanted.pack;
+			const githlpr::packidx::index_t& index = *wanted.index;
+			std::string data{bytes};
+			std::size_t pos{};
+			const auto next_byte = [&data, &pos, &pack]() {
+				if (pos >= data.size()) {
+					throw_corrupt(pack.name);
+				}
+				return static_cast<std::uint8_t>(data[pos++]);
+			};
+			const unsigned type{static_cast<unsigned>(next_byte() >> 4 & 7)};
+			for (std::uint8_t b{static_cast<std::uint8_t>(data[0])}; b & 0x80;) {
+				b = next_byte();
+			}
+			const std::size_t header_len{pos};
+			std::optional<wanted_t> base{};
+			if (ofs_delta == type) {
+				std::uint8_t b{next_byte()};
+				std::uint64_t distance{b & 0x7fu};
+				while (b & 0x80) {
+					b = next_byte();
+					distance = (distance + 1) << 7 | (b & 0x7fu);
+				}
+				if (distance > wanted.offset) {
+					throw_corrupt(pack.name);
+				}
+				base = wanted_t{&pack, &index, wanted.offset - distance};
+				data[0] = static_cast<char>((static_cast<std::uint8_t>(data[0]) & 0x8f) | ref_delta << 4);
+				data.replace(header_len, pos - header_len, index.get_name(base->offset));
+			} else if (ref_delta == type) {
+				const std::string base_name(data, header_len, githlpr::sha1::raw_len);
+				const std::optional<std::uint64_t> base_offset{index.find(base_name)};
+				if (githlpr::sha1::raw_len != base_name.size() or not base_offset) {
+					throw_corrupt(pack.name);
+				}
+				base = wanted_t{&pack, &index, *base_offset};
+			}
+			entries.emplace(index.get_name(wanted.offset), std::move(data));
+			return base;
+		}
+	public:
+		pack_builder_t(githlpr::remote::storage_t& storage, githlpr::cache::cache_t& cache) : storage(storage), cache(cache) {}
+
+		const githlpr::packidx::index_t* get_index(const githlpr::manifest::pack_t& pack)
+		{
+			auto it = indexes.find(pack.name);
+			if (indexes.end() == it) {
+				it = indexes.emplace(pack.name, githlpr::packidx::fetch_index(storage, cache, pack.name)).first;
+			}
+			return it->second ? &*it->second : nullptr;
+		}
+
+		/* Adds the object at offset and, once resolve() runs, the chain of delta bases it needs */
+		void add(const githlpr::manifest::pack_t& pack, const githlpr::packidx::index_t& index, const std::uint64_t offset)
+		{
+			pending.push_back({&pack, &index, offset});
+		}
+
+		/*
+		 * Reads the objects added, then their delta bases, one round per delta chain level; a round reads all it
+		 * needs at once, and bases already in the bytes read are not read again
+		 */
+		void resolve()
+		{
+			while (not pending.empty()) {
+				std::vector<wanted_t> missing{};
+				for (const wanted_t& wanted : pending) {
+					if (not entries.count(wanted.index->get_name(wanted.offset)) and not find_fetched(wanted)) {
+						missing.push_back(wanted);
+					}
+				}
+				if (not missing.empty()) {
+					fetch(std::move(missing));
+				}
+				std::vector<wanted_t> bases{};
+				for (const wanted_t& wanted : pending) {
+					if (entries.count(wanted.index->get_name(wanted.offset))) {
+						continue;
+					}
+					const std::optional<std::string_view> bytes{find_fetched(wanted)};
+					if (not bytes) {
+						throw_corrupt(wanted.pack->name);
+					}
+					if (const std::optional<wanted_t> base{copy_entry(wanted, *bytes)}) {
+						bases.push_back(*base);
+					}
+				}
+				pending = std::move(bases);
+			}
+		}
+
+		/* "PACK" <version 2:u32> <nentries:u32> <entries> <sha1 of all before> */
+		std::string build() const
+		{
+			std::string pack{"PACK"};
+			for (const std::uint32_t word : {std::uint32_t{2}, static_cast<std::uint32_t>(entries.size())}) {
+				for (int shift{24}; shift >= 0; shift -= 8) {
+					pack.push_back(static_cast<char>(word >> shift));
+				}
+			}
+			for (const auto& entry : entries) {
+				pack.append(entry.second);
+			}
+			githlpr::sha1::context_t ctx{};
+			ctx.update(pack);
+			const githlpr::sha1::digest_t digest{ctx.finish()};
+			pack.append(reinterpret_cast<const char*>(digest.data()), digest.size());
+			return pack;
+		}
+
+		std::size_t size() const
+		{
+			return entries.size();
+		}
+	};
+}
+
+void githlpr::lazy::fetch_objects(remote::storage_t& storage, cache::cache_t& cache, const std::vector<manifest::pack_t>& packs, const std::vector<std::string>& sha1s,
+				   const std::vector<std::string>& env)
+{
+	const trace::span_t span{"lazy fetch"};
+	pack_builder_t builder{storage, cache};
+	for (const std::string& sha1 : sha1s) {
+		const std::string raw{sha1::from_hex(sha1)};
+		bool found{};
+		// Newest first: recently pushed objects are the ones most likely missing
+		for (auto pack = packs.rbegin(); not found and packs.rend() != pack; pack++) {
+			if (pack->tree_pack.empty() or 0 == pack->size) {
+				continue;
+			}
+			if (const packidx::index_t *const index = builder.get_index(*pack)) {
+				if (const std::optional<std::uint64_t> offset = index->find(raw)) {
+					builder.add(*pack, *index, *offset);
+					found = true;
+				}
+			}
+		}
+		if (not found) {
+			throw std::runtime_error("object not found on remote: " + sha1);
+		}
+	}
+	builder.resolve();
+	LOG_DEBUG("indexing " + std::to_string(builder.size()) + " objects for " + std::to_string(sha1s.size()) + " lazy fetches");
+	(void)proc::run({"git", "index-pack", "--stdin", "--promisor"}, builder.build(), env);
+}
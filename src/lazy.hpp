@@ -0,0 +1,22 @@
+#ifndef LAZY_HPP
+#define LAZY_HPP
+
+#include <string>
+#include <vector>
+
+#include "cache.hpp"
+#include "manifest.hpp"
+#include "remote.hpp"
+
+/* Single objects for git's lazy fetches from a partial clone, read out of the remote packs by byte range */
+namespace githlpr::lazy
+{
+	/*
+	 * Looks the objects up in the remote pack indexes and indexes them, with the delta bases they need, into GIT_DIR as a promisor pack.
+	 * Only packs with a tree pack are searched: the blobs of other packs were fetched in full. git index-pack runs with env.
+	 */
+	extern void fetch_objects(remote::storage_t& storage, cache::cache_t& cache, const std::vector<manifest::pack_t>& packs, const std::vector<std::string>& sha1s,
+				  const std::vector<std::string>& env = {});
+}
+
+#endif /* LAZY_HPP */
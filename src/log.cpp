@@ -0,0 +1,34 @@
+#include <array>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include <cstdlib>
+
+#include "log.hpp"
+
+namespace
+{
+	constexpr std::array<std::string_view, GITHLPR_LOG_TRACE + 1> level_names{{"error", "warn", "info", "debug", "trace"}};
+}
+
+int githlpr::log::parse_level(const std::string_view level)
+{
+	for (std::size_t i{}; i < level_names.size(); i++) {
+		if (level_names[i] == level or std::to_string(i) == level) {
+			return static_cast<int>(i);
+		}
+	}
+	return default_level;
+}
+
+int githlpr::log::read_level()
+{
+	const char *const clevel = std::getenv(std::string(level_env).c_str());
+	return clevel ? parse_level(clevel) : default_level;
+}
+
+void githlpr::log::write(const int level, const std::string_view func, const std::string_view msg)
+{
+	std::cerr << "git-remote-rclone: " << level_names.at(static_cast<std::size_t>(level)) << ": " << func << ": " << msg << std::endl;
+}
@@ -0,0 +1,63 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <string_view>
+
+/* Levels as plain macros so the build can pick the compiled-in level, e.g. -DGITHLPR_LOG_LEVEL=GITHLPR_LOG_INFO */
+#define GITHLPR_LOG_ERROR 0
+#define GITHLPR_LOG_WARN  1
+#define GITHLPR_LOG_INFO  2
+#define GITHLPR_LOG_DEBUG 3
+#define GITHLPR_LOG_TRACE 4
+
+#ifndef GITHLPR_LOG_LEVEL
+#ifdef DEBUG
+#define GITHLPR_LOG_LEVEL GITHLPR_LOG_TRACE
+#else
+#define GITHLPR_LOG_LEVEL GITHLPR_LOG_INFO
+#endif
+#endif
+
+/*
+ * Messages above GITHLPR_LOG_LEVEL are discarded at compile time: their argument is type checked but never
+ * evaluated. The others cost one load and compare unless $GIT_REMOTE_RCLONE_LOG enables their level.
+ */
+#define GITHLPR_LOG(level, x) \
+	do { \
+		if constexpr ((level) <= GITHLPR_LOG_LEVEL) { \
+			if (githlpr::log::is_enabled(level)) { \
+				githlpr::log::write((level), __PRETTY_FUNCTION__, (x)); \
+			} \
+		} \
+	} while (false)
+
+#define LOG_ERROR(x) GITHLPR_LOG(GITHLPR_LOG_ERROR, x)
+#define LOG_WARN(x)  GITHLPR_LOG(GITHLPR_LOG_WARN, x)
+#define LOG_INFO(x)  GITHLPR_LOG(GITHLPR_LOG_INFO, x)
+#define LOG_DEBUG(x) GITHLPR_LOG(GITHLPR_LOG_DEBUG, x)
+#define LOG_TRACE(x) GITHLPR_LOG(GITHLPR_LOG_TRACE, x) // every protocol line
+
+namespace githlpr::log
+{
+	inline constexpr std::string_view level_env{"GIT_REMOTE_RCLONE_LOG"}; // error, warn, info, debug, trace or 0-4
+#ifdef DEBUG
+	inline constexpr int default_level{GITHLPR_LOG_DEBUG};
+#else
+	inline constexpr int default_level{GITHLPR_LOG_WARN};
+#endif
+
+	/* Level name or number; default_level if level is not one */
+	extern int parse_level(std::string_view level);
+	/* $GIT_REMOTE_RCLONE_LOG as of the first call */
+	extern int read_level();
+
+	inline bool is_enabled(const int level)
+	{
+		static const int max_level{read_level()};
+		return level <= max_level;
+	}
+
+	extern void write(int level, std::string_view func, std::string_view msg);
+}
+
+#endif /* LOG_HPP */
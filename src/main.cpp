@@ -1,14 +1,84 @@
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
+#include <csignal>
 #include <cstdlib>
 
+#include <unistd.h>
+
+#include "compact.hpp"
+#include "daemon.hpp"
 #include "githlpr.hpp"
+#include "mirror.hpp"
+#include "protoio.hpp"
+#include "remote.hpp"
+
+namespace
+{
+	/* "git-remote-rclone --compact <url>": maintenance run by the user, not by git */
+	int compact(const char *const url)
+	{
+		const std::unique_ptr<githlpr::remote::storage_t> storage{githlpr::remote::open_url(url)};
+		const githlpr::compact::result_t result{githlpr::compact::compact(*storage, githlpr::compact::get_options())};
+		std::cerr << "git-remote-rclone: merged " << result.merged << " packs, deleted " << result.deleted << " superseded packs, " << result.deleted_chunks << " chunks and " << result.pruned << " old manifests" << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	/* "git-remote-rclone <remote> [<url>]" as run by git, here or in the daemon */
+	int run(const std::vector<std::string>& args)
+	{
+		if (not githlpr::has_valid_git_dir_env()) {
+			std::cerr << "GIT_DIR is not set" << std::endl;
+			return EXIT_FAILURE;
+		}
+		if (args.empty()) {
+			std::cerr << "usage: git-remote-rclone <remote> [<url>]" << std::endl;
+			std::cerr << "       git-remote-rclone --compact <url>" << std::endl;
+			std::cerr << "       git-remote-rclone --daemon" << std::endl;
+			return EXIT_FAILURE;
+		}
+		try {
+			// git passes the url as second argument; without it the remote name is the url
+			const std::unique_ptr<githlpr::remote::storage_t> storage{githlpr::remote::open_url(args.size() < 2 ? args[0] : args[1])};
+			const std::unique_ptr<githlpr::mirror::fanout_t> fanout{githlpr::mirror::open(*storage, args[0])}; // waits for slow mirrors before exiting
+			githlpr::protoio::fd_reader_t input{STDIN_FILENO};
+			githlpr::protoio::fd_writer_t output{STDOUT_FILENO};
+			githlpr::process_git_cmds(input, output, *storage, fanout.get());
+		} catch (const std::runtime_error& err) {
+			std::cerr << "git-remote-rclone: " << err.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+}
 
-int main()
+int main(const int argc, const char *const argv[])
 {
-	if (not githlpr::has_valid_git_dir_env()) {
-		std::cerr << "GIT_DIR is not set" << std::endl;
-		std::exit(EXIT_FAILURE);
+	std::signal(SIGPIPE, SIG_IGN); // a vanished rclone/git child must surface as EPIPE, not kill the helper
+	const std::vector<std::string> args(argv + 1, argv + argc);
+	if (2 == args.size() and "--compact" == args[0]) {
+		try {
+			return compact(args[1].c_str());
+		} catch (const std::runtime_error& err) {
+			std::cerr << "git-remote-rclone: " << err.what() << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+	} else if (1 == args.size() and "--daemon" == args[0]) {
+		try {
+			return githlpr::daemon::serve(run);
+		} catch (const std::runtime_error& err) {
+			std::cerr << "git-remote-rclone: " << err.what() << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+	} else if (githlpr::daemon::is_enabled()) {
+		if (const std::optional<int> code = githlpr::daemon::forward(args)) {
+			return *code;
+		}
 	}
-	githlpr::process_git_cmds(std::cin, std::cout);
+	return run(args);
 }
@@ -0,0 +1,607 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "git.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "proc.hpp"
+#include "remote.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+/*
+ * Binary format; integers are unsigned LEB128 varints, sha1s are 20 raw bytes:
+ *   "GRRM" <version:u8>
+ *   <len> <head>
+ *   <nrefs> { <shared prefix len with previous ref> <suffix len> <suffix> <sha1> }   (sorted by ref)
+ *   <npacks> { <len> <name> <size> <len> <tree pack> <tree pack size> <flags> <ntips> { <sha1> } <nprereqs> { <sha1> } }
+ *   (packs oldest first; no <size> in version 1, no tree pack before version 3, no <flags> before version 4)
+ * <flags> has bit 0 set for a chunked pack, bit 1 for a chunked tree pack.
+ */
+
+namespace
+{
+	constexpr std::size_t io_buffer_size{64 * 1024};
+	constexpr std::size_t sha1_raw_len{githlpr::git::sha1_hex_len / 2};
+	constexpr std::uint64_t max_name_len{64 * 1024};
+	constexpr std::string_view hex_digits{"0123456789abcdef"};
+	constexpr std::uint64_t chunked_flag{1};
+	constexpr std::uint64_t tree_pack_chunked_flag{2};
+	constexpr std::size_t generation_len{20};
+	constexpr unsigned max_read_attempts{3};
+	constexpr unsigned max_commit_attempts{100};
+	constexpr std::chrono::milliseconds min_backoff{10};
+	constexpr std::chrono::milliseconds max_backoff{2000};
+
+	[[noreturn]] void throw_corrupt(const std::string& what)
+	{
+		throw std::runtime_error("corrupt manifest: " + what);
+	}
+
+	/* Buffered writer; accumulates in memory when fd is -1 */
+	class encoder_t {
+		const int fd;
+		std::string buf{};
+		std::uint64_t nflushed{};
+	public:
+		explicit encoder_t(const int fd = -1) : fd(fd) { buf.reserve(io_buffer_size); }
+
+		void bytes(const std::string_view data)
+		{
+			buf.append(data);
+			if (-1 != fd and buf.size() >= io_buffer_size) {
+				flush();
+			}
+		}
+
+		void varint(std::uint64_t value)
+		{
+			std::array<char, 10> enc{};
+			std::size_t len{};
+			do {
+				enc[len++] = static_cast<char>((value & 0x7f) | (value > 0x7f ? 0x80 : 0));
+				value >>= 7;
+			} while (value);
+			bytes(std::string_view(enc.data(), len));
+		}
+
+		void string(const std::string_view str)
+		{
+			varint(str.length());
+			bytes(str);
+		}
+
+		void sha1(const std::string_view hex)
+		{
+			if (githlpr::git::sha1_hex_len != hex.length()) {
+				throw std::runtime_error("invalid sha1: " + std::string(hex));
+			}
+			std::array<char, sha1_raw_len> raw{};
+			for (std::size_t i{}; i < raw.size(); i++) {
+				const std::size_t hi{hex_digits.find(hex[2 * i])}, lo{hex_digits.find(hex[2 * i + 1])};
+				if (std::string_view::npos == hi or std::string_view::npos == lo) {
+					throw std::runtime_error("invalid sha1: " + std::string(hex));
+				}
+				raw[i] = static_cast<char>(hi << 4 | lo);
+			}
+			bytes(std::string_view(raw.data(), raw.size()));
+		}
+
+		void flush()
+		{
+			githlpr::proc::write_all(fd, buf);
+			nflushed += buf.size();
+			buf.clear();
+		}
+
+		std::uint64_t get_nflushed() const
+		{
+			return nflushed;
+		}
+
+		std::string& get_buf()
+		{
+			return buf;
+		}
+	};
+
+	/* Buffered reader over an fd, or over data already in memory when fd is -1; what is read from fd goes to copy too */
+	class decoder_t {
+		const int fd;
+		const int copy{-1};
+		std::string buf{};
+		std::string_view avail{};
+		std::uint64_t nread_total{};
+	public:
+		explicit decoder_t(const int fd, const int copy = -1) : fd(fd), copy(copy), buf(io_buffer_size, '\0') {}
+		explicit decoder_t(const std::string_view data) : fd(-1), avail(data) {}
+
+		bool refill()
+		{
+			if (-1 == fd) {
+				return false;
+			}
+			for (;;) {
+				const ssize_t nread = ::read(fd, buf.data(), buf.size());
+				if (-1 == nread and EINTR == errno) {
+					continue;
+				} else if (-1 == nread) {
+					githlpr::proc::throw_errno("cannot read manifest");
+				}
+				avail = std::string_view(buf.data(), static_cast<std::size_t>(nread));
+				nread_total += static_cast<std::uint64_t>(nread);
+				if (-1 != copy) {
+					githlpr::proc::write_all(copy, avail);
+				}
+				return nread > 0;
+			}
+		}
+
+		bool at_eof()
+		{
+			return avail.empty() and not refill();
+		}
+
+		std::uint8_t byte()
+		{
+			if (at_eof()) {
+				throw_corrupt("unexpected end");
+			}
+			const std::uint8_t value{static_cast<std::uint8_t>(avail.front())};
+			avail.remove_prefix(1);
+			return value;
+		}
+
+		std::uint64_t varint()
+		{
+			std::uint64_t value{};
+			for (unsigned shift{}; shift < 64; shift += 7) {
+				const std::uint8_t b{byte()};
+				value |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+				if (not (b & 0x80)) {
+					return value;
+				}
+			}
+			throw_corrupt("varint overflow");
+		}
+
+		void bytes(std::string& out, std::size_t len)
+		{
+			while (len) {
+				if (at_eof()) {
+					throw_corrupt("unexpected end");
+				}
+				const std::size_t n{std::min(len, avail.length())};
+				out.append(avail.substr(0, n));
+				avail.remove_prefix(n);
+				len -= n;
+			}
+		}
+
+		std::uint64_t length()
+		{
+			const std::uint64_t len{varint()};
+			if (len > max_name_len) {
+				throw_corrupt("name too long");
+			}
+			return len;
+		}
+
+		void string(std::string& out)
+		{
+			out.clear();
+			bytes(out, length());
+		}
+
+		void sha1(std::string& hex)
+		{
+			hex.clear();
+			for (std::size_t i{}; i < sha1_raw_len; i++) {
+				const std::uint8_t b{byte()};
+				hex.push_back(hex_digits[b >> 4]);
+				hex.push_back(hex_digits[b & 0xf]);
+			}
+		}
+
+		/* Bytes read from fd so far */
+		std::uint64_t get_nread() const
+		{
+			return nread_total;
+		}
+	};
+
+	void encode(encoder_t& enc, const githlpr::manifest::manifest_t& manifest)
+	{
+		enc.bytes(githlpr::manifest::magic);
+		enc.bytes(std::string_view(reinterpret_cast<const char*>(&githlpr::manifest::version), 1));
+		enc.string(manifest.head);
+		enc.varint(manifest.refs.size());
+		std::string_view prev{};
+		for (const auto& [ref, sha1] : manifest.refs) {
+			// Refs are sorted, so neighbours share long prefixes such as "refs/tags/v1."
+			const std::size_t shared{static_cast<std::size_t>(std::mismatch(prev.begin(), prev.end(), ref.begin(), ref.end()).first - prev.begin())};
+			enc.varint(shared);
+			enc.string(std::string_view(ref).substr(shared));
+			enc.sha1(sha1);
+			prev = ref;
+		}
+		enc.varint(manifest.packs.size());
+		for (const githlpr::manifest::pack_t& pack : manifest.packs) {
+			enc.string(pack.name);
+			enc.varint(pack.size);
+			enc.string(pack.tree_pack);
+			enc.varint(pack.tree_pack_size);
+			enc.varint((pack.chunked ? chunked_flag : 0) | (pack.tree_pack_chunked ? tree_pack_chunked_flag : 0));
+			enc.varint(pack.tips.size());
+			for (const std::string& tip : pack.tips) {
+				enc.sha1(tip);
+			}
+			enc.varint(pack.prereqs.size());
+			for (const std::string& prereq : pack.prereqs) {
+				enc.sha1(prereq);
+			}
+		}
+	}
+
+	githlpr::manifest::manifest_t decode(decoder_t& dec, const githlpr::manifest::ref_visitor_t& on_ref)
+	{
+		githlpr::manifest::manifest_t manifest{};
+		if (dec.at_eof()) {
+			return manifest; // empty object: empty remote
+		}
+		std::string header{};
+		dec.bytes(header, githlpr::manifest::magic.length());
+		if (githlpr::manifest::magic != header) {
+			throw_corrupt("bad magic");
+		}
+		const std::uint8_t version{dec.byte()};
+		if (0 == version or githlpr::manifest::version < version) {
+			throw std::runtime_error("unsupported manifest version");
+		}
+		dec.string(manifest.head);
+
+		std::string ref{}, sha1{};
+		for (std::uint64_t nrefs{dec.varint()}; nrefs; nrefs--) {
+			const std::uint64_t shared{dec.varint()};
+			if (shared > ref.length()) {
+				throw_corrupt("bad ref prefix");
+			}
+			ref.resize(static_cast<std::size_t>(shared));
+			dec.bytes(ref, dec.length());
+			dec.sha1(sha1);
+			on_ref(ref, sha1);
+		}
+
+		for (std::uint64_t npacks{dec.varint()}; npacks; npacks--) {
+			githlpr::manifest::pack_t& pack = manifest.packs.emplace_back();
+			dec.string(pack.name);
+			if (version > 1) {
+				pack.size = dec.varint();
+			}
+			if (version > 2) {
+				dec.string(pack.tree_pack);
+				pack.tree_pack_size = dec.varint();
+			}
+			if (version > 3) {
+				const std::uint64_t flags{dec.varint()};
+				pack.chunked = flags & chunked_flag;
+				pack.tree_pack_chunked = flags & tree_pack_chunked_flag;
+			}
+			for (std::uint64_t ntips{dec.varint()}; ntips; ntips--) {
+				dec.sha1(pack.tips.emplace_back());
+			}
+			for (std::uint64_t nprereqs{dec.varint()}; nprereqs; nprereqs--) {
+				dec.sha1(pack.prereqs.emplace_back());
+			}
+		}
+		if (not dec.at_eof()) {
+			throw_corrupt("trailing data");
+		}
+		return manifest;
+	}
+
+	/* "<generation>" of a committed manifest; candidates add "-<unix time>-<nonce>" */
+	std::string get_generation_name(const std::uint64_t generation)
+	{
+		const std::string digits{std::to_string(generation)};
+		return std::string(generation_len - std::min(generation_len, digits.length()), '0') + digits;
+	}
+
+	/* Generation of the newest committed manifest listed; 0 if there is none */
+	std::uint64_t get_newest(const std::map<std::string, std::uint64_t>& listed)
+	{
+		for (auto it = listed.rbegin(); listed.rend() != it; ++it) {
+			if (generation_len == it->first.length() and std::string::npos == it->first.find_first_not_of("0123456789")) {
+				return std::stoull(it->first);
+			}
+		}
+		return 0;
+	}
+
+	std::int64_t get_time()
+	{
+		return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	/* Candidates record when they were uploaded, by the clock of their push; committed manifests never go stale */
+	bool is_stale(const std::string& name, const std::int64_t now)
+	{
+		if (name.length() <= generation_len or '-' != name[generation_len]) {
+			return false;
+		}
+		const std::string time{name.substr(generation_len + 1, name.find('-', generation_len + 1) - generation_len - 1)};
+		return std::string::npos == time.find_first_not_of("0123456789") and not time.empty()
+			and now - std::stoll(time) > githlpr::manifest::candidate_timeout.count();
+	}
+
+	std::mt19937_64& get_rng()
+	{
+		thread_local std::mt19937_64 rng{std::random_device{}()};
+		return rng;
+	}
+
+	/* Decodes the manifest straight from the transfer's pipe; std::nullopt if there is no such object */
+	template<typename F>
+	std::optional<githlpr::manifest::manifest_t> read_object(githlpr::remote::storage_t& storage, const std::string& path, F decode_fn, const int copy)
+	{
+		std::unique_ptr<githlpr::remote::source_t> source{storage.open_read(path)};
+		githlpr::manifest::manifest_t manifest{};
+		try {
+			decoder_t dec{source->fd(), copy};
+			manifest = decode_fn(dec);
+			githlpr::stats::add_downloaded(dec.get_nread());
+		} catch (const std::runtime_error&) {
+			if (source->finish()) {
+				throw; // a failed transfer is reported over a decoding error
+			}
+			return std::nullopt;
+		}
+		if (not source->finish()) {
+			return std::nullopt;
+		}
+		return manifest;
+	}
+
+	/* A generation as downloaded, written next to the copies it replaces once it decoded in full */
+	class copy_t {
+		const std::filesystem::path dir;
+		std::filesystem::path tmp{};
+		githlpr::proc::fd_t fd{};
+	public:
+		explicit copy_t(const std::filesystem::path& dir) : dir(dir)
+		{
+			if (dir.empty()) {
+				return;
+			}
+			std::filesystem::create_directories(dir);
+			tmp = dir / ("tmp-" + std::to_string(::getpid()));
+			fd = githlpr::proc::fd_t{::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)};
+			if (not fd) {
+				githlpr::proc::throw_errno("cannot create " + tmp.string());
+			}
+		}
+		copy_t(const copy_t&) = delete;
+		copy_t& operator=(const copy_t&) = delete;
+
+		~copy_t()
+		{
+			if (not tmp.empty()) {
+				std::error_code err{};
+				std::filesystem::remove(tmp, err);
+			}
+		}
+
+		int get() const
+		{
+			return fd.get();
+		}
+
+		void keep(const std::string& name)
+		{
+			if (tmp.empty()) {
+				return;
+			}
+			fd.close();
+			std::filesystem::rename(tmp, dir / name);
+			tmp.clear();
+			for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(dir)) {
+				const std::string old{entry.path().filename().string()};
+				if (generation_len == old.length() and old < name) {
+					std::error_code err{};
+					std::filesystem::remove(entry.path(), err); // another helper may have removed it first
+				}
+			}
+		}
+	};
+
+	/* Generations never change once committed, so a copy is as good as the remote object */
+	template<typename F>
+	std::optional<githlpr::manifest::manifest_t> read_copy(const std::filesystem::path& file, F decode_fn)
+	{
+		const githlpr::proc::fd_t fd{::open(file.c_str(), O_RDONLY | O_CLOEXEC)};
+		if (not fd) {
+			return std::nullopt;
+		}
+		decoder_t dec{fd.get()};
+		return decode_fn(dec);
+	}
+
+	template<typename F>
+	githlpr::manifest::manifest_t read_remote(githlpr::remote::storage_t& storage, F decode_fn, const std::filesystem::path& copy_dir)
+	{
+		const githlpr::trace::span_t span{"manifest read"};
+		const githlpr::stats::timer_t timer{githlpr::stats::op_t::MANIFEST_READ};
+		for (unsigned attempt{};; attempt++) {
+			const std::uint64_t generation{get_newest(storage.list(std::string(githlpr::manifest::dir)))};
+			const std::string name{get_generation_name(generation)};
+			if (generation and not copy_dir.empty()) {
+				if (std::optional<githlpr::manifest::manifest_t> manifest = read_copy(copy_dir / name, decode_fn)) {
+					LOG_DEBUG("manifest generation " + name + " is unchanged since it was downloaded");
+					manifest->generation = generation;
+					return std::move(*manifest);
+				}
+			}
+			const std::string path{generation ? std::string(githlpr::manifest::dir) + name : std::string(githlpr::manifest::path)};
+			copy_t copy{generation ? copy_dir : std::filesystem::path{}}; // the legacy manifest is replaced in place
+			if (std::optional<githlpr::manifest::manifest_t> manifest = read_object(storage, path, decode_fn, copy.get())) {
+				copy.keep(name);
+				manifest->generation = generation;
+				return std::move(*manifest);
+			} else if (0 == generation) {
+				return {}; // empty remote
+			} else if (attempt == max_read_attempts) {
+				throw std::runtime_error("manifest " + path + " vanished while reading it");
+			}
+			// Pruned since it was listed, so a newer generation exists
+		}
+	}
+
+	githlpr::manifest::manifest_t decode_all(decoder_t& dec)
+	{
+		std::map<std::string, std::string> refs{};
+		githlpr::manifest::manifest_t manifest{decode(dec, [&refs](const std::string_view ref, const std::string_view sha1) {
+			refs.emplace_hint(refs.end(), ref, sha1);
+		})};
+		manifest.refs = std::move(refs);
+		return manifest;
+	}
+}
+
+std::string githlpr::manifest::serialize(const manifest_t& manifest)
+{
+	encoder_t enc{};
+	encode(enc, manifest);
+	return std::move(enc.get_buf());
+}
+
+githlpr::manifest::manifest_t githlpr::manifest::parse(const std::string_view data)
+{
+	decoder_t dec{data};
+	return decode_all(dec);
+}
+
+githlpr::manifest::manifest_t githlpr::manifest::read(remote::storage_t& storage, const std::filesystem::path& copy_dir)
+{
+	return read_remote(storage, decode_all, copy_dir);
+}
+
+githlpr::manifest::manifest_t githlpr::manifest::read(remote::storage_t& storage, const ref_visitor_t& on_ref, const std::filesystem::path& copy_dir)
+{
+	return read_remote(storage, [&on_ref](decoder_t& dec) {
+		return decode(dec, on_ref);
+	}, copy_dir);
+}
+
+namespace
+{
+	void write_object(githlpr::remote::storage_t& storage, const std::string& path, const githlpr::manifest::manifest_t& manifest)
+	{
+		const githlpr::trace::span_t span{"manifest write", path};
+		const githlpr::stats::timer_t timer{githlpr::stats::op_t::MANIFEST_WRITE};
+		std::unique_ptr<githlpr::remote::sink_t> sink{storage.open_write(path)};
+		encoder_t enc{sink->fd()};
+		encode(enc, manifest);
+		enc.flush();
+		sink->commit();
+		githlpr::stats::add_uploaded(enc.get_nflushed());
+	}
+
+	/* When other pushes' candidates were first listed; one listed for candidate_timeout belongs to a push that died */
+	using seen_t = std::map<std::string, std::chrono::steady_clock::time_point>;
+
+	/*
+	 * Two pushes that both list after uploading their candidates cannot both find only their own, so at most one
+	 * moves its candidate into place; rclone has no conditional writes to do this with. A push only moves its
+	 * candidate within half of candidate_timeout, so no other push can have started to ignore it by then.
+	 */
+	bool commit(githlpr::remote::storage_t& storage, githlpr::manifest::manifest_t& manifest, seen_t& seen)
+	{
+		const std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+		const std::string dir{githlpr::manifest::dir};
+		const std::string name{get_generation_name(manifest.generation + 1)};
+		const std::string candidate{name + "-" + std::to_string(get_time()) + "-" + std::to_string(get_rng()())};
+		write_object(storage, dir + candidate, manifest);
+		std::string taken_by{};
+		try {
+			const std::map<std::string, std::uint64_t> listed{storage.list(dir)};
+			const std::chrono::steady_clock::time_point now{std::chrono::steady_clock::now()};
+			for (auto it = listed.lower_bound(name); listed.end() != it and taken_by.empty(); ++it) {
+				const bool is_committed{generation_len == it->first.length()};
+				if (candidate != it->first and (is_committed or now - seen.emplace(it->first, now).first->second < githlpr::manifest::candidate_timeout)) {
+					taken_by = it->first;
+				}
+			}
+			if (taken_by.empty() and now - start > githlpr::manifest::candidate_timeout / 2) {
+				taken_by = "a timeout";
+			}
+		} catch (const std::runtime_error&) {
+			storage.remove(dir + candidate); // would block other pushes until candidate_timeout
+			throw;
+		}
+		if (not taken_by.empty()) {
+			LOG_DEBUG("manifest generation " + name + " is taken by " + taken_by);
+			storage.remove(dir + candidate);
+			return false;
+		}
+		storage.rename(dir + candidate, dir + name);
+		manifest.generation++;
+		return true;
+	}
+}
+
+bool githlpr::manifest::update(remote::storage_t& storage, manifest_t& manifest, const change_t& change)
+{
+	unsigned nbackoffs{};
+	seen_t seen{};
+	for (unsigned attempt{}; attempt < max_commit_attempts; attempt++) {
+		manifest_t next{manifest};
+		if (not change(next)) {
+			return false;
+		} else if (commit(storage, next, seen)) {
+			manifest = std::move(next);
+			return true;
+		}
+		const std::uint64_t lost{manifest.generation + 1};
+		manifest = read(storage);
+		if (manifest.generation < lost) {
+			// Every candidate lost; without a random delay they would collide again
+			const std::chrono::milliseconds max_delay{std::min(max_backoff, min_backoff * (1u << std::min(nbackoffs++, 10u)))};
+			std::this_thread::sleep_for(std::chrono::milliseconds(std::uniform_int_distribution<std::int64_t>{0, max_delay.count()}(get_rng())));
+		}
+	}
+	throw std::runtime_error("remote manifest changed during " + std::to_string(max_commit_attempts) + " attempts to commit");
+}
+
+std::size_t githlpr::manifest::prune(remote::storage_t& storage)
+{
+	const std::map<std::string, std::uint64_t> listed{storage.list(std::string(dir))};
+	const std::uint64_t newest{get_newest(listed)};
+	if (0 == newest) {
+		return 0;
+	}
+	std::size_t nremoved{};
+	const std::int64_t now{get_time()};
+	const std::string oldest_kept{get_generation_name(newest - std::min<std::uint64_t>(newest, kept_generations - 1))};
+	for (const auto& [name, size] : listed) {
+		if ((name < oldest_kept and name.length() == generation_len) or is_stale(name, now)) {
+			LOG_DEBUG("deleting manifest " + name);
+			nremoved += storage.remove(std::string(dir) + name);
+		}
+	}
+	return nremoved + storage.remove(std::string(path)); // superseded by the first generation
+}
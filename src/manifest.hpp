@@ -0,0 +1,71 @@
+#ifndef MANIFEST_HPP
+#define MANIFEST_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "remote.hpp"
+
+namespace githlpr::manifest
+{
+	inline constexpr std::string_view dir{"manifests/"}; // "<generation>", zero-padded to 20 digits, per committed manifest
+	inline constexpr std::string_view path{"manifest"}; // the only manifest before generations; read while there are none
+	inline constexpr std::string_view packs_dir{"packs/"};
+	inline constexpr std::string_view magic{"GRRM"};
+	inline constexpr std::uint8_t version{4}; // version 1 lacks pack sizes, version 2 tree packs, version 3 chunked packs
+	inline constexpr std::size_t kept_generations{8}; // by prune()
+	inline constexpr std::chrono::seconds candidate_timeout{60}; // a push whose candidate is listed this long died
+
+	/* A pack holds every object reachable from its tips that is not reachable from its prerequisites */
+	struct pack_t {
+		std::string name{};
+		std::uint64_t size{}; // bytes; 0 if unknown
+		std::vector<std::string> tips{};
+		std::vector<std::string> prereqs{};
+		std::string tree_pack{}; // the same objects without blobs, for partial clones; empty if there is none
+		std::uint64_t tree_pack_size{};
+		bool chunked{}; // stored as chunks, see chunks.hpp
+		bool tree_pack_chunked{};
+	};
+
+	/* Remote state: refs and the packs holding their objects, oldest pack first */
+	struct manifest_t {
+		std::string head{}; // symref target of HEAD, e.g. "refs/heads/master"
+		std::map<std::string, std::string> refs{}; // ref -> sha1
+		std::vector<pack_t> packs{};
+		std::uint64_t generation{}; // of the object it was read from, not serialized; 0 for a remote without generations
+	};
+
+	/* Called per ref in sorted order while the manifest is decoded */
+	using ref_visitor_t = std::function<void(std::string_view ref, std::string_view sha1)>;
+	/* Applies a change to a copy of the newest manifest; false if there is nothing left to commit */
+	using change_t = std::function<bool(manifest_t& manifest)>;
+
+	extern std::string serialize(const manifest_t& manifest);
+	extern manifest_t parse(std::string_view data);
+	/*
+	 * The newest generation: one listing of dir, then a single read; no manifest is an empty remote. Unless copy_dir
+	 * is empty, the generation read is kept there, and not downloaded again while the listing finds no newer one.
+	 */
+	extern manifest_t read(remote::storage_t& storage, const std::filesystem::path& copy_dir = {});
+	/* As read(), but refs are handed to on_ref instead of being collected; memory does not grow with the number of refs */
+	extern manifest_t read(remote::storage_t& storage, const ref_visitor_t& on_ref, const std::filesystem::path& copy_dir = {});
+	/*
+	 * Commits change applied to manifest as the next generation without locking: the change is uploaded as a
+	 * candidate, and moved to the generation's name only if a listing finds no other candidate or manifest for it.
+	 * A push that loses reads the newest manifest and applies change again, at once if another push won, after a
+	 * random backoff if all candidates lost. A candidate a dead push left behind delays pushes by candidate_timeout.
+	 * manifest ends up as committed; false if change left nothing to commit.
+	 */
+	extern bool update(remote::storage_t& storage, manifest_t& manifest, const change_t& change);
+	/* Removes all but the newest kept_generations manifests, candidates older than candidate_timeout and path; returns the number removed */
+	extern std::size_t prune(remote::storage_t& storage);
+}
+
+#endif /* MANIFEST_HPP */
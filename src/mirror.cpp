@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <array>
+#include <exception>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "chunks.hpp"
+#include "git.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "mirror.hpp"
+#include "packidx.hpp"
+#include "proc.hpp"
+#include "remote.hpp"
+#include "trace.hpp"
+
+namespace
+{
+	/* Values of a git config key in the order git reads them; none if it is unset */
+	std::vector<std::string> get_config(const std::string& key)
+	{
+		githlpr::proc::child_t child{githlpr::proc::spawn({"git", "config", "--get-all", key}, githlpr::proc::PIPE_STDOUT)};
+		std::string output{};
+		std::array<char, 4096> buf{};
+		for (ssize_t nread{}; 0 != (nread = ::read(child.stdout_fd(), buf.data(), buf.size()));) {
+			if (-1 == nread and EINTR != errno) {
+				githlpr::proc::throw_errno("cannot read git config " + key);
+			} else if (nread > 0) {
+				output.append(buf.data(), static_cast<std::size_t>(nread));
+			}
+		}
+		constexpr int git_config_unset{1};
+		if (const int code = child.wait(); git_config_unset == code) {
+			return {};
+		} else if (0 != code) {
+			throw std::runtime_error(child.get_name() + " failed with exit code " + std::to_string(code));
+		}
+		std::vector<std::string> values{};
+		std::istringstream strm{output};
+		for (std::string line{}; std::getline(strm, line);) {
+			values.push_back(line);
+		}
+		return values;
+	}
+
+	githlpr::proc::fd_t open_file(const std::filesystem::path& file, const int flags)
+	{
+		githlpr::proc::fd_t fd{::open(file.c_str(), flags | O_CLOEXEC, 0644)};
+		if (not fd) {
+			githlpr::proc::throw_errno("cannot open " + file.string());
+		}
+		return fd;
+	}
+
+	/* Uploads a pack to a mirror, stored whole or as chunks as the manifest says, from the push's files, the pack cache or else git's remote */
+	void copy_pack(githlpr::remote::storage_t& primary, githlpr::remote::storage_t& mirror, const std::string& name, const bool chunked,
+		       const githlpr::mirror::files_t& files, const std::filesystem::path& tmp_file)
+	{
+		std::filesystem::path file{};
+		githlpr::cache::cache_t cache{githlpr::cache::open()};
+		if (const auto pushed = files.find(name); files.end() != pushed) {
+			file = pushed->second;
+		} else if (const std::optional<std::filesystem::path> cached = cache.lookup(name)) {
+			file = *cached;
+		} else {
+			LOG_DEBUG("downloading " + name + " for mirror " + mirror.get_name());
+			const githlpr::proc::fd_t out{open_file(tmp_file, O_WRONLY | O_CREAT | O_TRUNC)};
+			if (chunked) {
+				githlpr::chunks::stream(primary, githlpr::chunks::read_list(primary, name), out.get());
+			} else {
+				const std::unique_ptr<githlpr::remote::source_t> source{primary.open_read(std::string(githlpr::manifest::packs_dir) + name)};
+				githlpr::proc::fd_copy(source->fd(), out.get());
+				if (not source->finish()) {
+					throw std::runtime_error("pack missing on remote: " + name);
+				}
+			}
+			file = tmp_file;
+		}
+		if (chunked) {
+			const std::uint64_t chunk_size{githlpr::chunks::get_size()};
+			githlpr::chunks::upload_file(mirror, name, file, 0 == chunk_size ? githlpr::chunks::default_size : chunk_size, githlpr::chunks::get_cdc_size());
+		} else {
+			githlpr::remote::upload_file(mirror, std::string(githlpr::manifest::packs_dir) + name, file);
+		}
+		if (file == tmp_file) {
+			std::filesystem::remove(tmp_file);
+		}
+	}
+
+	/* Uploads the packs, tree packs and indexes a mirror does not have yet; chunked packs count as present once their chunk list is */
+	void copy_packs(githlpr::remote::storage_t& primary, githlpr::remote::storage_t& mirror, const std::vector<githlpr::manifest::pack_t>& packs,
+			const githlpr::mirror::files_t& files, const std::filesystem::path& tmp_file)
+	{
+		const std::map<std::string, std::uint64_t> listed{mirror.list(std::string(githlpr::manifest::packs_dir))};
+		for (const githlpr::manifest::pack_t& pack : packs) {
+			std::vector<std::pair<std::string, bool>> names{{pack.name, pack.chunked}};
+			if (not pack.tree_pack.empty() and pack.tree_pack != pack.name) {
+				names.emplace_back(pack.tree_pack, pack.tree_pack_chunked);
+			}
+			for (const auto& [name, chunked] : names) {
+				if (not listed.count(chunked ? githlpr::chunks::get_list_name(name) : name)) {
+					copy_pack(primary, mirror, name, chunked, files, tmp_file);
+				}
+			}
+			// Packs pushed before indexes were uploaded have none
+			const std::string index_name{githlpr::packidx::get_index_name(pack.name)};
+			const std::string index_path{std::string(githlpr::manifest::packs_dir) + index_name};
+			if (listed.count(index_name)) {
+				continue;
+			} else if (const auto pushed = files.find(index_name); files.end() != pushed) {
+				githlpr::remote::upload_file(mirror, index_path, pushed->second);
+			} else if (const std::optional<std::string> index = githlpr::remote::read_object(primary, index_path)) {
+				githlpr::remote::write_object(mirror, index_path, *index);
+			}
+		}
+	}
+}
+
+githlpr::mirror::fanout_t::fanout_t(remote::storage_t& primary, std::vector<std::unique_ptr<remote::storage_t>> mirrors, const std::size_t quorum)
+	: primary(primary), mirrors(std::move(mirrors)), quorum(std::clamp<std::size_t>(quorum, 1, 1 + this->mirrors.size()))
+{
+}
+
+githlpr::mirror::fanout_t::~fanout_t()
+{
+	try {
+		finish();
+	} catch (const std::exception& err) {
+		LOG_WARN(std::string("cannot cache pushed packs: ") + err.what());
+	}
+}
+
+void githlpr::mirror::fanout_t::replicate(const std::size_t i, const std::vector<manifest::pack_t>& packs, std::shared_future<manifest::manifest_t> committed) noexcept
+{
+	remote::storage_t& mirror = *mirrors[i];
+	const trace::span_t span{"mirror", mirror.get_name()};
+	const std::filesystem::path tmp_file{git::get_helper_dir() / "tmp" / ("mirror-" + std::to_string(::getpid()) + "-" + std::to_string(i) + ".pack")};
+	std::string status{"up to date"};
+	bool replicated{};
+	try {
+		copy_packs(primary, mirror, packs, files, tmp_file);
+		std::optional<manifest::manifest_t> target{};
+		try {
+			target = committed.get();
+		} catch (const std::exception&) {
+			status = "left alone, the push failed";
+		}
+		if (target) {
+			// Other pushes may have committed packs in the meantime
+			copy_packs(primary, mirror, target->packs, files, tmp_file);
+			const std::string data{manifest::serialize(*target)};
+			manifest::manifest_t state{manifest::read(mirror)};
+			if (manifest::update(mirror, state, [&target, &data](manifest::manifest_t& latest) {
+				if (manifest::serialize(latest) == data) {
+					return false;
+				}
+				latest.head = target->head;
+				latest.refs = target->refs;
+				latest.packs = target->packs;
+				return true;
+			})) {
+				status = "pushed";
+			}
+			replicated = true;
+		}
+	} catch (const std::exception& err) {
+		status = err.what();
+	}
+	const std::lock_guard lock{mutex};
+	std::cerr << "git-remote-rclone: mirror " << mirror.get_name() << ": " << status << std::endl;
+	nreplicated += replicated;
+	nfinished++;
+	finished.notify_all();
+}
+
+void githlpr::mirror::fanout_t::finish()
+{
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+	if (not files.empty()) {
+		cache::cache_t cache{cache::open()};
+		for (const auto& [name, file] : files) {
+			cache.insert(name, file); // a later clone from this repository needs no download
+		}
+		files.clear();
+	}
+}
+
+void githlpr::mirror::fanout_t::start(std::vector<manifest::pack_t> packs, files_t pushed, std::shared_future<manifest::manifest_t> committed)
+{
+	finish(); // mirrors commit pushes in the order git's remote did
+	files = std::move(pushed);
+	nreplicated = 0;
+	nfinished = 0;
+	std::filesystem::create_directories(git::get_helper_dir() / "tmp");
+	auto shared_packs = std::make_shared<const std::vector<manifest::pack_t>>(std::move(packs));
+	for (std::size_t i{}; i < mirrors.size(); i++) {
+		threads.emplace_back([this, i, shared_packs, committed]() noexcept { replicate(i, *shared_packs, committed); });
+	}
+}
+
+std::size_t githlpr::mirror::fanout_t::wait()
+{
+	std::unique_lock lock{mutex};
+	finished.wait(lock, [this]() { return 1 + nreplicated >= quorum or nfinished == threads.size(); });
+	return 1 + nreplicated;
+}
+
+std::unique_ptr<githlpr::mirror::fanout_t> githlpr::mirror::open(remote::storage_t& storage, const std::string& name)
+{
+	std::vector<std::unique_ptr<remote::storage_t>> mirrors{};
+	for (const std::string& url : get_config("remote." + name + "." + std::string(url_key))) {
+		mirrors.push_back(remote::open_url(url));
+	}
+	std::size_t quorum{1 + mirrors.size()};
+	if (const std::vector<std::string> values{mirrors.empty() ? std::vector<std::string>{} : get_config("remote." + name + "." + std::string(quorum_key))}; not values.empty()) {
+		const std::string& value = values.back();
+		const std::string invalid{"invalid remote." + name + "." + std::string(quorum_key) + ": " + value};
+		if (value.empty() or std::string::npos != value.find_first_not_of("0123456789")) {
+			throw std::runtime_error(invalid);
+		}
+		try {
+			quorum = std::stoul(value);
+		} catch (const std::out_of_range&) {
+			throw std::runtime_error(invalid);
+		}
+	}
+	return std::make_unique<fanout_t>(storage, std::move(mirrors), quorum);
+}
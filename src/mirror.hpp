@@ -0,0 +1,82 @@
+#ifndef MIRROR_HPP
+#define MIRROR_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "manifest.hpp"
+#include "remote.hpp"
+
+/* Remotes a push is replicated to besides the one git pushes to, e.g. a NAS, S3 and an offsite crypt remote */
+namespace githlpr::mirror
+{
+	inline constexpr std::string_view url_key{"rclonemirror"}; // remote.<name>.rcloneMirror, once per mirror: "rclone://<remote>:<path>"
+	inline constexpr std::string_view quorum_key{"rclonequorum"}; // remote.<name>.rcloneQuorum: remotes, git's included, a push must reach before "ok"
+
+	/* Files a push leaves behind for the mirrors by their name below packs/: its pack, the pack's index and its tree pack */
+	using files_t = std::map<std::string, std::filesystem::path>;
+
+	/*
+	 * Replicates every push to the mirrors, one thread per mirror: the packs of the pushed manifest the mirror lacks are
+	 * uploaded from the push's files, the pack cache or else git's remote, then the manifest git's remote committed is
+	 * committed on the mirror. git's remote stays the only one pushes are checked against and fetches read from.
+	 */
+	class fanout_t {
+		remote::storage_t& primary;
+		const std::vector<std::unique_ptr<remote::storage_t>> mirrors;
+		const std::size_t quorum;
+		std::mutex mutex{};
+		std::condition_variable finished{};
+		std::vector<std::thread> threads{};
+		std::size_t nreplicated{}; // mirrors that have the current push
+		std::size_t nfinished{};
+		files_t files{};
+
+		void replicate(std::size_t i, const std::vector<manifest::pack_t>& packs, std::shared_future<manifest::manifest_t> committed) noexcept;
+		/* Waits for every mirror, then moves the files into the pack cache */
+		void finish();
+	public:
+		/* quorum is clamped to [1, 1 + mirrors] */
+		fanout_t(remote::storage_t& primary, std::vector<std::unique_ptr<remote::storage_t>> mirrors, std::size_t quorum);
+		fanout_t(const fanout_t&) = delete;
+		fanout_t& operator=(const fanout_t&) = delete;
+		~fanout_t();
+
+		bool empty() const
+		{
+			return mirrors.empty();
+		}
+
+		std::size_t get_quorum() const
+		{
+			return quorum;
+		}
+
+		std::size_t size() const
+		{
+			return 1 + mirrors.size();
+		}
+
+		/*
+		 * Starts replicating a push of packs, once the previous push is replicated everywhere; the mirrors commit the
+		 * manifest committed yields, and leave theirs alone if it yields none because the push failed
+		 */
+		void start(std::vector<manifest::pack_t> packs, files_t files, std::shared_future<manifest::manifest_t> committed);
+		/* Remotes that have the push, git's included, once quorum of them have it or every mirror finished */
+		std::size_t wait();
+	};
+
+	/* Mirrors of git remote name from its config, with storage as git's remote; no mirrors unless it configures any */
+	extern std::unique_ptr<fanout_t> open(remote::storage_t& storage, const std::string& name);
+}
+
+#endif /* MIRROR_HPP */
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "manifest.hpp"
+#include "packidx.hpp"
+#include "sha1.hpp"
+
+/*
+ * Version 2 layout; integers are big endian:
+ *   "\377tOc" <version:u32> <fanout:u32[256]> <names:sha1[n]> <crc32:u32[n]> <offsets:u32[n]> <large offsets:u64[]> <pack sha1> <idx sha1>
+ * An offset with the high bit set is an index into the large offsets.
+ */
+
+namespace
+{
+	constexpr std::string_view magic{"\377tOc"};
+	constexpr std::size_t fanout_len{256 * 4};
+	constexpr std::uint32_t large_offset_flag{0x80000000};
+
+	[[noreturn]] void throw_corrupt(const std::string& what)
+	{
+		throw std::runtime_error("corrupt pack index: " + what);
+	}
+
+	std::uint64_t read_be(const std::string_view data, const std::size_t pos, const std::size_t len)
+	{
+		if (data.length() < pos + len) {
+			throw_corrupt("unexpected end");
+		}
+		std::uint64_t value{};
+		for (std::size_t i{}; i < len; i++) {
+			value = value << 8 | static_cast<std::uint8_t>(data[pos + i]);
+		}
+		return value;
+	}
+}
+
+githlpr::packidx::index_t githlpr::packidx::index_t::parse(const std::string_view data)
+{
+	if (0 != data.compare(0, magic.length(), magic) or 2 != read_be(data, 4, 4)) {
+		throw_corrupt("not a version 2 index");
+	}
+	const std::size_t n{static_cast<std::size_t>(read_be(data, 8 + fanout_len - 4, 4))};
+	const std::size_t names_pos{8 + fanout_len};
+	const std::size_t offsets_pos{names_pos + n * (sha1::raw_len + 4)};
+	const std::size_t large_pos{offsets_pos + n * 4};
+	if (data.length() < large_pos + 2 * sha1::raw_len) {
+		throw_corrupt("unexpected end");
+	}
+	index_t index{};
+	index.names = data.substr(names_pos, n * sha1::raw_len);
+	index.offsets.reserve(n);
+	index.by_offset.reserve(n);
+	for (std::size_t i{}; i < n; i++) {
+		std::uint64_t offset{read_be(data, offsets_pos + 4 * i, 4)};
+		if (offset & large_offset_flag) {
+			offset = read_be(data, large_pos + 8 * (offset & ~large_offset_flag), 8);
+		}
+		index.offsets.push_back(offset);
+		index.by_offset.emplace_back(offset, static_cast<std::uint32_t>(i));
+	}
+	std::sort(index.by_offset.begin(), index.by_offset.end());
+	return index;
+}
+
+std::optional<std::uint64_t> githlpr::packidx::index_t::find(const std::string_view raw_sha1) const
+{
+	std::size_t lo{}, hi{offsets.size()};
+	while (lo < hi) {
+		const std::size_t mid{lo + (hi - lo) / 2};
+		const int cmp{std::string_view(names).substr(mid * sha1::raw_len, sha1::raw_len).compare(raw_sha1)};
+		if (0 == cmp) {
+			return offsets[mid];
+		} else if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return std::nullopt;
+}
+
+std::string_view githlpr::packidx::index_t::get_name_at(const std::size_t i) const
+{
+	return std::string_view(names).substr(i * sha1::raw_len, sha1::raw_len);
+}
+
+std::string_view githlpr::packidx::index_t::get_name(const std::uint64_t offset) const
+{
+	const auto it = std::lower_bound(by_offset.begin(), by_offset.end(), std::make_pair(offset, std::uint32_t{}));
+	if (by_offset.end() == it or offset != it->first) {
+		throw_corrupt("no object at offset " + std::to_string(offset));
+	}
+	return get_name_at(it->second);
+}
+
+std::uint64_t githlpr::packidx::index_t::get_end(const std::uint64_t offset, const std::uint64_t pack_size) const
+{
+	const auto it = std::upper_bound(by_offset.begin(), by_offset.end(), std::make_pair(offset, std::numeric_limits<std::uint32_t>::max()));
+	return by_offset.end() == it ? pack_size - pack_trailer_len : it->first;
+}
+
+std::string githlpr::packidx::get_index_name(const std::string_view pack_name)
+{
+	constexpr std::string_view pack_ext{".pack"};
+	std::string name{pack_name};
+	if (name.length() >= pack_ext.length() and 0 == name.compare(name.length() - pack_ext.length(), pack_ext.length(), pack_ext)) {
+		name.resize(name.length() - pack_ext.length());
+	}
+	return name.append(".idx");
+}
+
+std::optional<githlpr::packidx::index_t> githlpr::packidx::fetch_index(remote::storage_t& storage, cache::cache_t& cache, const std::string& pack_name)
+{
+	const std::string name{get_index_name(pack_name)};
+	if (const std::optional<std::filesystem::path> cached = cache.lookup(name)) {
+		std::ifstream strm{*cached, std::ios::binary};
+		return index_t::parse(std::string{std::istreambuf_iterator<char>(strm), std::istreambuf_iterator<char>()});
+	}
+	const std::optional<std::string> data{remote::read_object(storage, std::string(manifest::packs_dir) + name)};
+	if (not data) {
+		return std::nullopt;
+	}
+	index_t index{index_t::parse(*data)};
+	if (cache.is_enabled()) {
+		const std::filesystem::path tmp_file{cache.get_tmp_path(name)};
+		std::ofstream{tmp_file, std::ios::binary} << *data;
+		cache.insert(name, tmp_file);
+	}
+	return index;
+}
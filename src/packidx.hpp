@@ -0,0 +1,48 @@
+#ifndef PACKIDX_HPP
+#define PACKIDX_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "cache.hpp"
+#include "remote.hpp"
+
+/* git pack index (.idx, version 2): where each object of a pack starts */
+namespace githlpr::packidx
+{
+	inline constexpr std::uint64_t pack_trailer_len{20};
+
+	class index_t {
+		std::string names{}; // sorted raw sha1s
+		std::vector<std::uint64_t> offsets{}; // in the order of names
+		std::vector<std::pair<std::uint64_t, std::uint32_t>> by_offset{}; // offset -> position in names
+	public:
+		/* Throws on anything but a well-formed version 2 index */
+		static index_t parse(std::string_view data);
+
+		std::size_t size() const
+		{
+			return offsets.size();
+		}
+
+		/* Raw sha1 of the i-th object in name order */
+		std::string_view get_name_at(std::size_t i) const;
+		/* Offset of the object in the pack; std::nullopt if the pack does not have it */
+		std::optional<std::uint64_t> find(std::string_view raw_sha1) const;
+		/* Raw sha1 of the object starting at offset; throws if no object starts there */
+		std::string_view get_name(std::uint64_t offset) const;
+		/* Where the object at offset ends: the next object, or the pack's trailing checksum */
+		std::uint64_t get_end(std::uint64_t offset, std::uint64_t pack_size) const;
+	};
+
+	/* "pack-<hash>.pack" -> "pack-<hash>.idx" */
+	extern std::string get_index_name(std::string_view pack_name);
+	/* Index of a remote pack from the local cache, or downloaded into it; std::nullopt if the remote has none */
+	extern std::optional<index_t> fetch_index(remote::storage_t& storage, cache::cache_t& cache, const std::string& pack_name);
+}
+
+#endif /* PACKIDX_HPP */
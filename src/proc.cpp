@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "log.hpp"
+#include "proc.hpp"
+#include "trace.hpp"
+
+extern char **environ;
+
+namespace
+{
+	constexpr std::size_t copy_chunk{1024 * 1024};
+
+	/* false if fd's reader has gone */
+	bool write_open(const int fd, std::string_view data)
+	{
+		while (not data.empty()) {
+			const ssize_t nwritten = ::write(fd, data.data(), data.size());
+			if (-1 == nwritten) {
+				if (EINTR == errno) {
+					continue;
+				} else if (EPIPE == errno) {
+					return false;
+				}
+				githlpr::proc::throw_errno("cannot write to file descriptor");
+			}
+			data.remove_prefix(static_cast<std::size_t>(nwritten));
+		}
+		return true;
+	}
+
+	std::size_t rw_copy(const int from, int to, const int copy = -1)
+	{
+		std::array<char, 64 * 1024> buf{};
+		std::size_t total{};
+		for (;;) {
+			const ssize_t nread = ::read(from, buf.data(), buf.size());
+			if (-1 == nread) {
+				if (EINTR == errno) {
+					continue;
+				}
+				githlpr::proc::throw_errno("cannot read from file descriptor");
+			} else if (0 == nread) {
+				return total;
+			}
+			const std::string_view data{buf.data(), static_cast<std::size_t>(nread)};
+			if (-1 != to and not write_open(to, data)) {
+				if (-1 == copy) {
+					return total;
+				}
+				to = -1; // copy still gets everything
+			}
+			if (-1 != copy) {
+				githlpr::proc::write_all(copy, data);
+			}
+			total += static_cast<std::size_t>(nread);
+		}
+	}
+}
+
+std::array<githlpr::proc::fd_t, 2> githlpr::proc::create_pipe()
+{
+	std::array<int, 2> fds{};
+	if (-1 == ::pipe2(fds.data(), O_CLOEXEC)) {
+		throw_errno("cannot create pipe");
+	}
+	return {fd_t{fds[0]}, fd_t{fds[1]}};
+}
+
+githlpr::proc::fd_t& githlpr::proc::fd_t::operator=(fd_t&& other) noexcept
+{
+	if (this != &other) {
+		close();
+		id = other.id;
+		other.id = -1;
+	}
+	return *this;
+}
+
+void githlpr::proc::fd_t::close()
+{
+	if (-1 != id) {
+		::close(id);
+		id = -1;
+	}
+}
+
+githlpr::proc::child_t::child_t(child_t&& other) noexcept
+	: pid(other.pid), name(std::move(other.name)), in(std::move(other.in)), out(std::move(other.out)),
+	  trace_start(other.trace_start), trace_detail(std::move(other.trace_detail))
+{
+	other.pid = -1;
+	other.trace_start = -1;
+}
+
+githlpr::proc::child_t& githlpr::proc::child_t::operator=(child_t&& other) noexcept
+{
+	if (this != &other) {
+		(void)wait();
+		pid = other.pid;
+		name = std::move(other.name);
+		in = std::move(other.in);
+		out = std::move(other.out);
+		trace_start = other.trace_start;
+		trace_detail = std::move(other.trace_detail);
+		other.pid = -1;
+		other.trace_start = -1;
+	}
+	return *this;
+}
+
+githlpr::proc::child_t::~child_t()
+{
+	(void)wait(); // never leave zombies behind, even when unwinding
+}
+
+int githlpr::proc::child_t::wait()
+{
+	in.close();
+	out.close();
+	if (-1 == pid) {
+		return 0;
+	}
+	int status{};
+	while (-1 == ::waitpid(pid, &status, 0)) {
+		if (EINTR != errno) {
+			pid = -1;
+			return -1;
+		}
+	}
+	pid = -1;
+	if (-1 != trace_start) {
+		trace::record(name, trace_detail, trace_start, trace::now()); // one span per child process
+		trace_start = -1;
+	}
+	if (WIFEXITED(status)) {
+		return WEXITSTATUS(status);
+	}
+	return 128 + WTERMSIG(status);
+}
+
+void githlpr::proc::child_t::check()
+{
+	if (const int code = wait(); 0 != code) {
+		throw std::runtime_error(name + " failed with exit code " + std::to_string(code));
+	}
+}
+
+void githlpr::proc::child_t::kill()
+{
+	if (-1 != pid) {
+		::kill(pid, SIGKILL);
+	}
+	(void)wait();
+}
+
+bool githlpr::proc::child_t::has_exited() const
+{
+	if (-1 == pid) {
+		return true;
+	}
+	siginfo_t info{};
+	return 0 == ::waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOHANG | WNOWAIT) and 0 != info.si_pid;
+}
+
+githlpr::proc::child_t githlpr::proc::spawn(const std::vector<std::string>& argv, const unsigned pipes, const std::vector<std::string>& env)
+{
+	std::vector<char*> cargv{};
+	for (const std::string& arg : argv) {
+		cargv.push_back(const_cast<char*>(arg.c_str()));
+	}
+	cargv.push_back(nullptr);
+	std::vector<char*> cenv{};
+	if (not env.empty()) {
+		for (char **var = environ; nullptr != *var; var++) {
+			const std::string_view var_str{*var};
+			const std::string_view name{var_str.substr(0, var_str.find('='))};
+			if (std::none_of(env.begin(), env.end(), [&name](const std::string& entry) {
+				return entry.length() > name.length() and '=' == entry[name.length()] and 0 == entry.compare(0, name.length(), name);
+			})) {
+				cenv.push_back(*var);
+			}
+		}
+		for (const std::string& entry : env) {
+			cenv.push_back(const_cast<char*>(entry.c_str()));
+		}
+		cenv.push_back(nullptr);
+	}
+
+	child_t child{};
+	child.name = argv.at(0) + (argv.size() > 1 ? " " + argv[1] : "");
+	std::array<fd_t, 2> in_pipe{}, out_pipe{};
+	posix_spawn_file_actions_t actions{};
+	posix_spawn_file_actions_init(&actions);
+	if (pipes & PIPE_STDIN) {
+		in_pipe = create_pipe();
+		posix_spawn_file_actions_adddup2(&actions, in_pipe[0].get(), STDIN_FILENO);
+	}
+	if (pipes & PIPE_STDOUT) {
+		out_pipe = create_pipe();
+		posix_spawn_file_actions_adddup2(&actions, out_pipe[1].get(), STDOUT_FILENO);
+	}
+	LOG_DEBUG("spawn " + child.name);
+	if (trace::is_enabled()) {
+		child.trace_start = trace::now();
+		for (const std::string& arg : argv) {
+			child.trace_detail.append(child.trace_detail.empty() ? "" : " ").append(arg);
+		}
+	}
+	const int err = ::posix_spawnp(&child.pid, cargv[0], &actions, nullptr, cargv.data(), env.empty() ? environ : cenv.data());
+	posix_spawn_file_actions_destroy(&actions);
+	if (0 != err) {
+		child.pid = -1;
+		throw std::runtime_error("cannot spawn " + argv[0] + ": " + std::strerror(err));
+	}
+	child.in = std::move(in_pipe[1]);
+	child.out = std::move(out_pipe[0]);
+	return child;
+}
+
+std::string githlpr::proc::run(const std::vector<std::string>& argv, const std::string_view input, const std::vector<std::string>& env)
+{
+	child_t child{spawn(argv, PIPE_STDIN | PIPE_STDOUT, env)};
+	std::string output{};
+	std::array<char, 64 * 1024> buf{};
+	std::size_t written{};
+	if (input.empty()) {
+		child.close_stdin();
+	}
+	// Feed stdin and drain stdout at the same time; either pipe filling up would deadlock otherwise
+	while (child.stdout_fd() != -1) {
+		std::array<pollfd, 2> fds{{
+			{child.stdout_fd(), POLLIN, 0},
+			{child.stdin_fd(), POLLOUT, 0}
+		}};
+		if (-1 == ::poll(fds.data(), child.stdin_fd() != -1 ? 2 : 1, -1)) {
+			if (EINTR == errno) {
+				continue;
+			}
+			throw_errno("cannot poll " + child.get_name());
+		}
+		if (child.stdin_fd() != -1 and fds[1].revents) {
+			// POLLOUT only guarantees room for PIPE_BUF bytes; larger writes could block
+			const ssize_t nwritten = ::write(child.stdin_fd(), input.data() + written, std::min<std::size_t>(PIPE_BUF, input.size() - written));
+			if (-1 == nwritten and EINTR != errno and EAGAIN != errno) {
+				child.close_stdin(); // child stopped reading; its exit code tells why
+			} else if (nwritten > 0 and (written += static_cast<std::size_t>(nwritten)) == input.size()) {
+				child.close_stdin();
+			}
+		}
+		if (fds[0].revents) {
+			const ssize_t nread = ::read(child.stdout_fd(), buf.data(), buf.size());
+			if (-1 == nread and EINTR != errno) {
+				throw_errno("cannot read output of " + child.get_name());
+			} else if (0 == nread) {
+				break;
+			} else if (nread > 0) {
+				output.append(buf.data(), static_cast<std::size_t>(nread));
+			}
+		}
+	}
+	child.check();
+	return output;
+}
+
+void githlpr::proc::write_all(const int fd, std::string_view data)
+{
+	while (not data.empty()) {
+		const ssize_t nwritten = ::write(fd, data.data(), data.size());
+		if (-1 == nwritten) {
+			if (EINTR == errno) {
+				continue;
+			}
+			throw_errno("cannot write to file descriptor");
+		}
+		data.remove_prefix(static_cast<std::size_t>(nwritten));
+	}
+}
+
+std::size_t githlpr::proc::fd_copy(const int from, const int to)
+{
+	std::size_t total{};
+	for (;;) {
+		const ssize_t nspliced = ::splice(from, nullptr, to, nullptr, copy_chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (-1 == nspliced) {
+			if (EINTR == errno) {
+				continue;
+			} else if (EINVAL == errno and 0 == total) {
+				return rw_copy(from, to); // neither side is a pipe
+			} else if (EPIPE == errno) {
+				return total;
+			}
+			throw_errno("cannot forward data between file descriptors");
+		} else if (0 == nspliced) {
+			return total;
+		}
+		total += static_cast<std::size_t>(nspliced);
+	}
+}
+
+std::size_t githlpr::proc::fd_tee(const int from, const int to, const int copy)
+{
+	std::size_t total{};
+	for (;;) {
+		// Duplicate what is in the pipe into to, then move the same bytes into copy
+		const ssize_t nteed = ::tee(from, to, copy_chunk, 0);
+		if (-1 == nteed) {
+			if (EINTR == errno) {
+				continue;
+			} else if (EINVAL == errno and 0 == total) {
+				return rw_copy(from, to, copy); // not both pipes
+			} else if (EPIPE == errno) {
+				// to stopped reading (e.g. index-pack is done at the pack trailer); copy still gets all of from
+				return total + fd_copy(from, copy);
+			}
+			throw_errno("cannot duplicate data between file descriptors");
+		} else if (0 == nteed) {
+			return total;
+		}
+		for (std::size_t left{static_cast<std::size_t>(nteed)}; left;) {
+			const ssize_t nspliced = ::splice(from, nullptr, copy, nullptr, left, SPLICE_F_MOVE);
+			if (-1 == nspliced) {
+				if (EINTR == errno) {
+					continue;
+				}
+				throw_errno("cannot forward data between file descriptors");
+			}
+			left -= static_cast<std::size_t>(nspliced);
+		}
+		total += static_cast<std::size_t>(nteed);
+	}
+}
+
+void githlpr::proc::throw_errno(const std::string& msg)
+{
+	throw std::runtime_error(msg + ": " + std::strerror(errno));
+}
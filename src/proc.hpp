@@ -0,0 +1,111 @@
+#ifndef PROC_HPP
+#define PROC_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace githlpr::proc
+{
+	/* Owning, move-only file descriptor */
+	class fd_t {
+		int id{-1};
+	public:
+		fd_t() = default;
+		explicit fd_t(const int id) : id(id) {}
+		fd_t(fd_t&& other) noexcept : id(other.id) { other.id = -1; }
+		fd_t& operator=(fd_t&& other) noexcept;
+		fd_t(const fd_t&) = delete;
+		fd_t& operator=(const fd_t&) = delete;
+		~fd_t() { close(); }
+
+		int get() const
+		{
+			return id;
+		}
+
+		explicit operator bool() const
+		{
+			return -1 != id;
+		}
+
+		void close();
+	};
+
+	enum pipes_t : unsigned {
+		PIPE_NONE   = 0,
+		PIPE_STDIN  = 1 << 0,
+		PIPE_STDOUT = 1 << 1
+	};
+
+	/* Child process; stdin/stdout are pipes if requested, otherwise inherited */
+	class child_t {
+		pid_t pid{-1};
+		std::string name{};
+		fd_t in{};
+		fd_t out{};
+		std::int64_t trace_start{-1}; // spawn time if tracing
+		std::string trace_detail{};
+
+		friend child_t spawn(const std::vector<std::string>&, unsigned, const std::vector<std::string>&);
+	public:
+		child_t() = default;
+		child_t(child_t&& other) noexcept;
+		child_t& operator=(child_t&& other) noexcept;
+		child_t(const child_t&) = delete;
+		child_t& operator=(const child_t&) = delete;
+		~child_t();
+
+		int stdin_fd() const
+		{
+			return in.get();
+		}
+
+		int stdout_fd() const
+		{
+			return out.get();
+		}
+
+		const std::string& get_name() const
+		{
+			return name;
+		}
+
+		void close_stdin()
+		{
+			in.close();
+		}
+
+		/* Closes our pipe ends, reaps the child and returns its exit code (128 + signal if killed) */
+		int wait();
+		/* As wait(), but throws if the child did not exit successfully */
+		void check();
+		/* Abort the child, e.g. so an unfinished upload is not committed */
+		void kill();
+		/* true once the child exited; it is still reaped by wait() */
+		bool has_exited() const;
+	};
+
+	/* Read and write end; neither is inherited by children */
+	extern std::array<fd_t, 2> create_pipe();
+	/* env holds "NAME=value" entries for the child only, replacing those of the same name in our environment */
+	extern child_t spawn(const std::vector<std::string>& argv, unsigned pipes = PIPE_NONE, const std::vector<std::string>& env = {});
+	/* Run to completion feeding input on stdin; returns stdout; throws on non-zero exit */
+	extern std::string run(const std::vector<std::string>& argv, std::string_view input = {}, const std::vector<std::string>& env = {});
+
+	extern void write_all(int fd, std::string_view data);
+	/*
+	 * Copy until EOF of from; uses splice(2) when either side is a pipe. Returns bytes copied.
+	 * Stops early if the reader of to has gone (e.g. git index-pack is done at the pack trailer); its exit code tells why.
+	 */
+	extern std::size_t fd_copy(int from, int to);
+	/* As fd_copy(), but also writes everything to copy; uses tee(2) when from and to are pipes */
+	extern std::size_t fd_tee(int from, int to, int copy);
+	[[noreturn]] extern void throw_errno(const std::string& msg);
+}
+
+#endif /* PROC_HPP */
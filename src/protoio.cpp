@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "protoio.hpp"
+#include "trace.hpp"
+
+namespace
+{
+	[[noreturn]] void throw_errno(const std::string& msg)
+	{
+		throw std::runtime_error(msg + ": " + std::strerror(errno));
+	}
+
+	void writev_all(const int fd, iovec *iov, int iovcnt)
+	{
+		while (iovcnt > 0) {
+			const ssize_t written = ::writev(fd, iov, iovcnt);
+			if (-1 == written) {
+				if (EINTR == errno) {
+					continue;
+				}
+				throw_errno("cannot write protocol reply");
+			}
+			// Skip over fully written vectors and advance into a partially written one
+			std::size_t left{static_cast<std::size_t>(written)};
+			while (iovcnt > 0 and left >= iov->iov_len) {
+				left -= iov->iov_len;
+				iov++;
+				iovcnt--;
+			}
+			if (iovcnt > 0) {
+				iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+				iov->iov_len -= left;
+			}
+		}
+	}
+}
+
+bool githlpr::protoio::fd_reader_t::getline(std::string& line)
+{
+	line.clear();
+	for (;;) {
+		const char *const first = buf.data() + begin;
+		const char *const last = buf.data() + end;
+		if (const char *const newline = std::find(first, last, '\n'); newline != last) {
+			line.append(first, newline);
+			begin += static_cast<std::size_t>(newline - first) + 1;
+			return true;
+		}
+		line.append(first, last);
+		begin = end = 0;
+		const ssize_t nread = ::read(fd, buf.data(), buf.size());
+		if (-1 == nread) {
+			if (EINTR == errno) {
+				continue;
+			}
+			throw_errno("cannot read protocol command");
+		} else if (0 == nread) {
+			return false;
+		}
+		end = static_cast<std::size_t>(nread);
+	}
+}
+
+bool githlpr::protoio::fd_reader_t::has_buffered() const
+{
+	return std::find(buf.data() + begin, buf.data() + end, '\n') != buf.data() + end;
+}
+
+githlpr::protoio::fd_writer_t::~fd_writer_t()
+{
+	try {
+		flush();
+	} catch (const std::runtime_error&) {
+		// peer is gone; nothing left to report to
+	}
+}
+
+void githlpr::protoio::fd_writer_t::write(const std::string_view data)
+{
+	if (buf.size() + data.size() <= buffer_size) {
+		buf.append(data);
+		return;
+	}
+	// Oversized payload: hand it to the kernel together with the buffer instead of copying it
+	std::array<iovec, 2> iov{{
+		{buf.data(), buf.size()},
+		{const_cast<char*>(data.data()), data.size()}
+	}};
+	writev_all(fd, iov.data(), static_cast<int>(iov.size()));
+	buf.clear();
+}
+
+void githlpr::protoio::fd_writer_t::flush()
+{
+	if (buf.empty()) {
+		return;
+	}
+	const trace::span_t span{"reply write"};
+	iovec iov{buf.data(), buf.size()};
+	writev_all(fd, &iov, 1);
+	buf.clear();
+}
+
+bool githlpr::protoio::stream_reader_t::getline(std::string& line)
+{
+	return not std::getline(strm, line).eof();
+}
+
+bool githlpr::protoio::stream_reader_t::has_buffered() const
+{
+	return strm.rdbuf()->in_avail() > 0;
+}
+
+void githlpr::protoio::stream_writer_t::write(const std::string_view data)
+{
+	strm << data;
+}
+
+void githlpr::protoio::stream_writer_t::flush()
+{
+	strm.flush();
+}
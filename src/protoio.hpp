@@ -0,0 +1,71 @@
+#ifndef PROTOIO_HPP
+#define PROTOIO_HPP
+
+#include <array>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+namespace githlpr::protoio
+{
+	inline constexpr std::size_t buffer_size{64 * 1024};
+
+	/* Source of newline terminated protocol lines; a trailing line without newline is discarded */
+	class reader_t {
+	public:
+		virtual ~reader_t() = default;
+		virtual bool getline(std::string& line) = 0;
+		/* true if the next getline() returns without waiting for the peer */
+		virtual bool has_buffered() const = 0;
+	};
+
+	/* Sink of protocol replies; data only reaches the peer on flush() */
+	class writer_t {
+	public:
+		virtual ~writer_t() = default;
+		virtual void write(std::string_view data) = 0;
+		virtual void flush() = 0;
+	};
+
+	class fd_reader_t final : public reader_t {
+		const int fd;
+		std::array<char, buffer_size> buf{};
+		std::size_t begin{};
+		std::size_t end{};
+	public:
+		explicit fd_reader_t(const int fd) : fd(fd) {}
+		bool getline(std::string& line) override;
+		bool has_buffered() const override;
+	};
+
+	/* Replies are collected in a single buffer and written with one writev(2) per flush */
+	class fd_writer_t final : public writer_t {
+		const int fd;
+		std::string buf{};
+	public:
+		explicit fd_writer_t(const int fd) : fd(fd) { buf.reserve(buffer_size); }
+		~fd_writer_t() override;
+		void write(std::string_view data) override;
+		void flush() override;
+	};
+
+	/* Adapters for std::istream/std::ostream, e.g. std::stringstream in tests */
+	class stream_reader_t final : public reader_t {
+		std::istream& strm;
+	public:
+		explicit stream_reader_t(std::istream& strm) : strm(strm) {}
+		bool getline(std::string& line) override;
+		bool has_buffered() const override;
+	};
+
+	class stream_writer_t final : public writer_t {
+		std::ostream& strm;
+	public:
+		explicit stream_writer_t(std::ostream& strm) : strm(strm) {}
+		void write(std::string_view data) override;
+		void flush() override;
+	};
+}
+
+#endif /* PROTOIO_HPP */
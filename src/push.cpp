@@ -0,0 +1,492 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "chunks.hpp"
+#include "git.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "mirror.hpp"
+#include "packidx.hpp"
+#include "proc.hpp"
+#include "push.hpp"
+#include "remote.hpp"
+#include "sha1.hpp"
+#include "stats.hpp"
+#include "tokenizer.hpp"
+#include "trace.hpp"
+
+namespace
+{
+	constexpr std::string_view heads_prefix{"refs/heads/"};
+
+	void add_unique(std::vector<std::string>& names, const std::string& name)
+	{
+		if (names.end() == std::find(names.begin(), names.end(), name)) {
+			names.push_back(name);
+		}
+	}
+
+	std::optional<std::string> get_ref(const githlpr::manifest::manifest_t& manifest, const std::string& ref)
+	{
+		const auto it = manifest.refs.find(ref);
+		return manifest.refs.end() == it ? std::nullopt : std::optional<std::string>{it->second};
+	}
+
+	/* Uploads a pack whole, or as chunks if it is larger than the upload chunk size; returns its size */
+	std::uint64_t upload_pack_file(githlpr::remote::storage_t& storage, const std::filesystem::path& file, const std::string& name, bool& chunked)
+	{
+		const githlpr::trace::span_t span{"pack upload", name};
+		const std::uint64_t chunk_size{githlpr::chunks::get_size()};
+		chunked = 0 != chunk_size and std::filesystem::file_size(file) > chunk_size;
+		if (chunked) {
+			return githlpr::chunks::upload_file(storage, name, file, chunk_size, githlpr::chunks::get_cdc_size());
+		}
+		return githlpr::remote::upload_file(storage, std::string(githlpr::manifest::packs_dir) + name, file);
+	}
+
+	constexpr std::size_t pack_header_size{12}; // "PACK", version, object count
+
+	std::uint32_t get_nobjects(const std::string_view header)
+	{
+		std::uint32_t nobjects{};
+		for (std::size_t i{8}; i < pack_header_size; i++) {
+			nobjects = nobjects << 8 | static_cast<std::uint8_t>(header[i]);
+		}
+		return nobjects;
+	}
+
+	/*
+	 * A pack uploaded as chunks is kept in dir, next to a keep file named by the revs and filter it packs, until its
+	 * upload is done. A retried push of the same revs uploads those bytes again and skips the chunks already on the
+	 * remote; pack-objects would rarely generate the same bytes twice, as it deltifies with several threads.
+	 */
+	std::filesystem::path get_keep_file(const std::filesystem::path& dir, std::vector<std::string> revs, const std::string_view filter)
+	{
+		std::sort(revs.begin(), revs.end());
+		githlpr::sha1::context_t ctx{};
+		ctx.update(filter);
+		for (const std::string& rev : revs) {
+			ctx.update("\n");
+			ctx.update(rev);
+		}
+		const githlpr::sha1::digest_t digest{ctx.finish()};
+		return dir / ("keep-" + githlpr::sha1::to_hex(std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size())));
+	}
+
+	/* The name of the pack keep_file names, if it is still there */
+	std::optional<std::string> get_kept_pack(const std::filesystem::path& keep_file)
+	{
+		std::ifstream strm{keep_file};
+		std::string name{};
+		if (not std::getline(strm, name) or not std::filesystem::exists(keep_file.parent_path() / name)) {
+			return std::nullopt;
+		}
+		LOG_DEBUG("uploading " + name + " kept from an earlier push");
+		return name;
+	}
+
+	void keep_pack(const std::filesystem::path& keep_file, const std::string& name)
+	{
+		if (not (std::ofstream{keep_file} << name << '\n')) {
+			throw std::runtime_error("cannot write " + keep_file.string());
+		}
+	}
+
+	/* A pack git pack-objects wrote to the remote as it generated it */
+	struct streamed_t {
+		std::string hash{}; // empty if it was not generated to the end
+		std::uint64_t size{};
+		std::uint32_t nobjects{};
+		std::string tmp_path{}; // the uploaded pack until it is renamed; empty if nothing of it is on the remote
+	};
+
+	std::string get_tmp_path()
+	{
+		const std::int64_t now{std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()};
+		return std::string(githlpr::manifest::packs_dir) + std::string(githlpr::push::tmp_prefix) + std::to_string(now) + "-"
+			+ std::to_string(std::random_device{}()) + ".pack";
+	}
+
+	/* Reads up to count bytes, fewer only at EOF */
+	std::size_t read_full(const int fd, char *const buf, const std::size_t count)
+	{
+		std::size_t nread{};
+		while (nread < count) {
+			const ssize_t n = ::read(fd, buf + nread, count - nread);
+			if (-1 == n) {
+				if (EINTR == errno) {
+					continue;
+				}
+				githlpr::proc::throw_errno("cannot read pack from git pack-objects");
+			} else if (0 == n) {
+				break;
+			}
+			nread += static_cast<std::size_t>(n);
+		}
+		return nread;
+	}
+
+	/*
+	 * Streams `git pack-objects --stdout` of revs through a fixed buffer into the remote, and into copy unless it is -1,
+	 * hashing it on the way; generation, hashing and upload overlap and nothing is written to disk. Packs without objects
+	 * are not uploaded, nor are packs that outgrow the upload chunk size, which are still streamed into copy. A filtered
+	 * pack with as many objects as the unfiltered one, full_nobjects, left nothing out and is not generated to the end.
+	 */
+	streamed_t stream_pack(githlpr::remote::storage_t& storage, const std::vector<std::string>& revs, const std::string_view filter, const int copy,
+			       const std::uint32_t full_nobjects = 0)
+	{
+		std::string input{};
+		for (const std::string& rev : revs) {
+			input.append(rev).append("\n");
+		}
+		std::vector<std::string> argv{"git", "pack-objects", "--revs", "--delta-base-offset", "-q", "--stdout"};
+		if (not filter.empty()) {
+			argv.push_back("--filter=" + std::string(filter));
+		}
+		const githlpr::trace::span_t span{"pack upload", filter};
+		const githlpr::stats::timer_t timer{githlpr::stats::op_t::PACK_UPLOAD};
+		githlpr::proc::child_t pack{githlpr::proc::spawn(argv, githlpr::proc::PIPE_STDIN | githlpr::proc::PIPE_STDOUT)};
+		githlpr::proc::write_all(pack.stdin_fd(), input); // revs are read completely before the pack is written
+		pack.close_stdin();
+
+		streamed_t streamed{};
+		std::array<char, 64 * 1024> buf{};
+		std::size_t nread{read_full(pack.stdout_fd(), buf.data(), pack_header_size)};
+		if (pack_header_size == nread) {
+			streamed.nobjects = get_nobjects(std::string_view{buf.data(), nread});
+		}
+		if (not filter.empty() and 0 != full_nobjects and full_nobjects == streamed.nobjects) {
+			pack.kill();
+			return streamed;
+		}
+		std::unique_ptr<githlpr::remote::sink_t> sink{};
+		if (0 != streamed.nobjects) {
+			streamed.tmp_path = get_tmp_path();
+			sink = storage.open_write(streamed.tmp_path);
+		}
+
+		const std::uint64_t chunk_size{githlpr::chunks::get_size()};
+		githlpr::sha1::context_t ctx{};
+		std::string trailer{}; // the last bytes read; the pack's checksum once it ends
+		for (; 0 != nread; nread = read_full(pack.stdout_fd(), buf.data(), buf.size())) {
+			const std::string_view data{buf.data(), nread};
+			if (data.size() >= githlpr::sha1::raw_len) {
+				ctx.update(trailer);
+				ctx.update(data.substr(0, data.size() - githlpr::sha1::raw_len));
+				trailer.assign(data.substr(data.size() - githlpr::sha1::raw_len));
+			} else if (trailer.append(data).size() > githlpr::sha1::raw_len) {
+				ctx.update(std::string_view{trailer}.substr(0, trailer.size() - githlpr::sha1::raw_len));
+				trailer.erase(0, trailer.size() - githlpr::sha1::raw_len);
+			}
+			streamed.size += data.size();
+			if (sink and 0 != chunk_size and streamed.size > chunk_size) {
+				sink.reset(); // uncommitted, so the remote keeps nothing of it
+				streamed.tmp_path.clear();
+			}
+			if (sink) {
+				githlpr::proc::write_all(sink->fd(), data);
+			}
+			if (-1 != copy) {
+				githlpr::proc::write_all(copy, data);
+			}
+		}
+		pack.check();
+		const githlpr::sha1::digest_t digest{ctx.finish()};
+		if (githlpr::sha1::raw_len != trailer.size() or not std::equal(digest.begin(), digest.end(), trailer.begin(),
+				[](const std::uint8_t a, const char b) { return a == static_cast<std::uint8_t>(b); })) {
+			throw std::runtime_error("git pack-objects wrote a corrupt pack");
+		}
+		streamed.hash = githlpr::sha1::to_hex(trailer);
+		if (sink) {
+			sink->commit();
+			githlpr::stats::add_uploaded(streamed.size);
+		}
+		return streamed;
+	}
+
+	/*
+	 * Streams a pack of revs without blobs for partial clones, or generates it into dir and uploads it as chunks if it
+	 * outgrows the upload chunk size, and sets it in pack. nobjects is the object count of pack, if known. Unless files is
+	 * null, the tree pack is also written into dir and added to files.
+	 */
+	void upload_tree_pack(githlpr::remote::storage_t& storage, const std::filesystem::path& dir, const std::vector<std::string>& revs, githlpr::manifest::pack_t& pack,
+			      const std::uint32_t nobjects = 0, githlpr::mirror::files_t *const files = nullptr)
+	{
+		const std::filesystem::path tmp_file{dir / ("tmp-" + std::to_string(::getpid()) + "-tree.pack")};
+		streamed_t streamed{};
+		{
+			const githlpr::proc::fd_t copy{files ? ::open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1};
+			if (files and not copy) {
+				githlpr::proc::throw_errno("cannot open " + tmp_file.string());
+			}
+			streamed = stream_pack(storage, revs, "blob:none", copy.get(), nobjects);
+		}
+		pack.tree_pack = streamed.hash.empty() ? pack.name : "pack-" + streamed.hash + ".pack";
+		if (files and pack.tree_pack != pack.name) {
+			std::filesystem::rename(tmp_file, dir / pack.tree_pack);
+			files->emplace(pack.tree_pack, dir / pack.tree_pack);
+		} else if (files) {
+			std::filesystem::remove(tmp_file);
+		}
+		if (pack.tree_pack == pack.name) {
+			if (not streamed.tmp_path.empty()) {
+				storage.remove(streamed.tmp_path);
+			}
+			pack.tree_pack_size = pack.size; // there are no blobs to leave out
+			pack.tree_pack_chunked = pack.chunked;
+		} else if (not streamed.tmp_path.empty()) {
+			storage.rename(streamed.tmp_path, std::string(githlpr::manifest::packs_dir) + pack.tree_pack);
+			pack.tree_pack_size = streamed.size;
+			pack.tree_pack_chunked = false;
+		} else {
+			const std::filesystem::path keep_file{get_keep_file(dir, revs, "blob:none")};
+			const std::optional<std::string> kept{get_kept_pack(keep_file)};
+			pack.tree_pack = kept ? *kept : "pack-" + githlpr::git::pack_objects(revs, dir, "blob:none") + ".pack"; // generated again, maybe with other deltas
+			keep_pack(keep_file, pack.tree_pack);
+			pack.tree_pack_size = upload_pack_file(storage, dir / pack.tree_pack, pack.tree_pack, pack.tree_pack_chunked);
+			std::filesystem::remove(keep_file);
+			if (files) {
+				(*files)[pack.tree_pack] = dir / pack.tree_pack;
+			} else {
+				std::filesystem::remove(dir / pack.tree_pack);
+			}
+		}
+	}
+
+	/*
+	 * Builds and uploads a pack of tips ^excludes; std::nullopt if the remote already has every object. Unless files is
+	 * null, the pack, its index and its tree pack are left for mirrors and added to files instead of the pack cache.
+	 */
+	std::optional<githlpr::manifest::pack_t> upload_pack(githlpr::remote::storage_t& storage, const std::vector<std::string>& tips, const std::vector<std::string>& excludes,
+							     githlpr::mirror::files_t *const files)
+	{
+		std::vector<std::string> revs{tips};
+		for (const std::string& exclude : excludes) {
+			revs.push_back("^" + exclude);
+		}
+		// index-pack writes the pack and its index as they stream; both are named by the checksum at the end
+		const std::filesystem::path tmp_dir{githlpr::git::get_helper_dir() / "tmp"};
+		std::filesystem::create_directories(tmp_dir);
+		const std::filesystem::path keep_file{get_keep_file(tmp_dir, revs, {})};
+		const std::optional<std::string> kept{get_kept_pack(keep_file)};
+		streamed_t streamed{};
+		if (kept and std::filesystem::exists(tmp_dir / githlpr::packidx::get_index_name(*kept))) {
+			std::string header(pack_header_size, '\0');
+			std::ifstream{tmp_dir / *kept, std::ios::binary}.read(header.data(), static_cast<std::streamsize>(header.size()));
+			streamed.hash = kept->substr(5, githlpr::git::sha1_hex_len); // "pack-<hash>.pack"
+			streamed.size = std::filesystem::file_size(tmp_dir / *kept);
+			streamed.nobjects = get_nobjects(header);
+		} else {
+			const std::filesystem::path tmp_file{tmp_dir / ("tmp-" + std::to_string(::getpid()) + ".pack")};
+			githlpr::proc::child_t index_pack{githlpr::proc::spawn({"git", "index-pack", "--stdin", tmp_file.string()}, githlpr::proc::PIPE_STDIN | githlpr::proc::PIPE_STDOUT)};
+			streamed = stream_pack(storage, revs, {}, index_pack.stdin_fd());
+			index_pack.close_stdin();
+			// index-pack reports "pack\t<hash>" on stdout; it must not reach git's protocol stream
+			githlpr::proc::fd_copy(index_pack.stdout_fd(), githlpr::proc::fd_t{::open("/dev/null", O_WRONLY | O_CLOEXEC)}.get());
+			index_pack.check();
+			std::filesystem::rename(tmp_file, tmp_dir / ("pack-" + streamed.hash + ".pack"));
+			std::filesystem::rename(githlpr::packidx::get_index_name(tmp_file.string()), tmp_dir / githlpr::packidx::get_index_name("pack-" + streamed.hash + ".pack"));
+		}
+
+		const std::string pack_name{"pack-" + streamed.hash + ".pack"};
+		const std::filesystem::path pack_file{tmp_dir / pack_name};
+		const std::filesystem::path index_file{tmp_dir / githlpr::packidx::get_index_name(pack_name)};
+		std::optional<githlpr::manifest::pack_t> pack{};
+		if (githlpr::git::empty_pack_size < streamed.size) {
+			LOG_DEBUG("uploading " + pack_name + " for " + std::to_string(tips.size()) + " tips");
+			pack = githlpr::manifest::pack_t{pack_name, streamed.size, tips, githlpr::git::boundary(tips, excludes)};
+			if (streamed.tmp_path.empty()) {
+				keep_pack(keep_file, pack_name);
+				pack->size = upload_pack_file(storage, pack_file, pack_name, pack->chunked);
+			} else {
+				storage.rename(streamed.tmp_path, std::string(githlpr::manifest::packs_dir) + pack_name);
+			}
+			githlpr::remote::upload_file(storage, std::string(githlpr::manifest::packs_dir) + index_file.filename().string(), index_file);
+			upload_tree_pack(storage, tmp_dir, revs, *pack, streamed.nobjects, files);
+			std::filesystem::remove(keep_file);
+			if (files) {
+				files->emplace(pack_name, pack_file);
+				files->emplace(index_file.filename().string(), index_file);
+				return pack;
+			}
+			githlpr::cache::open().insert(pack_name, pack_file); // a later clone from this repository needs no download
+		}
+		std::filesystem::remove(pack_file);
+		std::filesystem::remove(index_file);
+		return pack;
+	}
+}
+
+githlpr::push::spec_t githlpr::push::parse_spec(std::string_view push_arg)
+{
+	spec_t spec{};
+	spec.dst = tokenizer::get_push_dst(push_arg);
+	if (not push_arg.empty() and '+' == push_arg.front()) {
+		spec.force = true;
+		push_arg.remove_prefix(1);
+	}
+	spec.src = push_arg.substr(0, push_arg.find(':'));
+	return spec;
+}
+
+void githlpr::push::upload_pack_files(remote::storage_t& storage, const std::filesystem::path& dir, const std::string& hash, manifest::pack_t& pack,
+				       const std::vector<std::string>& env)
+{
+	pack.name = "pack-" + hash + ".pack";
+	pack.size = upload_pack_file(storage, dir / pack.name, pack.name, pack.chunked);
+	// Lazy fetches find single objects in the pack through its index
+	const std::string index_name{packidx::get_index_name(pack.name)};
+	remote::upload_file(storage, std::string(manifest::packs_dir) + index_name, dir / index_name);
+
+	// Packed by type: the commits the pack builds upon are not in the repository to exclude them by
+	if (const std::string tree_hash{git::pack_all_objects(dir, "blob:none", env)}; tree_hash.empty()) {
+		pack.tree_pack = pack.name; // there are no blobs to leave out
+		pack.tree_pack_size = pack.size;
+		pack.tree_pack_chunked = pack.chunked;
+	} else {
+		pack.tree_pack = "pack-" + tree_hash + ".pack";
+		pack.tree_pack_size = upload_pack_file(storage, dir / pack.tree_pack, pack.tree_pack, pack.tree_pack_chunked);
+	}
+}
+
+std::vector<githlpr::push::result_t> githlpr::push::push_batch(remote::storage_t& storage, const std::vector<spec_t>& specs, manifest::manifest_t& manifest,
+							       mirror::fanout_t *const fanout)
+{
+	// Resolve every src and check which remote tips exist locally with one git invocation
+	std::vector<std::string> revs{};
+	for (const spec_t& spec : specs) {
+		if (not spec.src.empty()) {
+			revs.push_back(spec.src);
+		}
+	}
+	const std::size_t nsrcs{revs.size()};
+	for (const auto& ref : manifest.refs) {
+		revs.push_back(ref.second);
+	}
+	const std::vector<std::optional<std::string>> names{git::resolve(revs)};
+
+	// Objects reachable from remote refs we have locally are on the remote already
+	std::vector<std::string> excludes{};
+	for (std::size_t i{nsrcs}; i < names.size(); i++) {
+		if (names[i]) {
+			add_unique(excludes, *names[i]);
+		}
+	}
+
+	std::vector<result_t> results{};
+	std::vector<std::optional<std::string>> new_sha1s{};
+	std::vector<std::string> tips{};
+	for (std::size_t i{}, src_i{}; i < specs.size(); i++) {
+		const spec_t& spec = specs[i];
+		results.push_back({spec.dst, {}});
+		new_sha1s.emplace_back(std::nullopt);
+		if (spec.src.empty()) {
+			continue; // delete
+		}
+		const std::optional<std::string>& name = names[src_i++];
+		const auto old = manifest.refs.find(spec.dst);
+		if (not name) {
+			results[i].error = "src refspec " + spec.src + " does not match any";
+		} else if (manifest.refs.end() != old and old->second != *name and not spec.force) {
+			if (excludes.end() == std::find(excludes.begin(), excludes.end(), old->second)) {
+				results[i].error = "fetch first";
+			} else if (not git::is_ancestor(old->second, *name)) {
+				results[i].error = "non-fast-forward";
+			}
+		}
+		if (results[i].error.empty()) {
+			new_sha1s[i] = name;
+			add_unique(tips, *name);
+		}
+	}
+
+	try {
+		const bool mirrored{fanout and not fanout->empty()};
+		mirror::files_t files{};
+		std::optional<manifest::pack_t> pack{};
+		if (not tips.empty()) {
+			pack = upload_pack(storage, tips, excludes, mirrored ? &files : nullptr);
+		}
+		// Mirrors upload the pack while the manifest is committed here; they commit it once it is
+		std::promise<manifest::manifest_t> committed{};
+		if (mirrored) {
+			std::vector<manifest::pack_t> packs{manifest.packs};
+			if (pack) {
+				packs.push_back(*pack);
+			}
+			fanout->start(std::move(packs), std::move(files), committed.get_future().share());
+		}
+		const manifest::manifest_t base{manifest};
+		manifest::update(storage, manifest, [&](manifest::manifest_t& updated) {
+			// Other pushes may have committed since the remote refs were listed; only refs they did not touch are rebased
+			bool changed{};
+			for (std::size_t i{}; i < specs.size(); i++) {
+				if (not results[i].error.empty()) {
+					continue;
+				}
+				const std::optional<std::string> now{get_ref(updated, specs[i].dst)};
+				if (new_sha1s[i] and not specs[i].force and now != get_ref(base, specs[i].dst) and now != new_sha1s[i]) {
+					results[i].error = "fetch first";
+				} else if (new_sha1s[i]) {
+					updated.refs[specs[i].dst] = *new_sha1s[i];
+					if (updated.head.empty() and 0 == specs[i].dst.compare(0, heads_prefix.length(), heads_prefix)) {
+						updated.head = specs[i].dst; // first branch on the remote becomes its default branch
+					}
+					changed = true;
+				} else {
+					updated.refs.erase(specs[i].dst);
+					changed = true;
+				}
+			}
+			if (not changed) {
+				return false;
+			} else if (pack) {
+				updated.packs.push_back(*pack);
+			}
+			if (not updated.head.empty() and not updated.refs.count(updated.head)) {
+				// Default branch was deleted: fall back to any remaining branch so HEAD never dangles
+				const auto branch = updated.refs.lower_bound(std::string(heads_prefix));
+				const bool is_branch{updated.refs.end() != branch and 0 == branch->first.compare(0, heads_prefix.length(), heads_prefix)};
+				updated.head = is_branch ? branch->first : std::string{};
+			}
+			return true;
+		});
+		committed.set_value(manifest);
+		if (mirrored) {
+			if (const std::size_t nremotes{fanout->wait()}; nremotes < fanout->get_quorum()) {
+				for (result_t& result : results) {
+					if (result.error.empty()) {
+						result.error = "pushed to " + std::to_string(nremotes) + " of " + std::to_string(fanout->size()) + " remotes, quorum is "
+							+ std::to_string(fanout->get_quorum());
+					}
+				}
+			}
+		}
+	} catch (const std::runtime_error& err) {
+		// Nothing of the batch is visible on the remote unless the manifest was committed
+		for (result_t& result : results) {
+			if (result.error.empty()) {
+				result.error = err.what();
+			}
+		}
+	}
+	return results;
+}
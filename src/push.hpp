@@ -0,0 +1,48 @@
+#ifndef PUSH_HPP
+#define PUSH_HPP
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "manifest.hpp"
+#include "mirror.hpp"
+#include "remote.hpp"
+
+namespace githlpr::push
+{
+	inline constexpr std::string_view tmp_prefix{"tmp-"}; // "packs/tmp-<unix time>-<nonce>.pack": a pack uploaded before its name was known
+
+	/* "push [+]<src>:<dst>"; an empty src deletes dst */
+	struct spec_t {
+		std::string src{};
+		std::string dst{};
+		bool force{};
+	};
+
+	/* Outcome for one dst; an empty error means "ok <dst>" */
+	struct result_t {
+		std::string dst{};
+		std::string error{};
+	};
+
+	extern spec_t parse_spec(std::string_view push_arg);
+	/*
+	 * Uploads <dir>/pack-<hash>.pack, which holds every object of the repository in GIT_DIR, and its index, plus a pack
+	 * of its objects without blobs for partial clones, and sets the names and sizes in pack. Packs above the upload
+	 * chunk size are uploaded as chunks. The files are left in dir. git runs with env.
+	 */
+	extern void upload_pack_files(remote::storage_t& storage, const std::filesystem::path& dir, const std::string& hash, manifest::pack_t& pack,
+				      const std::vector<std::string>& env = {});
+	/*
+	 * Pushes a whole batch as one transaction: one pack of the objects missing on the remote, uploaded while git
+	 * generates it, then all ref updates at once. manifest is the remote state as listed; it is updated on success.
+	 * Ref updates are rebased onto manifests other pushes committed since, except those to refs another push moved
+	 * ("fetch first"). The pack is built once for fanout's mirrors too; ref updates are only ok once its quorum has them.
+	 */
+	extern std::vector<result_t> push_batch(remote::storage_t& storage, const std::vector<spec_t>& specs, manifest::manifest_t& manifest,
+						mirror::fanout_t* fanout = nullptr);
+}
+
+#endif /* PUSH_HPP */
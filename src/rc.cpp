@@ -0,0 +1,757 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.hpp"
+#include "proc.hpp"
+#include "rc.hpp"
+#include "remote.hpp"
+#include "stats.hpp"
+
+namespace
+{
+	constexpr std::size_t io_buffer_size{64 * 1024};
+	constexpr std::size_t max_head_size{64 * 1024};
+	constexpr std::chrono::seconds start_timeout{10};
+	constexpr std::chrono::milliseconds start_poll_interval{20};
+	constexpr std::string_view hex_digits{"0123456789abcdef"};
+
+	githlpr::proc::fd_t connect_socket(const std::string& path)
+	{
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		if (path.length() >= sizeof(addr.sun_path)) {
+			throw std::runtime_error("rclone rcd socket path is too long: " + path);
+		}
+		std::copy(path.begin(), path.end(), addr.sun_path);
+		githlpr::proc::fd_t fd{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+		if (not fd) {
+			githlpr::proc::throw_errno("cannot create socket");
+		} else if (-1 == ::connect(fd.get(), reinterpret_cast<const sockaddr*>(&addr), sizeof(addr))) {
+			githlpr::proc::throw_errno("cannot connect to rclone rcd at " + path);
+		}
+		return fd;
+	}
+
+	/* false if fd's reader has gone */
+	bool write_open(const int fd, std::string_view data)
+	{
+		while (not data.empty()) {
+			const ssize_t nwritten = ::write(fd, data.data(), data.size());
+			if (-1 == nwritten) {
+				if (EINTR == errno) {
+					continue;
+				} else if (EPIPE == errno) {
+					return false;
+				}
+				githlpr::proc::throw_errno("cannot write to file descriptor");
+			}
+			data.remove_prefix(static_cast<std::size_t>(nwritten));
+		}
+		return true;
+	}
+
+	/* Just enough JSON for rc replies */
+	class json_reader_t {
+		const std::string_view json;
+		std::size_t pos{};
+
+		[[noreturn]] void fail() const
+		{
+			throw std::runtime_error("unexpected rclone rc reply: " + std::string(json.substr(0, 200)));
+		}
+
+		char peek()
+		{
+			while (pos < json.length() and std::string_view(" \t\r\n").find(json[pos]) != std::string_view::npos) {
+				pos++;
+			}
+			return pos < json.length() ? json[pos] : '\0';
+		}
+
+		void literal(const std::string_view word)
+		{
+			if (0 != json.compare(pos, word.length(), word)) {
+				fail();
+			}
+			pos += word.length();
+		}
+
+		unsigned hex4()
+		{
+			unsigned value{};
+			for (int i{}; i < 4; i++, pos++) {
+				const std::size_t digit{pos < json.length() ? hex_digits.find(static_cast<char>(std::tolower(static_cast<unsigned char>(json[pos])))) : std::string_view::npos};
+				if (std::string_view::npos == digit) {
+					fail();
+				}
+				value = value << 4 | static_cast<unsigned>(digit);
+			}
+			return value;
+		}
+
+		void utf8(std::string& out, const unsigned code)
+		{
+			if (code < 0x80) {
+				out.push_back(static_cast<char>(code));
+			} else if (code < 0x800) {
+				out.push_back(static_cast<char>(0xc0 | code >> 6));
+				out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+			} else if (code < 0x10000) {
+				out.push_back(static_cast<char>(0xe0 | code >> 12));
+				out.push_back(static_cast<char>(0x80 | (code >> 6 & 0x3f)));
+				out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+			} else {
+				out.push_back(static_cast<char>(0xf0 | code >> 18));
+				out.push_back(static_cast<char>(0x80 | (code >> 12 & 0x3f)));
+				out.push_back(static_cast<char>(0x80 | (code >> 6 & 0x3f)));
+				out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+			}
+		}
+	public:
+		explicit json_reader_t(const std::string_view json) : json(json) {}
+
+		bool consume(const char c)
+		{
+			if (c != peek()) {
+				return false;
+			}
+			pos++;
+			return true;
+		}
+
+		void expect(const char c)
+		{
+			if (not consume(c)) {
+				fail();
+			}
+		}
+
+		std::string string()
+		{
+			expect('"');
+			std::string out{};
+			for (;;) {
+				if (pos >= json.length()) {
+					fail();
+				}
+				const char c{json[pos++]};
+				if ('"' == c) {
+					return out;
+				} else if ('\\' != c) {
+					out.push_back(c);
+					continue;
+				} else if (pos >= json.length()) {
+					fail();
+				}
+				switch (const char esc{json[pos++]}; esc) {
+					case 'b': out.push_back('\b'); break;
+					case 'f': out.push_back('\f'); break;
+					case 'n': out.push_back('\n'); break;
+					case 'r': out.push_back('\r'); break;
+					case 't': out.push_back('\t'); break;
+					case 'u': {
+						unsigned code{hex4()};
+						if (code >= 0xd800 and code < 0xdc00 and 0 == json.compare(pos, 2, "\\u")) {
+							pos += 2;
+							code = 0x10000 + ((code - 0xd800) << 10) + (hex4() - 0xdc00); // surrogate pair
+						}
+						utf8(out, code);
+						break;
+					}
+					default: out.push_back(esc); // '"', '\\' and '/'
+				}
+			}
+		}
+
+		std::int64_t integer()
+		{
+			(void)peek();
+			const std::size_t start{pos};
+			while (pos < json.length() and std::string_view("+-.0123456789eE").find(json[pos]) != std::string_view::npos) {
+				pos++;
+			}
+			if (start == pos) {
+				fail();
+			}
+			return static_cast<std::int64_t>(std::strtod(std::string(json.substr(start, pos - start)).c_str(), nullptr));
+		}
+
+		bool boolean()
+		{
+			if ('t' == peek()) {
+				literal("true");
+				return true;
+			}
+			literal("false");
+			return false;
+		}
+
+		/* Calls on_key per member, which must read or skip its value */
+		void object(const std::function<void(const std::string& key)>& on_key)
+		{
+			expect('{');
+			if (consume('}')) {
+				return;
+			}
+			do {
+				const std::string key{string()};
+				expect(':');
+				on_key(key);
+			} while (consume(','));
+			expect('}');
+		}
+
+		void array(const std::function<void()>& on_item)
+		{
+			expect('[');
+			if (consume(']')) {
+				return;
+			}
+			do {
+				on_item();
+			} while (consume(','));
+			expect(']');
+		}
+
+		void skip()
+		{
+			switch (peek()) {
+				case '{': object([this](const std::string&) { skip(); }); break;
+				case '[': array([this]() { skip(); }); break;
+				case '"': (void)string(); break;
+				case 't': case 'f': (void)boolean(); break;
+				case 'n': literal("null"); break;
+				default: (void)integer();
+			}
+		}
+	};
+
+	std::string json_quote(const std::string_view str)
+	{
+		std::string quoted{"\""};
+		for (const char c : str) {
+			if ('"' == c or '\\' == c) {
+				quoted.push_back('\\');
+				quoted.push_back(c);
+			} else if (static_cast<unsigned char>(c) < 0x20) {
+				quoted.append("\\u00").append(1, hex_digits[static_cast<unsigned char>(c) >> 4]).append(1, hex_digits[c & 0xf]);
+			} else {
+				quoted.push_back(c);
+			}
+		}
+		return quoted.append("\"");
+	}
+
+	/* Status line and headers of a reply, then its body; rcd closes the connection after it */
+	class response_t {
+		githlpr::proc::fd_t fd;
+		std::string buf{};
+		std::size_t pos{};
+		int status{};
+		std::map<std::string, std::string> headers{}; // by lowercase name
+
+		bool fill()
+		{
+			if (pos == buf.size()) {
+				buf.clear();
+				pos = 0;
+			}
+			std::array<char, io_buffer_size> chunk{};
+			for (;;) {
+				const ssize_t nread = ::read(fd.get(), chunk.data(), chunk.size());
+				if (-1 == nread and EINTR == errno) {
+					continue;
+				} else if (-1 == nread) {
+					githlpr::proc::throw_errno("cannot read rclone rcd reply");
+				}
+				buf.append(chunk.data(), static_cast<std::size_t>(nread));
+				return nread > 0;
+			}
+		}
+
+		std::string line()
+		{
+			std::size_t end{};
+			while (std::string::npos == (end = buf.find("\r\n", pos))) {
+				if (buf.size() - pos > max_head_size or not fill()) {
+					throw std::runtime_error("truncated rclone rcd reply");
+				}
+			}
+			std::string line{buf.substr(pos, end - pos)};
+			pos = end + 2;
+			return line;
+		}
+
+		void read_exactly(std::string& out, std::uint64_t len)
+		{
+			std::array<char, io_buffer_size> chunk{};
+			while (len) {
+				const std::size_t nread{read_some(chunk.data(), static_cast<std::size_t>(std::min<std::uint64_t>(len, chunk.size())))};
+				if (0 == nread) {
+					throw std::runtime_error("truncated rclone rcd reply");
+				}
+				out.append(chunk.data(), nread);
+				len -= nread;
+			}
+		}
+	public:
+		explicit response_t(githlpr::proc::fd_t fd) : fd(std::move(fd))
+		{
+			const std::string status_line{line()};
+			// "HTTP/1.1 200 OK"
+			const std::size_t sp{status_line.find(' ')};
+			if (0 != status_line.compare(0, 5, "HTTP/") or std::string::npos == sp) {
+				throw std::runtime_error("unexpected rclone rcd reply: " + status_line);
+			}
+			status = std::atoi(status_line.c_str() + sp + 1);
+			for (std::string header{}; not (header = line()).empty();) {
+				const std::size_t colon{header.find(':')};
+				std::string name{header.substr(0, colon)};
+				std::transform(name.begin(), name.end(), name.begin(), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+				const std::size_t value{std::string::npos == colon ? header.size() : header.find_first_not_of(' ', colon + 1)};
+				headers[name] = std::string::npos == value ? std::string{} : header.substr(value);
+			}
+		}
+
+		int get_status() const
+		{
+			return status;
+		}
+
+		std::optional<std::uint64_t> get_length() const
+		{
+			const auto it = headers.find("content-length");
+			return headers.end() == it ? std::nullopt : std::optional<std::uint64_t>{std::stoull(it->second)};
+		}
+
+		/* Up to n bytes of the body, those read along with the head first; 0 at its end */
+		std::size_t read_some(char *const out, const std::size_t n)
+		{
+			if (pos == buf.size() and not fill()) {
+				return 0;
+			}
+			const std::size_t nread{std::min(n, buf.size() - pos)};
+			std::copy_n(buf.data() + pos, nread, out);
+			pos += nread;
+			return nread;
+		}
+
+		std::string read_body()
+		{
+			std::string body{};
+			if (const auto it = headers.find("transfer-encoding"); headers.end() != it and std::string::npos != it->second.find("chunked")) {
+				while (const std::uint64_t len{std::stoull(line(), nullptr, 16)}) {
+					read_exactly(body, len);
+					(void)line();
+				}
+				while (not line().empty()) {} // trailers
+			} else if (const std::optional<std::uint64_t> length{get_length()}) {
+				read_exactly(body, *length);
+			} else {
+				std::array<char, io_buffer_size> chunk{};
+				for (std::size_t nread{}; 0 != (nread = read_some(chunk.data(), chunk.size()));) {
+					body.append(chunk.data(), nread);
+				}
+			}
+			return body;
+		}
+	};
+
+	struct reply_t {
+		int status{};
+		std::string body{};
+	};
+
+	std::string get_error(const reply_t& reply)
+	{
+		std::string error{reply.body};
+		try {
+			json_reader_t json{reply.body};
+			json.object([&json, &error](const std::string& key) {
+				if ("error" == key) {
+					error = json.string();
+				} else {
+					json.skip();
+				}
+			});
+		} catch (const std::runtime_error&) {
+			// not an rc error reply; report it as it is
+		}
+		return error;
+	}
+
+	/* Missing objects and directories are 404s, or errors saying so from rcds that report them as 500s */
+	bool is_not_found(const reply_t& reply)
+	{
+		return 404 == reply.status or (200 != reply.status and std::string::npos != get_error(reply).find("not found"));
+	}
+
+	[[noreturn]] void throw_failed(const std::string& what, const reply_t& reply)
+	{
+		throw std::runtime_error("rclone rc " + what + " failed with status " + std::to_string(reply.status) + ": " + get_error(reply));
+	}
+
+	/* POSTs params, a JSON object, to an rc method */
+	reply_t call(const std::string& socket, const std::string_view method, const std::string& params)
+	{
+		githlpr::proc::fd_t fd{connect_socket(socket)};
+		githlpr::proc::write_all(fd.get(), "POST /" + std::string(method) + " HTTP/1.1\r\nHost: rclone\r\nContent-Type: application/json\r\n"
+					 "Content-Length: " + std::to_string(params.size()) + "\r\nConnection: close\r\n\r\n" + params);
+		response_t response{std::move(fd)};
+		const int status{response.get_status()};
+		return reply_t{status, response.read_body()};
+	}
+
+	/* The body of a GET streams into a pipe, so readers see an fd as with `rclone cat` */
+	class rc_source_t final : public githlpr::remote::source_t {
+		std::unique_ptr<response_t> response; // none if the object does not exist
+		githlpr::proc::fd_t out{};
+		githlpr::proc::fd_t in{}; // written by the pump
+		std::string error{};
+		std::thread pump{};
+
+		void run() noexcept
+		{
+			try {
+				std::array<char, io_buffer_size> buf{};
+				const std::optional<std::uint64_t> length{response->get_length()};
+				std::uint64_t total{};
+				for (std::size_t nread{}; 0 != (nread = response->read_some(buf.data(), buf.size()));) {
+					if (not write_open(in.get(), std::string_view(buf.data(), nread))) {
+						in.close();
+						return; // the reader has all it wanted
+					}
+					total += nread;
+				}
+				if (length and *length != total) {
+					error = "rclone rcd reply ended after " + std::to_string(total) + " of " + std::to_string(*length) + " bytes";
+				}
+			} catch (const std::runtime_error& err) {
+				error = err.what();
+			}
+			in.close();
+		}
+	public:
+		explicit rc_source_t(std::unique_ptr<response_t> response) : response(std::move(response))
+		{
+			std::array<githlpr::proc::fd_t, 2> pipe{githlpr::proc::create_pipe()};
+			out = std::move(pipe[0]);
+			if (this->response) {
+				in = std::move(pipe[1]);
+				pump = std::thread{[this]() noexcept { run(); }};
+			}
+		}
+
+		rc_source_t(const rc_source_t&) = delete;
+		rc_source_t& operator=(const rc_source_t&) = delete;
+
+		~rc_source_t() override
+		{
+			out.close(); // a pump still writing gets EPIPE
+			if (pump.joinable()) {
+				pump.join();
+			}
+		}
+
+		int fd() const override
+		{
+			return out.get();
+		}
+
+		bool finish() override
+		{
+			out.close();
+			if (pump.joinable()) {
+				pump.join();
+			}
+			if (not error.empty()) {
+				throw std::runtime_error(error);
+			}
+			return nullptr != response;
+		}
+	};
+
+	/*
+	 * What is written to the pipe is sent as a chunked multipart upload to operations/uploadfile. An upload that is
+	 * not committed ends without its last chunk, so rcd fails it instead of storing the partial data.
+	 */
+	class rc_sink_t final : public githlpr::remote::sink_t {
+		githlpr::proc::fd_t connection;
+		const std::string what;
+		const std::string epilogue;
+		githlpr::proc::fd_t in{};
+		githlpr::proc::fd_t out{}; // read by the pump
+		std::atomic<bool> committed{};
+		reply_t reply{};
+		std::string error{};
+		std::thread pump{};
+
+		void send_chunk(const std::string_view data)
+		{
+			std::string size{};
+			for (std::size_t n{data.size()}; n; n >>= 4) {
+				size.insert(size.begin(), hex_digits[n & 0xf]);
+			}
+			githlpr::proc::write_all(connection.get(), size + "\r\n");
+			githlpr::proc::write_all(connection.get(), data);
+			githlpr::proc::write_all(connection.get(), "\r\n");
+		}
+
+		void run() noexcept
+		{
+			try {
+				std::array<char, io_buffer_size> buf{};
+				for (;;) {
+					const ssize_t nread = ::read(out.get(), buf.data(), buf.size());
+					if (-1 == nread and EINTR == errno) {
+						continue;
+					} else if (-1 == nread) {
+						githlpr::proc::throw_errno("cannot read upload data");
+					} else if (0 == nread) {
+						break;
+					}
+					send_chunk(std::string_view(buf.data(), static_cast<std::size_t>(nread)));
+				}
+				if (committed) {
+					send_chunk(epilogue);
+					githlpr::proc::write_all(connection.get(), "0\r\n\r\n");
+					response_t response{std::move(connection)};
+					reply.status = response.get_status();
+					reply.body = response.read_body();
+				}
+			} catch (const std::runtime_error& err) {
+				error = err.what();
+			}
+			connection.close();
+			out.close(); // a writer still writing gets EPIPE
+		}
+	public:
+		rc_sink_t(githlpr::proc::fd_t connection, std::string what, std::string epilogue)
+			: connection(std::move(connection)), what(std::move(what)), epilogue(std::move(epilogue))
+		{
+			std::array<githlpr::proc::fd_t, 2> pipe{githlpr::proc::create_pipe()};
+			out = std::move(pipe[0]);
+			in = std::move(pipe[1]);
+			pump = std::thread{[this]() noexcept { run(); }};
+		}
+
+		rc_sink_t(const rc_sink_t&) = delete;
+		rc_sink_t& operator=(const rc_sink_t&) = delete;
+
+		~rc_sink_t() override
+		{
+			in.close();
+			if (pump.joinable()) {
+				pump.join();
+			}
+		}
+
+		int fd() const override
+		{
+			return in.get();
+		}
+
+		void commit() override
+		{
+			committed = true;
+			in.close();
+			pump.join();
+			if (not error.empty()) {
+				throw std::runtime_error(error);
+			} else if (200 != reply.status) {
+				throw_failed(what, reply);
+			}
+		}
+	};
+
+	/* "dir/name" -> {"dir", "name"} */
+	std::pair<std::string, std::string> split_path(const std::string& path)
+	{
+		const std::size_t slash{path.rfind('/')};
+		if (std::string::npos == slash) {
+			return {std::string{}, path};
+		}
+		return {path.substr(0, slash), path.substr(slash + 1)};
+	}
+
+	std::string get_boundary()
+	{
+		std::random_device rnd{};
+		std::string boundary{"git-remote-rclone-"};
+		for (int i{}; i < 32; i++) {
+			boundary.push_back(hex_digits[rnd() & 0xf]);
+		}
+		return boundary;
+	}
+}
+
+std::string githlpr::rc::url_encode(const std::string_view str, const bool in_query)
+{
+	std::string encoded{};
+	for (const char c : str) {
+		const unsigned char u{static_cast<unsigned char>(c)};
+		if (std::isalnum(u) or std::string_view("-._~").find(c) != std::string_view::npos or (not in_query and ('/' == c or ':' == c))) {
+			encoded.push_back(c);
+		} else {
+			encoded.append(1, '%').append(1, static_cast<char>(std::toupper(hex_digits[u >> 4]))).append(1, static_cast<char>(std::toupper(hex_digits[u & 0xf])));
+		}
+	}
+	return encoded;
+}
+
+std::map<std::string, std::uint64_t> githlpr::rc::parse_list(const std::string_view json)
+{
+	std::map<std::string, std::uint64_t> objects{};
+	json_reader_t reader{json};
+	reader.object([&reader, &objects](const std::string& key) {
+		if ("list" != key) {
+			reader.skip();
+			return;
+		}
+		reader.array([&reader, &objects]() {
+			std::string name{};
+			std::int64_t size{};
+			bool is_dir{};
+			reader.object([&](const std::string& field) {
+				if ("Name" == field) {
+					name = reader.string();
+				} else if ("Size" == field) {
+					size = reader.integer();
+				} else if ("IsDir" == field) {
+					is_dir = reader.boolean();
+				} else {
+					reader.skip();
+				}
+			});
+			if (not is_dir) {
+				objects.emplace(name, static_cast<std::uint64_t>(std::max<std::int64_t>(size, 0))); // -1 is an unknown size
+			}
+		});
+	});
+	return objects;
+}
+
+std::optional<githlpr::proc::child_t> githlpr::rc::start(const std::filesystem::path& socket)
+{
+	std::error_code err{};
+	std::filesystem::remove(socket, err); // left behind by an rcd that was killed
+	proc::child_t child{proc::spawn({"rclone", "rcd", "--rc-addr", "unix://" + socket.string(), "--rc-no-auth", "--rc-serve"})};
+	for (const auto deadline = std::chrono::steady_clock::now() + start_timeout; std::chrono::steady_clock::now() < deadline;) {
+		if (child.has_exited()) {
+			LOG_DEBUG("rclone rcd exited with code " + std::to_string(child.wait()));
+			return std::nullopt;
+		}
+		try {
+			(void)connect_socket(socket.string());
+			return child;
+		} catch (const std::runtime_error&) {
+			std::this_thread::sleep_for(start_poll_interval); // not listening yet
+		}
+	}
+	child.kill();
+	return std::nullopt;
+}
+
+std::unique_ptr<githlpr::remote::source_t> githlpr::rc::rc_storage_t::open_read(const std::string& path)
+{
+	stats::count_rclone(stats::rclone_cmd_t::CAT);
+	proc::fd_t fd{connect_socket(socket)};
+	// HTTP/1.0, so the object is never sent chunked
+	proc::write_all(fd.get(), "GET /[" + url_encode(base) + "]/" + url_encode(path) + " HTTP/1.0\r\nHost: rclone\r\n\r\n");
+	std::unique_ptr<response_t> response{std::make_unique<response_t>(std::move(fd))};
+	if (404 == response->get_status()) {
+		response.reset();
+	} else if (200 != response->get_status()) {
+		throw_failed("read of " + path, reply_t{response->get_status(), response->read_body()});
+	}
+	return std::make_unique<rc_source_t>(std::move(response));
+}
+
+std::unique_ptr<githlpr::remote::source_t> githlpr::rc::rc_storage_t::open_read(const std::string& path, const std::uint64_t offset, const std::uint64_t count)
+{
+	stats::count_rclone(stats::rclone_cmd_t::CAT);
+	proc::fd_t fd{connect_socket(socket)};
+	proc::write_all(fd.get(), "GET /[" + url_encode(base) + "]/" + url_encode(path) + " HTTP/1.0\r\nHost: rclone\r\n"
+			 "Range: bytes=" + std::to_string(offset) + "-" + std::to_string(offset + std::max<std::uint64_t>(count, 1) - 1) + "\r\n\r\n");
+	std::unique_ptr<response_t> response{std::make_unique<response_t>(std::move(fd))};
+	if (404 == response->get_status()) {
+		response.reset();
+	} else if (206 != response->get_status() and 200 != response->get_status()) {
+		throw_failed("read of " + path, reply_t{response->get_status(), response->read_body()});
+	} else if (200 == response->get_status() and offset) {
+		throw std::runtime_error("rclone rcd ignored the range read of " + path);
+	}
+	return std::make_unique<rc_source_t>(std::move(response));
+}
+
+std::unique_ptr<githlpr::remote::sink_t> githlpr::rc::rc_storage_t::open_write(const std::string& path)
+{
+	stats::count_rclone(stats::rclone_cmd_t::RCAT);
+	const auto [dir, name] = split_path(path);
+	const std::string boundary{get_boundary()};
+	proc::fd_t fd{connect_socket(socket)};
+	proc::write_all(fd.get(), "POST /operations/uploadfile?fs=" + url_encode(base, true) + "&remote=" + url_encode(dir, true) + " HTTP/1.1\r\nHost: rclone\r\n"
+			 "Content-Type: multipart/form-data; boundary=" + boundary + "\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n");
+	std::unique_ptr<rc_sink_t> sink{std::make_unique<rc_sink_t>(std::move(fd), "upload of " + path, "\r\n--" + boundary + "--\r\n")};
+	// The part's header goes first; rcd names the object after its filename
+	const std::string part{"--" + boundary + "\r\nContent-Disposition: form-data; name=\"file\"; filename=" + json_quote(name) + "\r\n"
+			 "Content-Type: application/octet-stream\r\n\r\n"};
+	proc::write_all(sink->fd(), part);
+	return sink;
+}
+
+void githlpr::rc::rc_storage_t::rename(const std::string& from, const std::string& to)
+{
+	stats::count_rclone(stats::rclone_cmd_t::MOVETO);
+	const reply_t reply{call(socket, "operations/movefile", "{\"srcFs\":" + json_quote(base) + ",\"srcRemote\":" + json_quote(from) +
+							       ",\"dstFs\":" + json_quote(base) + ",\"dstRemote\":" + json_quote(to) + "}")};
+	if (200 != reply.status) {
+		throw_failed("move of " + from, reply);
+	}
+}
+
+bool githlpr::rc::rc_storage_t::remove(const std::string& path)
+{
+	stats::count_rclone(stats::rclone_cmd_t::DELETEFILE);
+	const reply_t reply{call(socket, "operations/deletefile", "{\"fs\":" + json_quote(base) + ",\"remote\":" + json_quote(path) + "}")};
+	if (is_not_found(reply)) {
+		return false;
+	} else if (200 != reply.status) {
+		throw_failed("delete of " + path, reply);
+	}
+	return true;
+}
+
+std::map<std::string, std::uint64_t> githlpr::rc::rc_storage_t::list(const std::string& dir)
+{
+	stats::count_rclone(stats::rclone_cmd_t::LSF);
+	const std::string remote{not dir.empty() and '/' == dir.back() ? dir.substr(0, dir.size() - 1) : dir};
+	const reply_t reply{call(socket, "operations/list", "{\"fs\":" + json_quote(base) + ",\"remote\":" + json_quote(remote) +
+							    ",\"opt\":{\"filesOnly\":true,\"noModTime\":true,\"noMimeType\":true}}")};
+	if (is_not_found(reply)) {
+		return {};
+	} else if (200 != reply.status) {
+		throw_failed("list of " + dir, reply);
+	}
+	return parse_list(reply.body);
+}
@@ -0,0 +1,47 @@
+#ifndef RC_HPP
+#define RC_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "proc.hpp"
+#include "remote.hpp"
+
+/* Remote operations as HTTP requests to a running `rclone rcd`, which keeps its backends and their logins warm */
+namespace githlpr::rc
+{
+	inline constexpr std::string_view socket_env{"GIT_REMOTE_RCLONE_RC_SOCKET"}; // unix socket of an rcd to use instead of running rclone
+
+	/* Percent-encodes all but unreserved characters; '/' and ':' are kept unless in_query */
+	extern std::string url_encode(std::string_view str, bool in_query = false);
+	/* Sizes of the files in an operations/list reply by name */
+	extern std::map<std::string, std::uint64_t> parse_list(std::string_view json);
+	/* Runs `rclone rcd` on a unix socket at socket until it accepts requests; std::nullopt if it exited first */
+	extern std::optional<proc::child_t> start(const std::filesystem::path& socket);
+
+	/* Every operation is one request over socket against "<remote>:<path>"; transfers stream through a pipe like rclone's */
+	class rc_storage_t final : public remote::storage_t {
+		const std::string socket;
+		const std::string base;
+	public:
+		rc_storage_t(std::string socket, std::string base) : socket(std::move(socket)), base(std::move(base)) {}
+		std::unique_ptr<remote::source_t> open_read(const std::string& path) override;
+		std::unique_ptr<remote::source_t> open_read(const std::string& path, std::uint64_t offset, std::uint64_t count) override;
+		std::unique_ptr<remote::sink_t> open_write(const std::string& path) override;
+		void rename(const std::string& from, const std::string& to) override;
+		bool remove(const std::string& path) override;
+		std::map<std::string, std::uint64_t> list(const std::string& dir) override;
+
+		std::string get_name() const override
+		{
+			return base;
+		}
+	};
+}
+
+#endif /* RC_HPP */
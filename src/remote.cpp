@@ -0,0 +1,233 @@
+#include <array>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "proc.hpp"
+#include "rc.hpp"
+#include "remote.hpp"
+#include "stats.hpp"
+
+namespace
+{
+	// rclone exit codes for "directory not found" and "file not found"
+	constexpr int rclone_dir_not_found{3};
+	constexpr int rclone_file_not_found{4};
+
+	class rclone_source_t final : public githlpr::remote::source_t {
+		githlpr::proc::child_t child;
+	public:
+		explicit rclone_source_t(githlpr::proc::child_t child) : child(std::move(child)) {}
+
+		int fd() const override
+		{
+			return child.stdout_fd();
+		}
+
+		bool finish() override
+		{
+			const int code = child.wait();
+			if (rclone_dir_not_found == code or rclone_file_not_found == code) {
+				return false;
+			} else if (0 != code) {
+				throw std::runtime_error(child.get_name() + " failed with exit code " + std::to_string(code));
+			}
+			return true;
+		}
+	};
+
+	class rclone_sink_t final : public githlpr::remote::sink_t {
+		githlpr::proc::child_t child;
+		bool committed{};
+	public:
+		explicit rclone_sink_t(githlpr::proc::child_t child) : child(std::move(child)) {}
+
+		~rclone_sink_t() override
+		{
+			if (not committed) {
+				child.kill(); // closing stdin would make rclone upload the partial data
+			}
+		}
+
+		int fd() const override
+		{
+			return child.stdin_fd();
+		}
+
+		void commit() override
+		{
+			committed = true;
+			child.check();
+		}
+	};
+}
+
+std::string githlpr::remote::rclone_storage_t::get_remote_path(const std::string& path) const
+{
+	if (base.empty() or base.back() == ':' or base.back() == '/') {
+		return base + path;
+	}
+	return base + "/" + path;
+}
+
+std::unique_ptr<githlpr::remote::source_t> githlpr::remote::rclone_storage_t::open_read(const std::string& path)
+{
+	stats::count_rclone(stats::rclone_cmd_t::CAT);
+	return std::make_unique<rclone_source_t>(proc::spawn({"rclone", "cat", get_remote_path(path)}, proc::PIPE_STDOUT));
+}
+
+std::unique_ptr<githlpr::remote::source_t> githlpr::remote::rclone_storage_t::open_read(const std::string& path, const std::uint64_t offset, const std::uint64_t count)
+{
+	stats::count_rclone(stats::rclone_cmd_t::CAT);
+	return std::make_unique<rclone_source_t>(proc::spawn({"rclone", "cat", "--offset", std::to_string(offset), "--count", std::to_string(count), get_remote_path(path)}, proc::PIPE_STDOUT));
+}
+
+std::unique_ptr<githlpr::remote::sink_t> githlpr::remote::rclone_storage_t::open_write(const std::string& path)
+{
+	stats::count_rclone(stats::rclone_cmd_t::RCAT);
+	return std::make_unique<rclone_sink_t>(proc::spawn({"rclone", "rcat", get_remote_path(path)}, proc::PIPE_STDIN));
+}
+
+void githlpr::remote::rclone_storage_t::rename(const std::string& from, const std::string& to)
+{
+	stats::count_rclone(stats::rclone_cmd_t::MOVETO);
+	proc::spawn({"rclone", "moveto", get_remote_path(from), get_remote_path(to)}).check();
+}
+
+bool githlpr::remote::rclone_storage_t::remove(const std::string& path)
+{
+	stats::count_rclone(stats::rclone_cmd_t::DELETEFILE);
+	proc::child_t child{proc::spawn({"rclone", "deletefile", get_remote_path(path)})};
+	const int code = child.wait();
+	if (rclone_dir_not_found == code or rclone_file_not_found == code) {
+		return false;
+	} else if (0 != code) {
+		throw std::runtime_error(child.get_name() + " failed with exit code " + std::to_string(code));
+	}
+	return true;
+}
+
+std::map<std::string, std::uint64_t> githlpr::remote::rclone_storage_t::list(const std::string& dir)
+{
+	stats::count_rclone(stats::rclone_cmd_t::LSF);
+	// One "<size>;<name>" line per object
+	const std::unique_ptr<source_t> source{std::make_unique<rclone_source_t>(proc::spawn({"rclone", "lsf", "--files-only", "--format", "sp", get_remote_path(dir)},
+														proc::PIPE_STDOUT))};
+	std::string output{};
+	std::array<char, 64 * 1024> buf{};
+	for (ssize_t nread{}; 0 != (nread = ::read(source->fd(), buf.data(), buf.size()));) {
+		if (-1 == nread and EINTR != errno) {
+			proc::throw_errno("cannot list remote directory " + dir);
+		} else if (nread > 0) {
+			output.append(buf.data(), static_cast<std::size_t>(nread));
+		}
+	}
+	std::map<std::string, std::uint64_t> objects{};
+	if (not source->finish()) {
+		return objects;
+	}
+	std::istringstream strm{output};
+	for (std::string line{}; std::getline(strm, line);) {
+		const std::size_t sep{line.find(';')};
+		if (std::string::npos == sep) {
+			throw std::runtime_error("unexpected rclone lsf output: " + line);
+		}
+		objects.emplace(line.substr(sep + 1), std::stoull(line.substr(0, sep)));
+	}
+	return objects;
+}
+
+std::unique_ptr<githlpr::remote::storage_t> githlpr::remote::open_url(std::string_view url)
+{
+	if (0 == url.compare(0, url_prefix.length(), url_prefix)) {
+		url.remove_prefix(url_prefix.length());
+	}
+	if (url.empty()) {
+		throw std::runtime_error("missing rclone remote in url");
+	}
+	if (const char *const csocket = std::getenv(std::string(rc::socket_env).c_str()); csocket and '\0' != *csocket) {
+		return std::make_unique<rc::rc_storage_t>(csocket, std::string(url));
+	}
+	return std::make_unique<rclone_storage_t>(std::string(url));
+}
+
+std::optional<std::string> githlpr::remote::read_object(storage_t& storage, const std::string& path)
+{
+	std::unique_ptr<source_t> source{storage.open_read(path)};
+	std::string data{};
+	std::array<char, 64 * 1024> buf{};
+	for (;;) {
+		const ssize_t nread = ::read(source->fd(), buf.data(), buf.size());
+		if (-1 == nread) {
+			if (EINTR == errno) {
+				continue;
+			}
+			proc::throw_errno("cannot read remote object " + path);
+		} else if (0 == nread) {
+			break;
+		}
+		data.append(buf.data(), static_cast<std::size_t>(nread));
+	}
+	if (not source->finish()) {
+		return std::nullopt;
+	}
+	stats::add_downloaded(data.size());
+	return data;
+}
+
+std::string githlpr::remote::read_range(storage_t& storage, const std::string& path, const std::uint64_t offset, const std::uint64_t count)
+{
+	const std::unique_ptr<source_t> source{storage.open_read(path, offset, count)};
+	std::string data{};
+	std::array<char, 64 * 1024> buf{};
+	for (;;) {
+		const ssize_t nread = ::read(source->fd(), buf.data(), buf.size());
+		if (-1 == nread) {
+			if (EINTR == errno) {
+				continue;
+			}
+			proc::throw_errno("cannot read remote object " + path);
+		} else if (0 == nread) {
+			break;
+		}
+		data.append(buf.data(), static_cast<std::size_t>(nread));
+	}
+	if (not source->finish() or count != data.size()) {
+		throw std::runtime_error("remote object " + path + " is shorter than expected");
+	}
+	stats::add_downloaded(data.size());
+	return data;
+}
+
+void githlpr::remote::write_object(storage_t& storage, const std::string& path, const std::string_view data)
+{
+	std::unique_ptr<sink_t> sink{storage.open_write(path)};
+	proc::write_all(sink->fd(), data);
+	sink->commit();
+	stats::add_uploaded(data.size());
+}
+
+std::uint64_t githlpr::remote::upload_file(storage_t& storage, const std::string& path, const std::filesystem::path& file)
+{
+	const proc::fd_t in{::open(file.c_str(), O_RDONLY | O_CLOEXEC)};
+	if (not in) {
+		proc::throw_errno("cannot open " + file.string());
+	}
+	const stats::timer_t timer{stats::op_t::PACK_UPLOAD};
+	std::unique_ptr<sink_t> sink{storage.open_write(path)};
+	const std::uint64_t nbytes{proc::fd_copy(in.get(), sink->fd())};
+	sink->commit();
+	stats::add_uploaded(nbytes);
+	return nbytes;
+}
@@ -0,0 +1,79 @@
+#ifndef REMOTE_HPP
+#define REMOTE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace githlpr::remote
+{
+	inline constexpr std::string_view url_prefix{"rclone://"};
+
+	/* Readable remote object; fd() yields the object's bytes until EOF */
+	class source_t {
+	public:
+		virtual ~source_t() = default;
+		virtual int fd() const = 0;
+		/* Waits for the transfer to end; false if the object does not exist, throws on other failures */
+		virtual bool finish() = 0;
+	};
+
+	/* Writable remote object; bytes written to fd() only become the object on commit() */
+	class sink_t {
+	public:
+		virtual ~sink_t() = default;
+		virtual int fd() const = 0;
+		virtual void commit() = 0;
+	};
+
+	/* Object store the helper keeps its data in; paths are relative to the remote's root */
+	class storage_t {
+	public:
+		virtual ~storage_t() = default;
+		virtual std::unique_ptr<source_t> open_read(const std::string& path) = 0;
+		/* count bytes of the object starting at offset; must be safe to call from several threads */
+		virtual std::unique_ptr<source_t> open_read(const std::string& path, std::uint64_t offset, std::uint64_t count) = 0;
+		virtual std::unique_ptr<sink_t> open_write(const std::string& path) = 0;
+		/* Replaces to with from; readers of to see either the old or the new object */
+		virtual void rename(const std::string& from, const std::string& to) = 0;
+		/* false if the object did not exist */
+		virtual bool remove(const std::string& path) = 0;
+		/* Sizes of the objects directly below dir (ending in '/') by name; empty if dir does not exist */
+		virtual std::map<std::string, std::uint64_t> list(const std::string& dir) = 0;
+		/* Tells remotes apart, e.g. to keep local state per remote */
+		virtual std::string get_name() const = 0;
+	};
+
+	/* Every operation is one rclone invocation against "<remote>:<path>" */
+	class rclone_storage_t final : public storage_t {
+		const std::string base;
+	public:
+		explicit rclone_storage_t(std::string base) : base(std::move(base)) {}
+		std::string get_remote_path(const std::string& path) const;
+		std::unique_ptr<source_t> open_read(const std::string& path) override;
+		std::unique_ptr<source_t> open_read(const std::string& path, std::uint64_t offset, std::uint64_t count) override;
+		std::unique_ptr<sink_t> open_write(const std::string& path) override;
+		void rename(const std::string& from, const std::string& to) override;
+		bool remove(const std::string& path) override;
+		std::map<std::string, std::uint64_t> list(const std::string& dir) override;
+
+		std::string get_name() const override
+		{
+			return base;
+		}
+	};
+
+	/* url: "rclone://<remote>:<path>" as handed to the helper by git; served by the rcd at $GIT_REMOTE_RCLONE_RC_SOCKET if it is set */
+	extern std::unique_ptr<storage_t> open_url(std::string_view url);
+	extern std::optional<std::string> read_object(storage_t& storage, const std::string& path);
+	/* count bytes of path starting at offset; throws unless the remote has all of them */
+	extern std::string read_range(storage_t& storage, const std::string& path, std::uint64_t offset, std::uint64_t count);
+	extern void write_object(storage_t& storage, const std::string& path, std::string_view data);
+	extern std::uint64_t upload_file(storage_t& storage, const std::string& path, const std::filesystem::path& file);
+}
+
+#endif /* REMOTE_HPP */
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <cstring>
+
+#include "sha1.hpp"
+
+namespace
+{
+	constexpr std::string_view hex_digits{"0123456789abcdef"};
+
+	constexpr std::uint32_t rol(const std::uint32_t value, const unsigned bits)
+	{
+		return value << bits | value >> (32 - bits);
+	}
+}
+
+void githlpr::sha1::context_t::transform()
+{
+	// The message schedule is computed as the rounds go, in a ring of the last 16 words
+	std::array<std::uint32_t, 16> w{};
+	for (std::size_t i{}; i < w.size(); i++) {
+		w[i] = static_cast<std::uint32_t>(block[4 * i]) << 24 | static_cast<std::uint32_t>(block[4 * i + 1]) << 16
+			| static_cast<std::uint32_t>(block[4 * i + 2]) << 8 | block[4 * i + 3];
+	}
+	std::uint32_t a{state[0]}, b{state[1]}, c{state[2]}, d{state[3]}, e{state[4]};
+	const auto step = [&](const std::size_t i, const std::uint32_t f, const std::uint32_t k) {
+		if (i >= 16) {
+			w[i & 15] = rol(w[(i - 3) & 15] ^ w[(i - 8) & 15] ^ w[(i - 14) & 15] ^ w[i & 15], 1);
+		}
+		const std::uint32_t tmp{rol(a, 5) + f + e + k + w[i & 15]};
+		e = d;
+		d = c;
+		c = rol(b, 30);
+		b = a;
+		a = tmp;
+	};
+	// One loop per round function, so none of them branches on the round
+	for (std::size_t i{}; i < 20; i++) {
+		step(i, d ^ (b & (c ^ d)), 0x5a827999);
+	}
+	for (std::size_t i{20}; i < 40; i++) {
+		step(i, b ^ c ^ d, 0x6ed9eba1);
+	}
+	for (std::size_t i{40}; i < 60; i++) {
+		step(i, (b & c) | (d & (b | c)), 0x8f1bbcdc);
+	}
+	for (std::size_t i{60}; i < 80; i++) {
+		step(i, b ^ c ^ d, 0xca62c1d6);
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+void githlpr::sha1::context_t::update(std::string_view data)
+{
+	std::size_t used{static_cast<std::size_t>(nbytes % block.size())};
+	nbytes += data.size();
+	while (not data.empty()) {
+		const std::size_t n{std::min(block.size() - used, data.size())};
+		std::memcpy(block.data() + used, data.data(), n);
+		data.remove_prefix(n);
+		if (block.size() == (used += n)) {
+			transform();
+			used = 0;
+		}
+	}
+}
+
+githlpr::sha1::digest_t githlpr::sha1::context_t::finish()
+{
+	const std::uint64_t nbits{nbytes * 8};
+	update(std::string_view("\x80", 1));
+	while (56 != nbytes % block.size()) {
+		update(std::string_view("\0", 1));
+	}
+	std::array<char, 8> len{};
+	for (std::size_t i{}; i < len.size(); i++) {
+		len[i] = static_cast<char>(nbits >> (56 - 8 * i));
+	}
+	update(std::string_view(len.data(), len.size()));
+	digest_t digest{};
+	for (std::size_t i{}; i < digest.size(); i++) {
+		digest[i] = static_cast<std::uint8_t>(state[i / 4] >> (24 - 8 * (i % 4)));
+	}
+	return digest;
+}
+
+std::string githlpr::sha1::to_hex(const std::string_view raw)
+{
+	std::string hex{};
+	for (const char c : raw) {
+		const std::uint8_t b{static_cast<std::uint8_t>(c)};
+		hex.push_back(hex_digits[b >> 4]);
+		hex.push_back(hex_digits[b & 0xf]);
+	}
+	return hex;
+}
+
+std::string githlpr::sha1::from_hex(const std::string_view hex)
+{
+	if (2 * raw_len != hex.length()) {
+		throw std::runtime_error("invalid sha1: " + std::string(hex));
+	}
+	std::string raw(raw_len, '\0');
+	for (std::size_t i{}; i < raw_len; i++) {
+		const std::size_t hi{hex_digits.find(hex[2 * i])}, lo{hex_digits.find(hex[2 * i + 1])};
+		if (std::string_view::npos == hi or std::string_view::npos == lo) {
+			throw std::runtime_error("invalid sha1: " + std::string(hex));
+		}
+		raw[i] = static_cast<char>(hi << 4 | lo);
+	}
+	return raw;
+}
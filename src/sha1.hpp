@@ -0,0 +1,33 @@
+#ifndef SHA1_HPP
+#define SHA1_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace githlpr::sha1
+{
+	inline constexpr std::size_t raw_len{20};
+
+	using digest_t = std::array<std::uint8_t, raw_len>;
+
+	/* Incremental SHA-1, as git uses for object names and pack checksums */
+	class context_t {
+		std::array<std::uint32_t, 5> state{{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0}};
+		std::array<std::uint8_t, 64> block{};
+		std::uint64_t nbytes{};
+
+		void transform();
+	public:
+		void update(std::string_view data);
+		digest_t finish();
+	};
+
+	extern std::string to_hex(std::string_view raw);
+	/* Throws on anything but 40 hex digits */
+	extern std::string from_hex(std::string_view hex);
+}
+
+#endif /* SHA1_HPP */
@@ -0,0 +1,178 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "proc.hpp"
+#include "stats.hpp"
+
+namespace
+{
+	constexpr std::string_view prefix{"git_remote_rclone_"};
+	constexpr std::size_t nops{static_cast<std::size_t>(githlpr::stats::op_t::COUNT)};
+	constexpr std::size_t nrclone_cmds{static_cast<std::size_t>(githlpr::stats::rclone_cmd_t::COUNT)};
+	constexpr std::array<std::string_view, nops> op_names{{"manifest_read", "manifest_write", "pack_upload", "pack_download", "list"}};
+	constexpr std::array<std::string_view, nrclone_cmds> rclone_cmd_names{{"cat", "rcat", "moveto", "deletefile", "lsf"}};
+
+	/* Log-linear (HDR-style) bucket bounds: two per power of two from 1ms to 131s, the same for every run and host */
+	constexpr std::size_t nbuckets{35};
+	constexpr std::size_t buckets_per_octave{2};
+
+	double get_bound(const std::size_t bucket)
+	{
+		return 0.001 * std::exp2(static_cast<double>(bucket) / buckets_per_octave);
+	}
+
+	struct histogram_t {
+		std::array<std::atomic<std::uint64_t>, nbuckets + 1> counts{}; // last one is +Inf
+		std::atomic<std::uint64_t> sum_us{};
+	};
+
+	std::atomic<std::uint64_t> uploaded{};
+	std::atomic<std::uint64_t> downloaded{};
+	std::array<std::atomic<std::uint64_t>, nrclone_cmds> rclone_invocations{};
+	std::array<histogram_t, nops> histograms{};
+	std::string stats_file{};
+
+	std::string format(const double value)
+	{
+		std::array<char, 32> buf{};
+		std::snprintf(buf.data(), buf.size(), "%.15g", value);
+		return buf.data();
+	}
+
+	/* Samples of a previous run as "name{labels}" -> value */
+	std::map<std::string, double> read_samples(const std::string& file)
+	{
+		std::map<std::string, double> samples{};
+		std::ifstream strm{file};
+		for (std::string line{}; std::getline(strm, line);) {
+			const std::size_t sep{line.rfind(' ')};
+			if (line.empty() or '#' == line.front() or std::string::npos == sep) {
+				continue;
+			}
+			samples[line.substr(0, sep)] = std::strtod(line.c_str() + sep + 1, nullptr);
+		}
+		return samples;
+	}
+
+	class writer_t {
+		std::ostringstream strm{};
+		const std::map<std::string, double> prev;
+	public:
+		explicit writer_t(std::map<std::string, double> prev) : prev(std::move(prev)) {}
+
+		void family(const std::string_view name, const std::string_view type, const std::string_view help)
+		{
+			strm << "# TYPE " << prefix << name << ' ' << type << "\n# HELP " << prefix << name << ' ' << help << '\n';
+		}
+
+		void sample(const std::string& name, const double value)
+		{
+			const std::string key{std::string(prefix) + name};
+			const auto prev_value = prev.find(key);
+			strm << key << ' ' << format(value + (prev.end() == prev_value ? 0 : prev_value->second)) << '\n';
+		}
+
+		std::string str()
+		{
+			strm << "# EOF\n";
+			return strm.str();
+		}
+	};
+
+	void write_at_exit()
+	{
+		githlpr::stats::write(stats_file);
+	}
+}
+
+bool githlpr::stats::init()
+{
+	const char *const cfile = std::getenv(std::string(file_env).c_str());
+	if (nullptr == cfile or '\0' == *cfile) {
+		return false;
+	}
+	stats_file = cfile;
+	std::atexit(write_at_exit);
+	return true;
+}
+
+void githlpr::stats::add_uploaded(const std::uint64_t nbytes)
+{
+	uploaded += nbytes;
+}
+
+void githlpr::stats::add_downloaded(const std::uint64_t nbytes)
+{
+	downloaded += nbytes;
+}
+
+void githlpr::stats::count_rclone(const rclone_cmd_t cmd)
+{
+	rclone_invocations[static_cast<std::size_t>(cmd)]++;
+}
+
+void githlpr::stats::observe(const op_t op, const std::chrono::steady_clock::duration duration)
+{
+	histogram_t& histogram = histograms[static_cast<std::size_t>(op)];
+	const double seconds{std::chrono::duration<double>(duration).count()};
+	std::size_t bucket{};
+	while (bucket < nbuckets and seconds > get_bound(bucket)) {
+		bucket++;
+	}
+	histogram.counts[bucket]++;
+	histogram.sum_us += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+}
+
+void githlpr::stats::write(const std::string& file)
+{
+	// Concurrent helper runs add to the same file one after another
+	const proc::fd_t lock{::open((file + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)};
+	if (not lock or -1 == ::flock(lock.get(), LOCK_EX)) {
+		return;
+	}
+	writer_t writer{read_samples(file)};
+	writer.family("uploaded_bytes", "counter", "Bytes written to the remote.");
+	writer.sample("uploaded_bytes_total", static_cast<double>(uploaded.load()));
+	writer.family("downloaded_bytes", "counter", "Bytes read from the remote.");
+	writer.sample("downloaded_bytes_total", static_cast<double>(downloaded.load()));
+	writer.family("rclone_invocations", "counter", "rclone processes started, by subcommand.");
+	for (std::size_t cmd{}; cmd < nrclone_cmds; cmd++) {
+		writer.sample("rclone_invocations_total{command=\"" + std::string(rclone_cmd_names[cmd]) + "\"}", static_cast<double>(rclone_invocations[cmd].load()));
+	}
+	writer.family("operation_duration_seconds", "histogram", "Latency of remote operations.");
+	for (std::size_t op{}; op < nops; op++) {
+		const std::string labels{"operation=\"" + std::string(op_names[op]) + "\""};
+		std::uint64_t count{};
+		for (std::size_t bucket{}; bucket <= nbuckets; bucket++) {
+			count += histograms[op].counts[bucket].load();
+			const std::string le{bucket < nbuckets ? format(get_bound(bucket)) : "+Inf"};
+			writer.sample("operation_duration_seconds_bucket{" + labels + ",le=\"" + le + "\"}", static_cast<double>(count));
+		}
+		writer.sample("operation_duration_seconds_sum{" + labels + "}", static_cast<double>(histograms[op].sum_us.load()) / 1e6);
+		writer.sample("operation_duration_seconds_count{" + labels + "}", static_cast<double>(count));
+	}
+
+	// The textfile collector must never see a partially written file
+	const std::string tmp_file{file + ".tmp"};
+	{
+		std::ofstream strm{tmp_file};
+		strm << writer.str();
+	}
+	std::error_code err{};
+	std::filesystem::rename(tmp_file, file, err);
+}
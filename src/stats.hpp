@@ -0,0 +1,77 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * Counters and latency histograms exported in OpenMetrics text format, enabled by $GIT_REMOTE_RCLONE_STATS=<file>.
+ * At exit the values of this run are added to those already in the file, so the file accumulates over all runs,
+ * e.g. for the node exporter's textfile collector.
+ */
+namespace githlpr::stats
+{
+	inline constexpr std::string_view file_env{"GIT_REMOTE_RCLONE_STATS"};
+
+	enum class op_t : unsigned {
+		MANIFEST_READ,
+		MANIFEST_WRITE,
+		PACK_UPLOAD,
+		PACK_DOWNLOAD,
+		LIST,
+		COUNT
+	};
+
+	enum class rclone_cmd_t : unsigned {
+		CAT,
+		RCAT,
+		MOVETO,
+		DELETEFILE,
+		LSF,
+		COUNT
+	};
+
+	/* Reads $GIT_REMOTE_RCLONE_STATS and arranges for the stats to be written at exit */
+	extern bool init();
+
+	inline bool is_enabled()
+	{
+		static const bool enabled{init()};
+		return enabled;
+	}
+
+	extern void add_uploaded(std::uint64_t nbytes);
+	extern void add_downloaded(std::uint64_t nbytes);
+	extern void count_rclone(rclone_cmd_t cmd);
+	extern void observe(op_t op, std::chrono::steady_clock::duration duration);
+
+	/* Observes the time from construction to destruction as one op */
+	class timer_t {
+		const op_t op;
+		std::chrono::steady_clock::time_point start{};
+	public:
+		explicit timer_t(const op_t op) : op(op)
+		{
+			if (is_enabled()) {
+				start = std::chrono::steady_clock::now();
+			}
+		}
+
+		timer_t(const timer_t&) = delete;
+		timer_t& operator=(const timer_t&) = delete;
+
+		~timer_t()
+		{
+			if (is_enabled()) {
+				observe(op, std::chrono::steady_clock::now() - start);
+			}
+		}
+	};
+
+	/* Adds this run's values to those in file; called at exit, exposed for tests */
+	extern void write(const std::string& file);
+}
+
+#endif /* STATS_HPP */
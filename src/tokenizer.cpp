@@ -0,0 +1,37 @@
+#include <stdexcept>
+#include <string_view>
+
+#include "tokenizer.hpp"
+
+namespace
+{
+	constexpr std::string_view whitespace{" \t\n\v\f\r"};
+}
+
+githlpr::tokenizer::cmd_line_t githlpr::tokenizer::tokenize(const std::string_view line)
+{
+	cmd_line_t cmd_line{};
+	cmd_line.line = line;
+	std::size_t pos{line.find_first_not_of(whitespace)};
+	while (std::string_view::npos != pos and cmd_line.nwords < max_words) {
+		std::size_t end{line.find_first_of(whitespace, pos)};
+		if (cmd_line.nwords + 1 == max_words) {
+			// Last slot takes the remainder of the line so no argument is silently dropped
+			end = line.find_last_not_of(whitespace) + 1;
+		} else if (std::string_view::npos == end) {
+			end = line.length();
+		}
+		cmd_line.words[cmd_line.nwords++] = line.substr(pos, end - pos);
+		pos = line.find_first_not_of(whitespace, end);
+	}
+	return cmd_line;
+}
+
+std::string_view githlpr::tokenizer::get_push_dst(const std::string_view push_arg)
+{
+	const std::size_t colon_pos{push_arg.find(':')};
+	if (std::string_view::npos == colon_pos) {
+		throw std::runtime_error("could not parse dst-ref from push argument");
+	}
+	return push_arg.substr(colon_pos + 1);
+}
@@ -0,0 +1,56 @@
+#ifndef TOKENIZER_HPP
+#define TOKENIZER_HPP
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+namespace githlpr::tokenizer
+{
+	// git never sends more than "<cmd> <arg> <arg>" (e.g. "fetch <sha1> <name>", "option <name> <value>")
+	inline constexpr std::size_t max_words{4};
+
+	/* Non-owning view of a tokenized command line; valid as long as the line buffer it was parsed from */
+	class cmd_line_t {
+		std::string_view line{};
+		std::array<std::string_view, max_words> words{};
+		std::size_t nwords{};
+
+		friend cmd_line_t tokenize(std::string_view);
+	public:
+		std::string_view cmd() const
+		{
+			return words[0];
+		}
+
+		/* n-th argument after the command (0-based); empty if not present */
+		std::string_view arg(const std::size_t n) const
+		{
+			return n + 1 < nwords ? words[n + 1] : std::string_view{};
+		}
+
+		std::size_t nargs() const
+		{
+			return nwords ? nwords - 1 : 0;
+		}
+
+		/* Remainder of the line starting at the n-th argument, including any further whitespace */
+		std::string_view rest(const std::size_t n) const
+		{
+			if (n + 1 >= nwords) {
+				return {};
+			}
+			return line.substr(static_cast<std::size_t>(words[n + 1].data() - line.data()));
+		}
+
+		bool empty() const
+		{
+			return 0 == nwords;
+		}
+	};
+
+	extern cmd_line_t tokenize(std::string_view line);
+	extern std::string_view get_push_dst(std::string_view push_arg);
+}
+
+#endif /* TOKENIZER_HPP */
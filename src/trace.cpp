@@ -0,0 +1,112 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "trace.hpp"
+
+namespace
+{
+	struct event_t {
+		std::string name{};
+		std::string detail{};
+		std::int64_t start{};
+		std::int64_t end{};
+	};
+
+	/* Only its own thread appends to a buffer; buffers are never freed so spans of finished threads survive */
+	struct buffer_t {
+		std::vector<event_t> events{};
+		unsigned tid{};
+		buffer_t* next{};
+	};
+
+	std::atomic<buffer_t*> buffers{};
+	std::atomic<unsigned> next_tid{1};
+	std::string trace_file{};
+
+	buffer_t& get_buffer()
+	{
+		thread_local buffer_t* buffer{};
+		if (nullptr == buffer) {
+			buffer = new buffer_t{};
+			buffer->tid = next_tid++;
+			buffer->next = buffers.load();
+			while (not buffers.compare_exchange_weak(buffer->next, buffer)); // lock-free push onto the list of buffers
+		}
+		return *buffer;
+	}
+
+	void write_json_string(std::ostream& strm, const std::string_view str)
+	{
+		strm << '"';
+		for (const char c : str) {
+			if ('"' == c or '\\' == c) {
+				strm << '\\' << c;
+			} else if (static_cast<unsigned char>(c) < 0x20) {
+				char esc[8]{};
+				std::snprintf(esc, sizeof(esc), "\\u%04x", static_cast<unsigned>(c));
+				strm << esc;
+			} else {
+				strm << c;
+			}
+		}
+		strm << '"';
+	}
+
+	void write_at_exit()
+	{
+		githlpr::trace::write(trace_file);
+	}
+}
+
+bool githlpr::trace::init()
+{
+	const char *const cfile = std::getenv(std::string(file_env).c_str());
+	if (nullptr == cfile or '\0' == *cfile) {
+		return false;
+	}
+	trace_file = cfile;
+	std::atexit(write_at_exit);
+	return true;
+}
+
+std::int64_t githlpr::trace::now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void githlpr::trace::record(const std::string_view name, const std::string_view detail, const std::int64_t start, const std::int64_t end)
+{
+	get_buffer().events.push_back({std::string(name), std::string(detail), start, end});
+}
+
+void githlpr::trace::write(const std::string& file)
+{
+	std::ofstream strm{file};
+	const pid_t pid{::getpid()};
+	strm << "{\"traceEvents\":[";
+	const char* sep{"\n"};
+	for (const buffer_t* buffer{buffers.load()}; buffer; buffer = buffer->next) {
+		for (const event_t& event : buffer->events) {
+			strm << sep << "{\"ph\":\"X\",\"cat\":\"githlpr\",\"name\":";
+			write_json_string(strm, event.name);
+			strm << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid << ",\"ts\":" << event.start << ",\"dur\":" << event.end - event.start;
+			if (not event.detail.empty()) {
+				strm << ",\"args\":{\"detail\":";
+				write_json_string(strm, event.detail);
+				strm << "}";
+			}
+			strm << "}";
+			sep = ",\n";
+		}
+	}
+	strm << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
@@ -0,0 +1,65 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * Chrome trace event profiling (chrome://tracing, ui.perfetto.dev), enabled by $GIT_REMOTE_RCLONE_TRACE=<file>.
+ * Every thread records its spans into a buffer of its own; the file is written when the process exits.
+ */
+namespace githlpr::trace
+{
+	inline constexpr std::string_view file_env{"GIT_REMOTE_RCLONE_TRACE"};
+
+	/* Reads $GIT_REMOTE_RCLONE_TRACE and arranges for the trace to be written at exit */
+	extern bool init();
+
+	inline bool is_enabled()
+	{
+		static const bool enabled{init()};
+		return enabled;
+	}
+
+	/* Microseconds on a monotonic clock */
+	extern std::int64_t now();
+	extern void record(std::string_view name, std::string_view detail, std::int64_t start, std::int64_t end);
+
+	/* Span from construction to destruction; costs nothing beyond the is_enabled() check when tracing is off */
+	class span_t {
+		const char *const name;
+		std::string detail{};
+		std::int64_t start{-1};
+	public:
+		explicit span_t(const char *const name) : name(name)
+		{
+			if (is_enabled()) {
+				start = now();
+			}
+		}
+
+		span_t(const char *const name, const std::string_view detail) : name(name)
+		{
+			if (is_enabled()) {
+				this->detail = detail;
+				start = now();
+			}
+		}
+
+		span_t(const span_t&) = delete;
+		span_t& operator=(const span_t&) = delete;
+
+		~span_t()
+		{
+			if (-1 != start) {
+				record(name, detail, start, now());
+			}
+		}
+	};
+
+	/* Writes the trace of all threads; called at exit, exposed for tests */
+	extern void write(const std::string& file);
+}
+
+#endif /* TRACE_HPP */
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdlib>
+
+#include "chunks.hpp"
+#include "sha1.hpp"
+
+/*
+ * Chunking throughput on one core and how much of a pack survives a change in the middle as unchanged chunks.
+ * Prints one JSON object per scenario.
+ */
+
+namespace
+{
+	using bench_clock = std::chrono::steady_clock;
+
+	constexpr std::size_t data_size{256 * 1024 * 1024};
+	constexpr std::uint64_t avg_size{1024 * 1024};
+	constexpr int nrounds{5};
+
+	std::string get_rnd_data(const std::size_t size)
+	{
+		std::string data(size, '\0');
+		std::uint64_t state{88172645463325252u};
+		for (char& c : data) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			c = static_cast<char>(state);
+		}
+		return data;
+	}
+
+	std::vector<std::string_view> split(const std::string& data, const githlpr::chunks::cdc_t *const cdc, const bool scalar = false)
+	{
+		std::vector<std::string_view> chunks{};
+		for (std::string_view rest{data}; not rest.empty();) {
+			const std::size_t len{not cdc ? std::min<std::size_t>(avg_size, rest.size()) : scalar ? cdc->find_cut_scalar(rest) : cdc->find_cut(rest)};
+			chunks.push_back(rest.substr(0, len));
+			rest.remove_prefix(len);
+		}
+		return chunks;
+	}
+
+	void report(const std::string& scenario, const double bytes, const double seconds, const std::size_t nchunks)
+	{
+		std::cout << "{\"scenario\":\"" << scenario << "\""
+			  << ",\"bytes\":" << bytes
+			  << ",\"seconds\":" << seconds
+			  << ",\"gb_per_sec_per_core\":" << bytes / seconds / 1e9
+			  << ",\"chunks\":" << nchunks
+			  << "}" << std::endl;
+	}
+
+	/* The lane scan, and the byte at a time one it falls back to */
+	void bench_cdc(const std::string& data, const bool scalar)
+	{
+		const githlpr::chunks::cdc_t cdc{avg_size};
+		std::size_t nchunks{};
+		const bench_clock::time_point start = bench_clock::now();
+		for (int round{}; round < nrounds; round++) {
+			nchunks = split(data, &cdc, scalar).size();
+		}
+		report(scalar ? "fastcdc_scalar" : "fastcdc", static_cast<double>(nrounds) * static_cast<double>(data.size()), std::chrono::duration<double>(bench_clock::now() - start).count(), nchunks);
+	}
+
+	/* Every chunk is hashed for its name as well */
+	void bench_sha1(const std::string& data)
+	{
+		const bench_clock::time_point start = bench_clock::now();
+		for (int round{}; round < nrounds; round++) {
+			githlpr::sha1::context_t ctx{};
+			ctx.update(data);
+			(void)ctx.finish();
+		}
+		report("sha1", static_cast<double>(nrounds) * static_cast<double>(data.size()), std::chrono::duration<double>(bench_clock::now() - start).count(), 0);
+	}
+
+	/* Share of the bytes of data with an insertion in the middle that are in chunks of the original data */
+	void bench_dedup(const std::string& data, const bool content_defined)
+	{
+		const githlpr::chunks::cdc_t cdc{avg_size};
+		std::string changed{data};
+		changed.insert(changed.size() / 2, "an object added by a repack");
+		std::set<std::string_view> known{};
+		for (const std::string_view chunk : split(data, content_defined ? &cdc : nullptr)) {
+			known.insert(chunk);
+		}
+		std::size_t reused{};
+		for (const std::string_view chunk : split(changed, content_defined ? &cdc : nullptr)) {
+			reused += known.count(chunk) ? chunk.size() : 0;
+		}
+		std::cout << "{\"scenario\":\"dedup_" << (content_defined ? "fastcdc" : "fixed") << "\""
+			  << ",\"reused_fraction\":" << static_cast<double>(reused) / static_cast<double>(changed.size())
+			  << "}" << std::endl;
+	}
+}
+
+int main()
+{
+	const std::string data{get_rnd_data(data_size)};
+	bench_cdc(data, false);
+	bench_cdc(data, true);
+	bench_sha1(data);
+	bench_dedup(data, false);
+	bench_dedup(data, true);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <csignal>
+#include <cstdlib>
+
+#include "storageutils.hpp"
+#include "testutils.hpp"
+
+#include "githlpr.hpp"
+#include "manifest.hpp"
+#include "protoio.hpp"
+
+/*
+ * Drives githlpr::process_git_cmds() with synthetic command streams against an in-memory remote.
+ * Prints one JSON object per scenario; a command is one protocol line, so for batched push/fetch the
+ * high percentiles are the blank lines that run the batch.
+ */
+
+namespace
+{
+	std::atomic<std::size_t> nallocs{};
+}
+
+void* operator new(const std::size_t size)
+{
+	nallocs.fetch_add(1, std::memory_order_relaxed);
+	if (void *const ptr = std::malloc(size ? size : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc{};
+}
+
+void operator delete(void *const ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *const ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+namespace
+{
+	using bench_clock = std::chrono::steady_clock;
+
+	constexpr std::size_t ncaps{200000};
+	constexpr std::size_t nlist_refs{10000};
+	constexpr std::size_t nlists{100};
+	constexpr std::size_t npush_rounds{20};
+	constexpr std::size_t nrefs_per_batch{500};
+
+	/* Per command latency and allocations of one scenario */
+	struct samples_t {
+		std::vector<double> latencies_us{};
+		std::size_t allocs{};
+		std::size_t reply_bytes{};
+		double seconds{};
+	};
+
+	/* Replays a command stream; the time until the next getline() is the previous command's latency */
+	class timed_reader_t final : public githlpr::protoio::reader_t {
+		std::istringstream strm;
+		samples_t& samples;
+		bool started{};
+		bench_clock::time_point last{};
+		std::size_t last_allocs{};
+
+		void record()
+		{
+			const bench_clock::time_point now = bench_clock::now();
+			const std::size_t allocs{nallocs.load(std::memory_order_relaxed)};
+			if (started) {
+				samples.latencies_us.push_back(std::chrono::duration<double, std::micro>(now - last).count());
+				samples.allocs += allocs - last_allocs;
+				samples.seconds += std::chrono::duration<double>(now - last).count();
+			}
+			started = true;
+		}
+	public:
+		timed_reader_t(const std::string& cmds, samples_t& samples) : strm(cmds), samples(samples) {}
+
+		bool getline(std::string& line) override
+		{
+			record();
+			// Reading the next line is not part of the command before it
+			const bool ok{static_cast<bool>(std::getline(strm, line))};
+			last = bench_clock::now();
+			last_allocs = nallocs.load(std::memory_order_relaxed);
+			return ok;
+		}
+
+		bool has_buffered() const override
+		{
+			return true;
+		}
+	};
+
+	class null_writer_t final : public githlpr::protoio::writer_t {
+		samples_t& samples;
+	public:
+		explicit null_writer_t(samples_t& samples) : samples(samples) {}
+
+		void write(const std::string_view data) override
+		{
+			samples.reply_bytes += data.size();
+		}
+
+		void flush() override {}
+	};
+
+	void run(const std::string& cmds, githlpr::remote::storage_t& storage, samples_t& samples)
+	{
+		timed_reader_t input{cmds, samples};
+		null_writer_t output{samples};
+		githlpr::process_git_cmds(input, output, storage);
+	}
+
+	double percentile(std::vector<double> values, const double p)
+	{
+		if (values.empty()) {
+			return 0;
+		}
+		const std::size_t i{std::min(values.size() - 1, static_cast<std::size_t>(p * static_cast<double>(values.size())))};
+		std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(i), values.end());
+		return values[i];
+	}
+
+	void report(const std::string& scenario, const samples_t& samples)
+	{
+		const double ncmds{static_cast<double>(samples.latencies_us.size())};
+		std::cout << "{\"scenario\":\"" << scenario << "\""
+			  << ",\"commands\":" << samples.latencies_us.size()
+			  << ",\"seconds\":" << samples.seconds
+			  << ",\"commands_per_sec\":" << ncmds / samples.seconds
+			  << ",\"reply_bytes_per_sec\":" << static_cast<double>(samples.reply_bytes) / samples.seconds
+			  << ",\"allocs_per_command\":" << static_cast<double>(samples.allocs) / ncmds
+			  << ",\"p50_us\":" << percentile(samples.latencies_us, 0.50)
+			  << ",\"p99_us\":" << percentile(samples.latencies_us, 0.99)
+			  << ",\"max_us\":" << percentile(samples.latencies_us, 1.0)
+			  << "}" << std::endl;
+	}
+
+	void bench_capabilities()
+	{
+		storageutils::mem_storage_t storage{};
+		std::string cmds{};
+		for (std::size_t i{}; i < ncaps; i++) {
+			cmds.append(githlpr::cmds::caps).append("\n");
+		}
+		samples_t samples{};
+		run(cmds, storage, samples);
+		report("capabilities", samples);
+	}
+
+	void bench_list()
+	{
+		storageutils::mem_storage_t storage{};
+		githlpr::manifest::manifest_t manifest{};
+		for (std::size_t i{}; i < nlist_refs; i++) {
+			manifest.refs["refs/heads/branch" + std::to_string(i)] = testutils::get_rnd_hex_str(40);
+		}
+		manifest.head = manifest.refs.begin()->first;
+		storage.objects[std::string(githlpr::manifest::path)] = githlpr::manifest::serialize(manifest);
+		std::string cmds{};
+		for (std::size_t i{}; i < nlists; i++) {
+			cmds.append(githlpr::cmds::list).append("\n");
+		}
+		samples_t samples{};
+		run(cmds, storage, samples);
+		report("list", samples);
+	}
+
+	std::filesystem::path setup_repo(const std::string& name)
+	{
+		const std::filesystem::path repo = std::filesystem::temp_directory_path() / ("bench_githlpr." + name);
+		std::filesystem::remove_all(repo);
+		unsetenv("GIT_DIR");
+		if (not testutils::execute("git init -q --initial-branch=master " + repo)) {
+			throw std::runtime_error("cannot create repository " + repo);
+		}
+		testutils::setup::set_env("GIT_DIR", repo / ".git");
+		return repo;
+	}
+
+	void commit(const std::filesystem::path& repo, const std::size_t n)
+	{
+		if (not testutils::git::git_cmd("-c user.name=bench -c user.email=bench@bench commit -q --allow-empty -m " + std::to_string(n), repo)) {
+			throw std::runtime_error("cannot commit to " + repo);
+		}
+	}
+
+	/* Each round commits, then pushes HEAD to every ref in one batch and fetches them back in one batch */
+	void bench_push_fetch()
+	{
+		storageutils::mem_storage_t storage{};
+		const std::filesystem::path dst = setup_repo("dst");
+		const std::filesystem::path src = setup_repo("src");
+		samples_t push_samples{}, fetch_samples{};
+		for (std::size_t round{}; round < npush_rounds; round++) {
+			testutils::setup::set_env("GIT_DIR", src / ".git");
+			commit(src, round);
+			std::string push_cmds{"list for-push\n"};
+			for (std::size_t i{}; i < nrefs_per_batch; i++) {
+				push_cmds.append("push +HEAD:refs/heads/branch").append(std::to_string(i)).append("\n");
+			}
+			run(push_cmds.append("\n"), storage, push_samples);
+
+			const std::string sha1{githlpr::manifest::read(storage).refs.begin()->second};
+			testutils::setup::set_env("GIT_DIR", dst / ".git");
+			std::string fetch_cmds{"list\n"};
+			for (std::size_t i{}; i < nrefs_per_batch; i++) {
+				fetch_cmds.append("fetch ").append(sha1).append(" refs/heads/branch").append(std::to_string(i)).append("\n");
+			}
+			run(fetch_cmds.append("\n"), storage, fetch_samples);
+		}
+		report("push", push_samples);
+		report("fetch", fetch_samples);
+		unsetenv("GIT_DIR");
+		std::filesystem::remove_all(src);
+		std::filesystem::remove_all(dst);
+	}
+}
+
+int main()
+{
+	std::signal(SIGPIPE, SIG_IGN); // as in git-remote-rclone
+	try {
+		bench_capabilities();
+		bench_list();
+		bench_push_fetch();
+	} catch (const std::runtime_error& err) {
+		std::cerr << "bench_githlpr: " << err.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
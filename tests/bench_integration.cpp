@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "testutils.hpp"
+
+/*
+ * Times push, clone, incremental and no-op fetch with git and the built helper on synthetic repositories, generated
+ * with git fast-import, against a local and a crypt rclone remote. Prints one JSON object per tier, backend and
+ * operation with wall time, bytes moved and rclone invocations (from $GIT_REMOTE_RCLONE_STATS) and the peak RSS of
+ * the operation's processes. Needs git, rclone and BINARY_SEARCH_PATH like test_integration; tiers are named as
+ * arguments, the 10k object tiers by default.
+ */
+
+namespace
+{
+	namespace git = testutils::git;
+	using bench_clock = std::chrono::steady_clock;
+
+	/* Every commit rewrites nchanged consecutive files of ndirs * files_per_dir, and every tag_every-th commit is tagged */
+	struct tier_t {
+		std::string_view name;
+		std::size_t ncommits;
+		std::size_t nchanged;
+		std::size_t ndirs;
+		std::size_t tag_every; // 0: master only
+		bool by_default;
+	};
+
+	constexpr std::size_t files_per_dir{16};
+	constexpr std::array tiers{
+		tier_t{"10k-deep", 2500, 1, 16, 0, true}, // blob, its directory, root tree and commit per commit
+		tier_t{"10k-wide", 10, 900, 100, 0, true}, // 900 blobs, 100 directories, root tree and commit per commit
+		tier_t{"10k-refs", 2500, 1, 16, 1, true},
+		tier_t{"1m-deep", 250000, 1, 16, 0, false},
+		tier_t{"1m-wide", 1000, 900, 100, 0, false},
+	};
+	constexpr std::array<std::string_view, 2> backends{"local", "crypt"};
+
+	struct sample_t {
+		double seconds{};
+		std::uint64_t uploaded_bytes{};
+		std::uint64_t downloaded_bytes{};
+		std::uint64_t rclone_invocations{};
+		long peak_rss_kb{};
+	};
+
+	/*
+	 * Appends commits [first, first + n) of tier to branch master of repo with git fast-import; returns the number of
+	 * objects they add
+	 */
+	std::size_t import_commits(const std::filesystem::path& repo, const tier_t& tier, const std::size_t first, const std::size_t n)
+	{
+		const std::filesystem::path stream_file{repo.parent_path() / (repo.filename().string() + ".fast-import")};
+		const std::size_t nfiles{std::max(tier.nchanged, tier.ndirs * files_per_dir)};
+		std::size_t nobjects{};
+		{
+			std::ofstream strm{stream_file, std::ios::binary};
+			const auto data = [&strm](const std::string& content) {
+				strm << "data " << content.size() << '\n' << content << '\n';
+			};
+			for (std::size_t c{first}; c < first + n; c++) {
+				strm << "commit refs/heads/master\nmark :" << c + 1 << "\ncommitter bench <bench@bench> " << 1700000000 + c << " +0000\n";
+				data("commit " + std::to_string(c));
+				if (c == first and 0 != first) {
+					strm << "from refs/heads/master^0\n";
+				}
+				std::vector<bool> changed_dirs(tier.ndirs);
+				for (std::size_t j{}; j < tier.nchanged; j++) {
+					const std::size_t file{(c * tier.nchanged + j) % nfiles};
+					changed_dirs[file % tier.ndirs] = true;
+					strm << "M 100644 inline d" << file % tier.ndirs << "/f" << file << '\n';
+					data("commit " + std::to_string(c) + " file " + std::to_string(file) + "\n");
+				}
+				nobjects += 2 + tier.nchanged + static_cast<std::size_t>(std::count(changed_dirs.begin(), changed_dirs.end(), true));
+				if (0 != tier.tag_every and 0 == c % tier.tag_every) {
+					strm << "reset refs/tags/t" << c << "\nfrom :" << c + 1 << "\n\n";
+				}
+			}
+			if (not strm.flush()) {
+				throw std::runtime_error("cannot write " + stream_file);
+			}
+		}
+		if (not git::git_cmd("fast-import --quiet < \"" + stream_file.string() + "\"", repo)) {
+			throw std::runtime_error("cannot import history into " + repo);
+		}
+		std::filesystem::remove(stream_file);
+		return nobjects;
+	}
+
+	/* Sums the values of the metrics in the OpenMetrics file whose names start with name */
+	std::uint64_t get_metric(const std::filesystem::path& file, const std::string_view name)
+	{
+		std::ifstream strm{file};
+		std::uint64_t sum{};
+		for (std::string line{}; std::getline(strm, line);) {
+			if (0 == line.compare(0, name.length(), name) and std::string::npos != line.find(' ')) {
+				sum += std::strtoull(line.c_str() + line.rfind(' ') + 1, nullptr, 10);
+			}
+		}
+		return sum;
+	}
+
+	/* Runs cmd with sh, its output on stderr, and measures it; the peak RSS is that of its largest process */
+	sample_t run(const std::string& cmd, const std::filesystem::path& stats_file)
+	{
+		std::filesystem::remove(stats_file);
+		testutils::setup::set_env("GIT_REMOTE_RCLONE_STATS", stats_file.string());
+		const bench_clock::time_point start{bench_clock::now()};
+		const pid_t pid{::fork()};
+		if (-1 == pid) {
+			throw std::runtime_error(std::string("cannot fork: ") + std::strerror(errno));
+		} else if (0 == pid) {
+			::dup2(STDERR_FILENO, STDOUT_FILENO); // stdout is the report
+			::execl("/bin/sh", "sh", "-c", cmd.c_str(), static_cast<char*>(nullptr));
+			::_exit(127);
+		}
+		int status{};
+		rusage usage{};
+		while (-1 == ::wait4(pid, &status, 0, &usage)) {
+			if (EINTR != errno) {
+				throw std::runtime_error(std::string("cannot wait for ") + cmd + ": " + std::strerror(errno));
+			}
+		}
+		sample_t sample{};
+		sample.seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+		if (not WIFEXITED(status) or 0 != WEXITSTATUS(status)) {
+			throw std::runtime_error("failed: " + cmd);
+		}
+		sample.uploaded_bytes = get_metric(stats_file, "git_remote_rclone_uploaded_bytes_total");
+		sample.downloaded_bytes = get_metric(stats_file, "git_remote_rclone_downloaded_bytes_total");
+		sample.rclone_invocations = get_metric(stats_file, "git_remote_rclone_rclone_invocations_total");
+		sample.peak_rss_kb = usage.ru_maxrss; // includes the descendants it waited for
+		return sample;
+	}
+
+	void report(const tier_t& tier, const std::size_t nobjects, const std::string_view backend, const std::string_view operation, const sample_t& sample)
+	{
+		std::cout << "{\"tier\":\"" << tier.name << "\""
+			  << ",\"objects\":" << nobjects
+			  << ",\"backend\":\"" << backend << "\""
+			  << ",\"operation\":\"" << operation << "\""
+			  << ",\"seconds\":" << sample.seconds
+			  << ",\"uploaded_bytes\":" << sample.uploaded_bytes
+			  << ",\"downloaded_bytes\":" << sample.downloaded_bytes
+			  << ",\"rclone_invocations\":" << sample.rclone_invocations
+			  << ",\"peak_rss_kb\":" << sample.peak_rss_kb
+			  << "}" << std::endl;
+	}
+
+	/* Pushes the tier's history to every backend, clones it and fetches it unchanged, then pushes and fetches one more commit */
+	void bench_tier(const tier_t& tier)
+	{
+		const std::filesystem::path dir{testutils::setup::setup_sub_workdir(std::string(tier.name))}; // "remote": crypt over dir/remote
+		const std::filesystem::path rclone_cfg{dir / "rclone.conf"};
+		if (not testutils::rclone::rclone_cmd(rclone_cfg, "config create --non-interactive local alias \"remote=" + dir / "local" + "\"")) {
+			throw std::runtime_error("cannot setup rclone config for local");
+		}
+		testutils::setup::set_env("RCLONE_CONFIG", rclone_cfg.string());
+		const std::filesystem::path stats_file{dir / "stats.prom"};
+		const std::filesystem::path src{dir / "src"};
+		if (not testutils::execute("git init -q --initial-branch=master \"" + src.string() + "\"")) {
+			throw std::runtime_error("cannot create repository " + src);
+		}
+		const std::size_t nobjects{import_commits(src, tier, 0, tier.ncommits)};
+		const auto get_url = [](const std::string_view backend) {
+			return std::string("rclone://") + ("local" == backend ? "local" : "remote") + ":repo";
+		};
+		const auto get_clone = [&dir](const std::string_view backend) {
+			return dir / ("clone-" + std::string(backend));
+		};
+
+		for (const std::string_view backend : backends) {
+			if (not git::git_cmd("remote add " + std::string(backend) + " " + get_url(backend), src)) {
+				throw std::runtime_error("cannot add remote " + std::string(backend));
+			}
+			report(tier, nobjects, backend, "push",
+			       run("git -C \"" + src.string() + "\" push -q " + std::string(backend) + " 'refs/heads/*:refs/heads/*' 'refs/tags/*:refs/tags/*'", stats_file));
+			report(tier, nobjects, backend, "clone", run("git clone -q " + get_url(backend) + " \"" + get_clone(backend).string() + "\"", stats_file));
+			report(tier, nobjects, backend, "fetch_noop", run("git -C \"" + get_clone(backend).string() + "\" fetch -q origin", stats_file));
+		}
+		const std::size_t nincremental{import_commits(src, tier, tier.ncommits, 1)};
+		for (const std::string_view backend : backends) {
+			report(tier, nincremental, backend, "push_incremental",
+			       run("git -C \"" + src.string() + "\" push -q " + std::string(backend) + " master", stats_file));
+			report(tier, nincremental, backend, "fetch_incremental", run("git -C \"" + get_clone(backend).string() + "\" fetch -q origin", stats_file));
+		}
+		unsetenv("GIT_REMOTE_RCLONE_STATS");
+		std::filesystem::remove_all(dir);
+	}
+}
+
+int main(const int argc, const char *const *const argv)
+{
+	try {
+		const std::vector<std::string_view> names(argv + 1, argv + argc);
+		for (const std::string_view name : names) {
+			if (std::none_of(tiers.begin(), tiers.end(), [name](const tier_t& tier) { return tier.name == name; })) {
+				throw std::runtime_error("unknown tier " + std::string(name));
+			}
+		}
+		testutils::setup::setup_workdir(std::filesystem::absolute(argv[0]).parent_path() / "bench_integration");
+		unsetenv("GIT_TRACE2"); // would be timed too
+		for (const tier_t& tier : tiers) {
+			if (names.empty() ? tier.by_default : names.end() != std::find(names.begin(), names.end(), tier.name)) {
+				bench_tier(tier);
+			}
+		}
+	} catch (const std::runtime_error& err) {
+		std::cerr << "bench_integration: " << err.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
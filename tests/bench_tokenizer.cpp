@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdlib>
+
+#include "testutils.hpp"
+
+#include "githlpr.hpp"
+#include "tokenizer.hpp"
+
+namespace
+{
+	using bench_clock = std::chrono::steady_clock;
+
+	constexpr std::size_t nlines{200000};
+	constexpr int nrounds{5};
+
+	/* Tokenizer as it was before githlpr::tokenizer; kept as the baseline to compare against */
+	namespace legacy
+	{
+		std::string get_nth_str_word(const std::string_view& str, const size_t n)
+		{
+			std::istringstream cmdstr{std::string(str)};
+			std::string word_n{};
+			for (size_t i{}; i < n; i++) {
+				cmdstr >> std::skipws >> word_n;
+			}
+			return word_n;
+		}
+
+		std::string get_push_dst(const std::string_view& push_args)
+		{
+			size_t colon_pos{push_args.find(':')};
+			colon_pos += 1;
+			return get_nth_str_word(push_args.substr(colon_pos, push_args.length() - colon_pos), 1);
+		}
+	}
+
+	std::string make_cmd_strm()
+	{
+		std::ostringstream strm{};
+		for (std::size_t i{}; i < nlines; i++) {
+			if (i % 2) {
+				strm << "push refs/heads/branch" << i << ":refs/heads/branch" << i << '\n';
+			} else {
+				strm << "fetch " << testutils::get_rnd_hex_str(40) << " refs/heads/branch" << i << '\n';
+			}
+		}
+		return strm.str();
+	}
+
+	template<typename F>
+	double lines_per_sec(const std::string& cmds, F parse_line)
+	{
+		double best{};
+		for (int round{}; round < nrounds; round++) {
+			std::istringstream input{cmds};
+			std::string line{};
+			std::size_t sink{};
+			const auto start = bench_clock::now();
+			while (std::getline(input, line)) {
+				sink += parse_line(line);
+			}
+			const std::chrono::duration<double> elapsed = bench_clock::now() - start;
+			if (0 == sink) {
+				std::exit(EXIT_FAILURE); // keeps the parsed result observable for the optimizer
+			}
+			best = std::max(best, static_cast<double>(nlines) / elapsed.count());
+		}
+		return best;
+	}
+}
+
+int main()
+{
+	const std::string cmds = make_cmd_strm();
+
+	const double legacy_lps = lines_per_sec(cmds, [](const std::string& line) {
+		std::size_t len = legacy::get_nth_str_word(line, 1).length();
+		if ("push" == legacy::get_nth_str_word(line, 1)) {
+			len += legacy::get_push_dst(legacy::get_nth_str_word(line, 2)).length();
+		} else {
+			len += legacy::get_nth_str_word(line, 2).length() + legacy::get_nth_str_word(line, 3).length();
+		}
+		return len;
+	});
+
+	const double tokenizer_lps = lines_per_sec(cmds, [](const std::string& line) {
+		const githlpr::tokenizer::cmd_line_t cmd_line{githlpr::tokenizer::tokenize(line)};
+		std::size_t len = cmd_line.cmd().length();
+		if (githlpr::cmds::push == cmd_line.cmd()) {
+			len += githlpr::tokenizer::get_push_dst(cmd_line.arg(0)).length();
+		} else {
+			len += cmd_line.arg(0).length() + cmd_line.arg(1).length();
+		}
+		return len;
+	});
+
+	std::cout << "lines:     " << nlines << '\n'
+		  << "legacy:    " << static_cast<long long>(legacy_lps) << " lines/sec\n"
+		  << "tokenizer: " << static_cast<long long>(tokenizer_lps) << " lines/sec\n"
+		  << "speedup:   " << tokenizer_lps / legacy_lps << "x" << std::endl;
+}
@@ -0,0 +1,152 @@
+#ifndef STORAGEUTILS_HPP
+#define STORAGEUTILS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "proc.hpp"
+#include "remote.hpp"
+
+namespace storageutils
+{
+	/* memfd backed file descriptor so storage_t users can splice/read it like an rclone pipe */
+	githlpr::proc::fd_t create_memfd(const std::string& data = {})
+	{
+		githlpr::proc::fd_t fd{::memfd_create("storageutils", MFD_CLOEXEC)};
+		if (not fd) {
+			githlpr::proc::throw_errno("cannot create memfd");
+		}
+		githlpr::proc::write_all(fd.get(), data);
+		::lseek(fd.get(), 0, SEEK_SET);
+		return fd;
+	}
+
+	std::string read_memfd(const githlpr::proc::fd_t& fd)
+	{
+		std::string data{};
+		const off_t size = ::lseek(fd.get(), 0, SEEK_END);
+		data.resize(static_cast<std::size_t>(size));
+		if (size != ::pread(fd.get(), data.data(), data.size(), 0)) {
+			githlpr::proc::throw_errno("cannot read memfd");
+		}
+		return data;
+	}
+
+	/* In-memory remote; counts operations so tests can assert on remote round trips. Safe to use from several threads */
+	class mem_storage_t final : public githlpr::remote::storage_t {
+		class source_t final : public githlpr::remote::source_t {
+			githlpr::proc::fd_t memfd;
+			const bool exists;
+		public:
+			source_t(githlpr::proc::fd_t memfd, const bool exists) : memfd(std::move(memfd)), exists(exists) {}
+
+			int fd() const override
+			{
+				return memfd.get();
+			}
+
+			bool finish() override
+			{
+				return exists;
+			}
+		};
+
+		class sink_t final : public githlpr::remote::sink_t {
+			mem_storage_t& storage;
+			const std::string path;
+			githlpr::proc::fd_t memfd{create_memfd()};
+		public:
+			sink_t(mem_storage_t& storage, const std::string& path) : storage(storage), path(path) {}
+
+			int fd() const override
+			{
+				return memfd.get();
+			}
+
+			void commit() override
+			{
+				const std::lock_guard lock{storage.mutex};
+				storage.objects[path] = read_memfd(memfd);
+			}
+		};
+
+		static inline std::atomic<int> ninstances{};
+		const std::string name{"mem" + std::to_string(ninstances++)};
+		std::mutex mutex{};
+	public:
+		std::map<std::string, std::string> objects{};
+		std::atomic<int> nreads{};
+		std::atomic<int> nwrites{};
+
+		std::unique_ptr<githlpr::remote::source_t> open_read(const std::string& path) override
+		{
+			nreads++;
+			const std::lock_guard lock{mutex};
+			const auto object = objects.find(path);
+			if (objects.end() == object) {
+				return std::make_unique<source_t>(create_memfd(), false);
+			}
+			return std::make_unique<source_t>(create_memfd(object->second), true);
+		}
+
+		std::unique_ptr<githlpr::remote::source_t> open_read(const std::string& path, const std::uint64_t offset, const std::uint64_t count) override
+		{
+			nreads++;
+			const std::lock_guard lock{mutex};
+			const auto object = objects.find(path);
+			if (objects.end() == object) {
+				return std::make_unique<source_t>(create_memfd(), false);
+			}
+			return std::make_unique<source_t>(create_memfd(object->second.substr(std::min<std::size_t>(offset, object->second.size()), count)), true);
+		}
+
+		std::unique_ptr<githlpr::remote::sink_t> open_write(const std::string& path) override
+		{
+			nwrites++;
+			return std::make_unique<sink_t>(*this, path);
+		}
+
+		void rename(const std::string& from, const std::string& to) override
+		{
+			nwrites++;
+			const std::lock_guard lock{mutex};
+			objects[to] = objects.at(from);
+			objects.erase(from);
+		}
+
+		bool remove(const std::string& path) override
+		{
+			nwrites++;
+			const std::lock_guard lock{mutex};
+			return 0 != objects.erase(path);
+		}
+
+		std::map<std::string, std::uint64_t> list(const std::string& dir) override
+		{
+			nreads++;
+			const std::lock_guard lock{mutex};
+			std::map<std::string, std::uint64_t> listed{};
+			for (auto object = objects.lower_bound(dir); objects.end() != object and 0 == object->first.compare(0, dir.length(), dir); ++object) {
+				if (std::string::npos == object->first.find('/', dir.length())) {
+					listed.emplace(object->first.substr(dir.length()), object->second.size());
+				}
+			}
+			return listed;
+		}
+
+		std::string get_name() const override
+		{
+			return name;
+		}
+	};
+}
+
+#endif /* STORAGEUTILS_HPP */
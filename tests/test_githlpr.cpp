@@ -1,19 +1,50 @@
+#include <array>
 #include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <future>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <thread>
 #include <vector>
 
 #include <cstdlib>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include "storageutils.hpp"
 #include "testutils.hpp"
 
+#include "cache.hpp"
+#include "chunks.hpp"
+#include "compact.hpp"
+#include "config.hpp"
+#include "daemon.hpp"
+#include "download.hpp"
 #include "githlpr.hpp"
+#include "git.hpp"
+#include "log.hpp"
+#include "manifest.hpp"
+#include "mirror.hpp"
+#include "packidx.hpp"
+#include "protoio.hpp"
+#include "push.hpp"
+#include "rc.hpp"
+#include "sha1.hpp"
+#include "stats.hpp"
+#include "tokenizer.hpp"
+#include "trace.hpp"
 
 namespace
 {
@@ -41,6 +72,146 @@ namespace
 	{
 		return testutils::getline(strm).empty() && testutils::is_strm_eof(strm);
 	}
+
+	/* Remote that fails every operation, like a mirror that is down */
+	class unreachable_storage_t final : public githlpr::remote::storage_t {
+	public:
+		std::unique_ptr<githlpr::remote::source_t> open_read(const std::string&) override
+		{
+			throw std::runtime_error("unreachable");
+		}
+
+		std::unique_ptr<githlpr::remote::source_t> open_read(const std::string&, std::uint64_t, std::uint64_t) override
+		{
+			throw std::runtime_error("unreachable");
+		}
+
+		std::unique_ptr<githlpr::remote::sink_t> open_write(const std::string&) override
+		{
+			throw std::runtime_error("unreachable");
+		}
+
+		void rename(const std::string&, const std::string&) override
+		{
+			throw std::runtime_error("unreachable");
+		}
+
+		bool remove(const std::string&) override
+		{
+			throw std::runtime_error("unreachable");
+		}
+
+		std::map<std::string, std::uint64_t> list(const std::string&) override
+		{
+			throw std::runtime_error("unreachable");
+		}
+
+		std::string get_name() const override
+		{
+			return "unreachable";
+		}
+	};
+
+	/* Remote whose link drops after nchunks chunk uploads, like a flaky link in the middle of a chunked push */
+	class dropping_storage_t final : public githlpr::remote::storage_t {
+		githlpr::remote::storage_t& storage;
+		int nchunks;
+	public:
+		dropping_storage_t(githlpr::remote::storage_t& storage, const int nchunks) : storage(storage), nchunks(nchunks) {}
+
+		std::unique_ptr<githlpr::remote::source_t> open_read(const std::string& path) override
+		{
+			return storage.open_read(path);
+		}
+
+		std::unique_ptr<githlpr::remote::source_t> open_read(const std::string& path, const std::uint64_t offset, const std::uint64_t count) override
+		{
+			return storage.open_read(path, offset, count);
+		}
+
+		std::unique_ptr<githlpr::remote::sink_t> open_write(const std::string& path) override
+		{
+			if (0 == path.compare(0, githlpr::chunks::dir.length(), githlpr::chunks::dir) and nchunks-- <= 0) {
+				throw std::runtime_error("link dropped");
+			}
+			return storage.open_write(path);
+		}
+
+		void rename(const std::string& from, const std::string& to) override
+		{
+			storage.rename(from, to);
+		}
+
+		bool remove(const std::string& path) override
+		{
+			return storage.remove(path);
+		}
+
+		std::map<std::string, std::uint64_t> list(const std::string& dir) override
+		{
+			return storage.list(dir);
+		}
+
+		std::string get_name() const override
+		{
+			return "dropping";
+		}
+	};
+
+	/* Throw-away repository with one commit on master; GIT_DIR points to it until unset_git_dir() */
+	std::filesystem::path setup_git_dir(const std::string& name)
+	{
+		const std::filesystem::path repo = std::filesystem::temp_directory_path() / ("test_githlpr." + name);
+		std::filesystem::remove_all(repo);
+		unsetenv("GIT_DIR"); // would redirect git init to the previous repository
+		REQUIRE(testutils::execute("git init -q --initial-branch=master " + repo));
+		REQUIRE(testutils::git::git_cmd("-c user.name=test -c user.email=test@test commit -q --allow-empty -m init", repo));
+		testutils::setup::set_env("GIT_DIR", repo / ".git");
+		return repo;
+	}
+
+	void commit_git_dir(const std::filesystem::path& repo)
+	{
+		REQUIRE(testutils::git::git_cmd("-c user.name=test -c user.email=test@test commit -q --allow-empty -m next", repo));
+	}
+
+	std::string get_head_sha1()
+	{
+		return githlpr::git::resolve({"HEAD"}).at(0).value();
+	}
+
+	/* Object of the newest committed manifest */
+	std::string get_manifest_path(const storageutils::mem_storage_t& storage)
+	{
+		const std::string dir{githlpr::manifest::dir};
+		for (auto object = storage.objects.rbegin(); storage.objects.rend() != object; ++object) {
+			if (0 == object->first.compare(0, dir.length(), dir) and std::string::npos == object->first.find('-')) {
+				return object->first;
+			}
+		}
+		return std::string(githlpr::manifest::path);
+	}
+
+	githlpr::manifest::manifest_t read_manifest(const storageutils::mem_storage_t& storage)
+	{
+		return githlpr::manifest::parse(storage.objects.at(get_manifest_path(storage)));
+	}
+
+	void unset_git_dir()
+	{
+		REQUIRE_MESSAGE(not unsetenv("GIT_DIR"),
+				("cannot unset env GIT_DIR"));
+	}
+
+	std::size_t count_objects(const storageutils::mem_storage_t& storage, const std::string_view& prefix, const std::string_view& suffix = {})
+	{
+		std::size_t count{};
+		for (const auto& object : storage.objects) {
+			count += 0 == object.first.compare(0, prefix.length(), prefix) and object.first.length() >= suffix.length()
+				and 0 == object.first.compare(object.first.length() - suffix.length(), suffix.length(), suffix);
+		}
+		return count;
+	}
 }
 
 TEST_CASE("has_valid_git_dir() should return false if GIT_DIR is unset")
@@ -54,17 +225,877 @@ TEST_CASE("has_valid_git_dir() should return false if GIT_DIR is unset")
 	REQUIRE_FALSE(githlpr::has_valid_git_dir_env());
 }
 
+TEST_SUITE("tokenizer")
+{
+	TEST_CASE("tokenize()")
+	{
+		SUBCASE("should return no words for blank lines")
+		{
+			CHECK(githlpr::tokenizer::tokenize("").empty());
+			CHECK(githlpr::tokenizer::tokenize(" \t ").empty());
+		}
+
+		SUBCASE("should split cmd and args on any whitespace")
+		{
+			const githlpr::tokenizer::cmd_line_t cmd_line = githlpr::tokenizer::tokenize("  fetch\t2a569a9e  refs/heads/master ");
+			CHECK_EQ("fetch", cmd_line.cmd());
+			CHECK_EQ(2, cmd_line.nargs());
+			CHECK_EQ("2a569a9e", cmd_line.arg(0));
+			CHECK_EQ("refs/heads/master", cmd_line.arg(1));
+			CHECK(cmd_line.arg(2).empty());
+		}
+
+		SUBCASE("should keep the remainder of over-long lines in the last word")
+		{
+			const githlpr::tokenizer::cmd_line_t cmd_line = githlpr::tokenizer::tokenize("option name value with spaces ");
+			CHECK_EQ(3, cmd_line.nargs());
+			CHECK_EQ("with spaces", cmd_line.arg(2));
+			CHECK_EQ("value with spaces ", cmd_line.rest(1));
+		}
+	}
+
+	TEST_CASE("get_push_dst()")
+	{
+		CHECK_EQ("refs/heads/branch", githlpr::tokenizer::get_push_dst("+HEAD:refs/heads/branch"));
+		CHECK_THROWS_WITH(githlpr::tokenizer::get_push_dst("refs/heads/branch"), "could not parse dst-ref from push argument");
+	}
+}
+
+TEST_SUITE("protoio")
+{
+	TEST_CASE("fd reader/writer")
+	{
+		std::array<int, 2> fds{};
+		REQUIRE_FALSE(::pipe(fds.data()));
+		REQUIRE_NE(-1, ::fcntl(fds[0], F_SETFL, O_NONBLOCK)); // fail instead of hang on an empty pipe
+		REQUIRE_NE(-1, ::fcntl(fds[1], F_SETPIPE_SZ, 4 * githlpr::protoio::buffer_size));
+		githlpr::protoio::fd_reader_t reader{fds[0]};
+		githlpr::protoio::fd_writer_t writer{fds[1]};
+		std::string line{};
+
+		SUBCASE("should not write replies before flush()")
+		{
+			writer.write("pong\n");
+			CHECK_FALSE(reader.has_buffered());
+			CHECK_THROWS(reader.getline(line)); // EAGAIN: pipe is still empty
+			writer.flush();
+			CHECK(reader.getline(line));
+			CHECK_EQ("pong", line);
+		}
+
+		SUBCASE("should split lines across reads and report buffered lines")
+		{
+			const std::string long_line(githlpr::protoio::buffer_size + 16, 'x');
+			writer.write(long_line);
+			writer.write("\nping\nping\n");
+			writer.flush();
+			CHECK(reader.getline(line));
+			CHECK_EQ(long_line, line);
+			CHECK(reader.getline(line));
+			CHECK(reader.has_buffered());
+			CHECK(reader.getline(line));
+			CHECK_EQ("ping", line);
+			CHECK_FALSE(reader.has_buffered());
+		}
+
+		::close(fds[0]);
+		::close(fds[1]);
+	}
+}
+
+TEST_SUITE("manifest")
+{
+	TEST_CASE("serialize()/parse()")
+	{
+		githlpr::manifest::manifest_t manifest{};
+		manifest.head = test_ref;
+		manifest.refs[std::string(test_ref)] = test_sha1;
+		manifest.refs["refs/tags/v1.0.0"] = test_sha1;
+		manifest.refs["refs/tags/v1.0.1"] = test_sha1;
+		manifest.packs.push_back({"pack-a.pack", 1234, {std::string(test_sha1)}, {}});
+		manifest.packs.push_back({"pack-b.pack", std::uint64_t{5} << 30, {std::string(test_sha1)}, {std::string(test_sha1)}, "pack-c.pack", 321, true, false});
+
+		SUBCASE("should round-trip refs, head and packs")
+		{
+			const githlpr::manifest::manifest_t parsed = githlpr::manifest::parse(githlpr::manifest::serialize(manifest));
+			CHECK_EQ(manifest.head, parsed.head);
+			CHECK(manifest.refs == parsed.refs);
+			REQUIRE_EQ(2, parsed.packs.size());
+			CHECK_EQ("pack-b.pack", parsed.packs[1].name);
+			CHECK_EQ(manifest.packs[1].size, parsed.packs[1].size);
+			CHECK(manifest.packs[1].tips == parsed.packs[1].tips);
+			CHECK(manifest.packs[1].prereqs == parsed.packs[1].prereqs);
+			CHECK_EQ("pack-c.pack", parsed.packs[1].tree_pack);
+			CHECK_EQ(321, parsed.packs[1].tree_pack_size);
+			CHECK(parsed.packs[1].chunked);
+			CHECK_FALSE(parsed.packs[1].tree_pack_chunked);
+			CHECK_FALSE(parsed.packs[0].chunked);
+		}
+
+		SUBCASE("should store sha1s raw and shared ref prefixes once")
+		{
+			const std::string data = githlpr::manifest::serialize(manifest);
+			CHECK_LT(data.size(), 7 * githlpr::git::sha1_hex_len); // less than the 7 sha1s alone would take in hex
+			CHECK_EQ(std::string::npos, data.find("refs/tags/v1.0.1"));
+		}
+
+		SUBCASE("should treat an empty object as an empty remote")
+		{
+			CHECK(githlpr::manifest::parse("").refs.empty());
+		}
+
+		SUBCASE("should throw on truncated or foreign data")
+		{
+			const std::string data = githlpr::manifest::serialize(manifest);
+			CHECK_THROWS_WITH(githlpr::manifest::parse(data.substr(0, data.size() - 1)), "corrupt manifest: unexpected end");
+			CHECK_THROWS_WITH(githlpr::manifest::parse("ref 2a569a9e refs/heads/master"), "corrupt manifest: bad magic");
+		}
+	}
+
+}
+
+TEST_SUITE("log")
+{
+	TEST_CASE("parse_level()")
+	{
+		CHECK_EQ(GITHLPR_LOG_TRACE, githlpr::log::parse_level("trace"));
+		CHECK_EQ(GITHLPR_LOG_ERROR, githlpr::log::parse_level("0"));
+		CHECK_EQ(githlpr::log::default_level, githlpr::log::parse_level("verbose"));
+	}
+
+	TEST_CASE("should not evaluate messages above the compiled-in level")
+	{
+		int evaluated{};
+		const auto msg = [&evaluated]() { evaluated++; return std::string("msg"); };
+		GITHLPR_LOG(GITHLPR_LOG_LEVEL + 1, msg());
+		CHECK_EQ(0, evaluated);
+	}
+}
+
+TEST_SUITE("trace")
+{
+	TEST_CASE("write()")
+	{
+		const std::filesystem::path file = std::filesystem::temp_directory_path() / "test_githlpr.trace.json";
+		githlpr::trace::record("main \"span\"", "rclone cat remote:packs", 10, 25);
+		std::thread([]() { githlpr::trace::record("worker span", {}, 12, 20); }).join();
+		githlpr::trace::write(file);
+
+		std::ifstream strm{file};
+		const std::string trace{std::istreambuf_iterator<char>(strm), std::istreambuf_iterator<char>()};
+		CHECK_EQ(0, trace.find("{\"traceEvents\":["));
+		const std::string pid = std::to_string(::getpid());
+		CHECK_NE(std::string::npos, trace.find("\"name\":\"main \\\"span\\\"\",\"pid\":" + pid + ",\"tid\":1,\"ts\":10,\"dur\":15,\"args\":{\"detail\":\"rclone cat remote:packs\"}}"));
+		CHECK_NE(std::string::npos, trace.find("\"name\":\"worker span\",\"pid\":" + pid + ",\"tid\":2,\"ts\":12,\"dur\":8}")); // buffer of its own
+		std::filesystem::remove(file);
+	}
+}
+
+TEST_SUITE("stats")
+{
+	TEST_CASE("write()")
+	{
+		const std::filesystem::path file = std::filesystem::temp_directory_path() / "test_githlpr.prom";
+		std::filesystem::remove(file);
+		githlpr::stats::add_uploaded(100);
+		githlpr::stats::count_rclone(githlpr::stats::rclone_cmd_t::MOVETO);
+		githlpr::stats::observe(githlpr::stats::op_t::LIST, std::chrono::milliseconds(3));
+		githlpr::stats::write(file);
+		githlpr::stats::write(file); // a second run adds to the first
+
+		std::ifstream strm{file};
+		const std::string stats{std::istreambuf_iterator<char>(strm), std::istreambuf_iterator<char>()};
+		CHECK_NE(std::string::npos, stats.find("# TYPE git_remote_rclone_uploaded_bytes counter\n"));
+		CHECK_NE(std::string::npos, stats.find("\ngit_remote_rclone_uploaded_bytes_total 200\n"));
+		CHECK_NE(std::string::npos, stats.find("\ngit_remote_rclone_rclone_invocations_total{command=\"moveto\"} 2\n"));
+		CHECK_NE(std::string::npos, stats.find("\ngit_remote_rclone_operation_duration_seconds_bucket{operation=\"list\",le=\"0.002\"} 0\n"));
+		CHECK_NE(std::string::npos, stats.find("\ngit_remote_rclone_operation_duration_seconds_bucket{operation=\"list\",le=\"0.004\"} 2\n"));
+		CHECK_NE(std::string::npos, stats.find("\ngit_remote_rclone_operation_duration_seconds_bucket{operation=\"list\",le=\"+Inf\"} 2\n"));
+		CHECK_NE(std::string::npos, stats.find("\ngit_remote_rclone_operation_duration_seconds_sum{operation=\"list\"} 0.006\n"));
+		CHECK_EQ(stats.length() - 6, stats.rfind("# EOF\n"));
+		std::filesystem::remove(file);
+		std::filesystem::remove(file.string() + ".lock");
+	}
+}
+
+TEST_SUITE("sha1")
+{
+	TEST_CASE("context_t")
+	{
+		const auto hash = [](const std::vector<std::string>& parts) {
+			githlpr::sha1::context_t ctx{};
+			for (const std::string& part : parts) {
+				ctx.update(part);
+			}
+			const githlpr::sha1::digest_t digest{ctx.finish()};
+			return githlpr::sha1::to_hex(std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size()));
+		};
+		CHECK_EQ("da39a3ee5e6b4b0d3255bfef95601890afd80709", hash({}));
+		CHECK_EQ("a9993e364706816aba3e25717850c26c9cd0d89d", hash({"abc"}));
+		CHECK_EQ("84983e441c3bd26ebaae4aa1f95129e5e54670f1", hash({"abcdbcdecdefdefgefghfghighij", "hijkijkljklmklmnlmnomnopnopq"}));
+		CHECK_EQ(std::string(test_sha1), githlpr::sha1::to_hex(githlpr::sha1::from_hex(test_sha1)));
+	}
+}
+
+TEST_SUITE("packidx")
+{
+	TEST_CASE("index_t")
+	{
+		const std::filesystem::path repo = setup_git_dir("packidx");
+		const std::filesystem::path dir = repo / "packs";
+		const std::string hash = githlpr::git::pack_objects({"HEAD"}, dir);
+		std::ifstream strm{dir / ("pack-" + hash + ".idx"), std::ios::binary};
+		const githlpr::packidx::index_t index = githlpr::packidx::index_t::parse(std::string{std::istreambuf_iterator<char>(strm), std::istreambuf_iterator<char>()});
+		const std::uint64_t pack_size = std::filesystem::file_size(dir / ("pack-" + hash + ".pack"));
+
+		REQUIRE_EQ(2, index.size()); // commit and empty tree
+		const std::string commit = githlpr::sha1::from_hex(get_head_sha1());
+		const std::optional<std::uint64_t> offset = index.find(commit);
+		REQUIRE(offset);
+		CHECK_EQ(12, *offset); // first after the header
+		CHECK_EQ(commit, index.get_name(*offset));
+		CHECK_LT(*offset, index.get_end(*offset, pack_size));
+		CHECK_FALSE(index.find(githlpr::sha1::from_hex(test_sha1)));
+		CHECK_THROWS_WITH(githlpr::packidx::index_t::parse("PACK"), "corrupt pack index: not a version 2 index");
+		CHECK_EQ("pack-a.idx", githlpr::packidx::get_index_name("pack-a.pack"));
+		unset_git_dir();
+	}
+}
+
+TEST_SUITE("config")
+{
+	TEST_CASE("parse_size()")
+	{
+		CHECK_EQ(512, githlpr::config::parse_size("512"));
+		CHECK_EQ(2 * 1024 * 1024, githlpr::config::parse_size("2M"));
+		CHECK_THROWS_WITH(githlpr::config::parse_size("1T"), "invalid size: 1T");
+		CHECK_THROWS_WITH(githlpr::config::parse_size("M"), "invalid size: M");
+	}
+
+	TEST_CASE("parse_duration()/get_duration()")
+	{
+		CHECK_EQ(90, githlpr::config::parse_duration("90"));
+		CHECK_EQ(90, githlpr::config::parse_duration("90s"));
+		CHECK_EQ(2 * 60 * 60, githlpr::config::parse_duration("2h"));
+		CHECK_EQ(24 * 60 * 60, githlpr::config::parse_duration("1d"));
+		CHECK_THROWS_WITH(githlpr::config::parse_duration("1G"), "invalid duration: 1G");
+		CHECK_THROWS_WITH(githlpr::config::parse_duration("-1"), "invalid duration: -1");
+		CHECK_THROWS_WITH(githlpr::config::parse_duration("h"), "invalid duration: h");
+
+		CHECK_EQ(7, githlpr::config::get_duration("GIT_REMOTE_RCLONE_TEST_DURATION", 7));
+		testutils::setup::set_env("GIT_REMOTE_RCLONE_TEST_DURATION", "1G");
+		CHECK_THROWS_WITH(githlpr::config::get_duration("GIT_REMOTE_RCLONE_TEST_DURATION", 7),
+				  "invalid GIT_REMOTE_RCLONE_TEST_DURATION: 1G (seconds, or with an s, m, h or d suffix)");
+		unsetenv("GIT_REMOTE_RCLONE_TEST_DURATION");
+	}
+}
+
+TEST_SUITE("rc")
+{
+	TEST_CASE("url_encode()")
+	{
+		CHECK_EQ("remote:a%20dir/pack-1.pack", githlpr::rc::url_encode("remote:a dir/pack-1.pack"));
+		CHECK_EQ("remote%3Aa%2Fb%26c%3D", githlpr::rc::url_encode("remote:a/b&c=", true));
+	}
+
+	TEST_CASE("parse_list()")
+	{
+		const std::map<std::string, std::uint64_t> listed{githlpr::rc::parse_list(R"({"list":[
+			{"Path":"manifests/00000000000000000001","Name":"00000000000000000001","Size":42,"MimeType":"application/octet-stream","ModTime":"2024-01-01T00:00:00Z","IsDir":false},
+			{"Path":"manifests/sub","Name":"sub","Size":-1,"IsDir":true},
+			{"Name":"a \"b\" \u00e9","Size":-1,"IsDir":false,"Hashes":{"sha1":"x"},"Tier":null}
+		]})")};
+		CHECK_EQ(2, listed.size());
+		CHECK_EQ(42, listed.at("00000000000000000001"));
+		CHECK_EQ(0, listed.at("a \"b\" \xc3\xa9")); // unknown size
+		CHECK(githlpr::rc::parse_list(R"({"list":[]})").empty());
+		CHECK_THROWS(githlpr::rc::parse_list(R"({"list":[{"Name":)"));
+	}
+}
+
+TEST_SUITE("daemon")
+{
+	TEST_CASE("serialize()/parse()")
+	{
+		githlpr::daemon::request_t request{};
+		request.cwd = "/home/user/repo";
+		request.args = {"origin", "rclone://remote:repo"};
+		request.env = {"GIT_DIR=.git", "EMPTY=", "RCLONE_CONFIG=/home/user/.config/rclone/rclone.conf"};
+		const githlpr::daemon::request_t parsed{githlpr::daemon::parse(githlpr::daemon::serialize(request))};
+		CHECK_EQ(request.cwd, parsed.cwd);
+		CHECK_EQ(request.args, parsed.args);
+		CHECK_EQ(request.env, parsed.env);
+		CHECK(githlpr::daemon::parse(githlpr::daemon::serialize({"/", {}, {}})).args.empty());
+		CHECK_THROWS_WITH(githlpr::daemon::parse(std::string("/\0" "3\0" "origin", 10)), "invalid request");
+	}
+}
+
+TEST_SUITE("download")
+{
+	TEST_CASE("download_ranges()")
+	{
+		storageutils::mem_storage_t storage{};
+		const std::filesystem::path file = std::filesystem::temp_directory_path() / "test_githlpr.download";
+		std::string data(1000 * 1000 + 7, '\0');
+		for (std::size_t i{}; i < data.size(); i++) {
+			data[i] = static_cast<char>((i * 2654435761u) >> 13);
+		}
+		storage.objects["packs/pack-a.pack"] = data;
+
+		SUBCASE("should write a file byte-identical to the object")
+		{
+			const githlpr::download::options_t options{4, 64 * 1024};
+			REQUIRE(githlpr::download::is_ranged(options, data.size()));
+			CHECK(githlpr::download::download_ranges(storage, "packs/pack-a.pack", data.size(), file, options));
+			CHECK_EQ(16, storage.nreads); // one transfer per range
+			std::ifstream strm{file, std::ios::binary};
+			const std::string downloaded{std::istreambuf_iterator<char>(strm), std::istreambuf_iterator<char>()};
+			CHECK(data == downloaded);
+		}
+
+		SUBCASE("should report a missing object")
+		{
+			CHECK_FALSE(githlpr::download::download_ranges(storage, "packs/pack-b.pack", data.size(), file, {4, 64 * 1024}));
+		}
+
+		SUBCASE("should throw if the object is shorter than expected")
+		{
+			CHECK_THROWS_WITH(githlpr::download::download_ranges(storage, "packs/pack-a.pack", data.size() + 1, file, {4, 64 * 1024}),
+					"remote object packs/pack-a.pack is shorter than expected");
+		}
+
+		SUBCASE("should not split objects within a single chunk")
+		{
+			CHECK_FALSE(githlpr::download::is_ranged({4, 64 * 1024}, 64 * 1024));
+			CHECK_FALSE(githlpr::download::is_ranged({1, 64 * 1024}, data.size()));
+		}
+
+		std::filesystem::remove(file);
+	}
+}
+
+TEST_SUITE("chunks")
+{
+	TEST_CASE("upload_file()/stream()/read_range()")
+	{
+		storageutils::mem_storage_t storage{};
+		const std::filesystem::path file = std::filesystem::temp_directory_path() / "test_githlpr.chunks";
+		std::string data(10 * 1000 + 7, '\0');
+		for (std::size_t i{}; i < data.size(); i++) {
+			data[i] = static_cast<char>((i * 2654435761u) >> 13);
+		}
+		std::ofstream{file, std::ios::binary} << data;
+		REQUIRE_EQ(data.size(), githlpr::chunks::upload_file(storage, "pack-a.pack", file, 1000));
+		const std::vector<githlpr::chunks::chunk_t> chunks = githlpr::chunks::read_list(storage, "pack-a.pack");
+		REQUIRE_EQ(11, chunks.size());
+		CHECK_EQ(7, chunks.back().size);
+
+		SUBCASE("should upload only the chunks an interrupted upload left out")
+		{
+			storage.objects.erase("chunks/" + chunks[3].sha1);
+			storage.objects.erase("packs/pack-a.chunks");
+			storage.nwrites = 0;
+			CHECK_EQ(data.size(), githlpr::chunks::upload_file(storage, "pack-a.pack", file, 1000));
+			CHECK_EQ(2, storage.nwrites); // the missing chunk and the list
+		}
+
+		SUBCASE("should upload a found chunk again that a compaction deleted before the list referred to it")
+		{
+			// Deletes a chunk as the list is written, like a compaction running meanwhile
+			class racing_storage_t final : public githlpr::remote::storage_t {
+				storageutils::mem_storage_t& storage;
+				const std::string victim;
+			public:
+				racing_storage_t(storageutils::mem_storage_t& storage, std::string victim) : storage(storage), victim(std::move(victim)) {}
+				std::unique_ptr<githlpr::remote::source_t> open_read(const std::string& path) override
+				{
+					return storage.open_read(path);
+				}
+				std::unique_ptr<githlpr::remote::source_t> open_read(const std::string& path, const std::uint64_t offset, const std::uint64_t count) override
+				{
+					return storage.open_read(path, offset, count);
+				}
+				std::unique_ptr<githlpr::remote::sink_t> open_write(const std::string& path) override
+				{
+					if (githlpr::chunks::get_list_name("pack-b.pack") == path.substr(path.rfind('/') + 1)) {
+						storage.objects.erase(victim);
+					}
+					return storage.open_write(path);
+				}
+				void rename(const std::string& from, const std::string& to) override
+				{
+					storage.rename(from, to);
+				}
+				bool remove(const std::string& path) override
+				{
+					return storage.remove(path);
+				}
+				std::map<std::string, std::uint64_t> list(const std::string& dir) override
+				{
+					return storage.list(dir);
+				}
+				std::string get_name() const override
+				{
+					return storage.get_name();
+				}
+			};
+			racing_storage_t racing{storage, "chunks/" + chunks[3].sha1};
+			storage.nwrites = 0;
+			CHECK_EQ(data.size(), githlpr::chunks::upload_file(racing, "pack-b.pack", file, 1000));
+			CHECK_EQ(2, storage.nwrites); // the list and the deleted chunk
+			const githlpr::proc::fd_t out = storageutils::create_memfd();
+			CHECK_EQ(data.size(), githlpr::chunks::stream(storage, githlpr::chunks::read_list(storage, "pack-b.pack"), out.get()));
+		}
+
+		SUBCASE("should reassemble the chunks in order")
+		{
+			const githlpr::proc::fd_t out = storageutils::create_memfd();
+			CHECK_EQ(data.size(), githlpr::chunks::stream(storage, chunks, out.get()));
+			CHECK(data == storageutils::read_memfd(out));
+			CHECK(data.substr(990, 1020) == githlpr::chunks::read_range(storage, chunks, 990, 1020));
+		}
+
+		SUBCASE("should throw on a chunk that does not match its sha1")
+		{
+			storage.objects["chunks/" + chunks[5].sha1][0] ^= 1;
+			const githlpr::proc::fd_t out = storageutils::create_memfd();
+			CHECK_THROWS_WITH(githlpr::chunks::stream(storage, chunks, out.get()), ("corrupt chunk: " + chunks[5].sha1).c_str());
+			CHECK_THROWS_WITH(githlpr::download::download_chunks(storage, chunks, file, {4, 1000}), ("corrupt remote object chunks/" + chunks[5].sha1).c_str());
+		}
+
+		SUBCASE("should remove a pack's chunk list but not its chunks, which other lists may refer to")
+		{
+			std::set<std::string> sha1s{};
+			for (const githlpr::chunks::chunk_t& chunk : chunks) {
+				sha1s.insert(chunk.sha1);
+			}
+			CHECK(sha1s == githlpr::chunks::list_referenced(storage));
+			CHECK_EQ(chunks.size(), githlpr::chunks::remove_list(storage, "pack-a.pack").value().size());
+			CHECK_EQ(sha1s.size(), storage.objects.size());
+			CHECK(githlpr::chunks::list_referenced(storage).empty());
+			CHECK_FALSE(githlpr::chunks::remove_list(storage, "pack-a.pack"));
+		}
+
+		SUBCASE("should keep content-defined chunks after an insertion")
+		{
+			std::string shifted{data};
+			shifted.insert(100, "inserted");
+			std::ofstream{file, std::ios::binary} << shifted;
+			REQUIRE_EQ(shifted.size(), githlpr::chunks::upload_file(storage, "pack-b.pack", file, 1000, 512));
+			std::ofstream{file, std::ios::binary} << data;
+			storage.nwrites = 0;
+			REQUIRE_EQ(data.size(), githlpr::chunks::upload_file(storage, "pack-c.pack", file, 1000, 512));
+			const std::vector<githlpr::chunks::chunk_t> cdc_chunks = githlpr::chunks::read_list(storage, "pack-c.pack");
+			CHECK_GT(cdc_chunks.size(), 5);
+			CHECK_LE(storage.nwrites, 3); // only chunks up to the first cut after the insertion differ, and the list
+			for (std::size_t i{}; i + 1 < cdc_chunks.size(); i++) {
+				CHECK_GE(cdc_chunks[i].size, 128);
+				CHECK_LE(cdc_chunks[i].size, 2048);
+			}
+		}
+
+		SUBCASE("should cut where the scalar scan does")
+		{
+			std::string bytes(std::size_t{1} << 21, '\0');
+			std::uint64_t state{88172645463325252u};
+			for (std::size_t i{}; i < bytes.size() / 2; i++) { // the second half has no cut points
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				bytes[i] = static_cast<char>(state);
+			}
+			for (const std::uint64_t avg_size : {std::uint64_t{256}, std::uint64_t{4096}, std::uint64_t{65536}}) {
+				const githlpr::chunks::cdc_t cdc{avg_size};
+				for (std::string_view rest{bytes}; not rest.empty();) {
+					const std::size_t cut{cdc.find_cut(rest)};
+					REQUIRE_EQ(cdc.find_cut_scalar(rest), cut);
+					rest.remove_prefix(cut);
+				}
+			}
+		}
+
+		CHECK_EQ("pack-a.chunks", githlpr::chunks::get_list_name("pack-a.pack"));
+		std::filesystem::remove(file);
+	}
+}
+
+TEST_SUITE("cache")
+{
+	TEST_CASE("cache_t")
+	{
+		const std::filesystem::path dir = std::filesystem::temp_directory_path() / "test_githlpr.cache";
+		std::filesystem::remove_all(dir);
+		const auto insert = [](githlpr::cache::cache_t& cache, const std::string& key, const std::size_t size) {
+			const std::filesystem::path tmp_file{cache.get_tmp_path(key)};
+			githlpr::proc::write_all(githlpr::proc::fd_t{::open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644)}.get(), std::string(size, 'x'));
+			cache.insert(key, tmp_file);
+		};
+
+		SUBCASE("should count hits and misses across instances")
+		{
+			{
+				githlpr::cache::cache_t cache{dir, 1024};
+				CHECK_FALSE(cache.lookup("pack-a.pack"));
+				insert(cache, "pack-a.pack", 100);
+				CHECK(cache.lookup("pack-a.pack"));
+				cache.save_stats();
+			}
+			const githlpr::cache::cache_t cache{dir, 1024};
+			CHECK_EQ(1, cache.get_stats().hits);
+			CHECK_EQ(1, cache.get_stats().misses);
+			CHECK_EQ(100, cache.get_stats().hit_bytes);
+		}
+
+		SUBCASE("should add up the counts of instances open at the same time")
+		{
+			githlpr::cache::cache_t first{dir, 1024}, second{dir, 1024};
+			CHECK_FALSE(first.lookup("pack-a.pack"));
+			CHECK_FALSE(second.lookup("pack-a.pack"));
+			CHECK_FALSE(second.lookup("pack-b.pack"));
+			first.save_stats();
+			second.save_stats();
+			CHECK_EQ(3, second.get_stats().misses);
+			first.save_stats(); // nothing new to add
+			CHECK_EQ(3, githlpr::cache::cache_t(dir, 1024).get_stats().misses);
+		}
+
+		SUBCASE("should cache only packs that match the checksum naming them")
+		{
+			githlpr::cache::cache_t cache{dir, 1024};
+			const std::string data{"PACK" + testutils::get_rnd_hex_str(64)};
+			githlpr::sha1::context_t ctx{};
+			ctx.update(data);
+			const githlpr::sha1::digest_t digest{ctx.finish()};
+			const std::string trailer(reinterpret_cast<const char*>(digest.data()), digest.size());
+			const std::string key{"pack-" + githlpr::sha1::to_hex(trailer) + ".pack"};
+			CHECK_NE(cache.get_tmp_path(key), cache.get_tmp_path(key)); // one per concurrent fetch
+			const auto insert_data = [&cache, &key](const std::string& content) {
+				const std::filesystem::path tmp_file{cache.get_tmp_path(key)};
+				std::ofstream{tmp_file, std::ios::binary} << content;
+				cache.insert(key, tmp_file);
+				CHECK_FALSE(std::filesystem::exists(tmp_file));
+			};
+			insert_data(data.substr(0, 20) + data + trailer); // interleaved by two writers
+			CHECK_FALSE(cache.lookup(key));
+			insert_data(data + trailer);
+			CHECK(cache.lookup(key));
+		}
+
+		SUBCASE("should evict the least recently used entries beyond its size")
+		{
+			githlpr::cache::cache_t cache{dir, 250};
+			insert(cache, "pack-a.pack", 100);
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			insert(cache, "pack-b.pack", 100);
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			CHECK(cache.lookup("pack-a.pack")); // a is now more recent than b
+			insert(cache, "pack-c.pack", 100);
+			CHECK(cache.lookup("pack-a.pack"));
+			CHECK_FALSE(cache.lookup("pack-b.pack"));
+			CHECK(cache.lookup("pack-c.pack"));
+			CHECK_EQ(1, cache.get_stats().evictions);
+		}
+
+		SUBCASE("should neither keep nor return anything when its size is 0")
+		{
+			{
+				githlpr::cache::cache_t cache{dir, 1024};
+				insert(cache, "pack-a.pack", 1);
+			}
+			githlpr::cache::cache_t cache{dir, 0};
+			CHECK_FALSE(cache.lookup("pack-a.pack"));
+			insert(cache, "pack-b.pack", 1);
+			CHECK_FALSE(cache.lookup("pack-b.pack"));
+			CHECK_FALSE(std::filesystem::exists(dir / "pack-b.pack"));
+			CHECK_EQ(0, cache.get_stats().misses);
+		}
+
+		std::filesystem::remove_all(dir);
+	}
+}
+
+TEST_SUITE("compact")
+{
+	TEST_CASE("plan()")
+	{
+		const auto sized = [](const std::vector<std::uint64_t>& sizes) {
+			std::vector<githlpr::manifest::pack_t> packs{};
+			for (const std::uint64_t size : sizes) {
+				packs.push_back({"pack-" + std::to_string(packs.size()) + ".pack", size, {}, {}});
+			}
+			return packs;
+		};
+
+		CHECK_EQ(0, githlpr::compact::plan({}, 2));
+		CHECK_EQ(1, githlpr::compact::plan(sized({100}), 2));
+		CHECK_EQ(3, githlpr::compact::plan(sized({400, 200, 100}), 2)); // already geometric
+		CHECK_EQ(0, githlpr::compact::plan(sized({10, 10, 10, 10}), 2));
+		CHECK_EQ(1, githlpr::compact::plan(sized({1000, 10, 10, 10}), 2));
+		CHECK_EQ(1, githlpr::compact::plan(sized({2000, 100, 400, 10}), 2)); // 100 is small next to the 400 after it
+		CHECK_EQ(0, githlpr::compact::plan(sized({1000, 100, 400, 10}), 2));
+	}
+
+	TEST_CASE("compact()")
+	{
+		storageutils::mem_storage_t storage{};
+		const std::filesystem::path src = setup_git_dir("compact_src");
+		for (int i{}; i < 6; i++) {
+			commit_git_dir(src);
+			std::stringstream cmd_strm{}, reply_strm{};
+			cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(cmd_strm, reply_strm, storage);
+		}
+		const std::string sha1 = get_head_sha1();
+		REQUIRE_EQ(6, read_manifest(storage).packs.size());
+
+		const githlpr::compact::result_t result{githlpr::compact::compact(storage, {2, 3600})};
+		CHECK_EQ(6, result.merged);
+		REQUIRE_EQ(1, read_manifest(storage).packs.size());
+		CHECK(read_manifest(storage).packs[0].prereqs.empty());
+		// Superseded packs wait for the grace period; without blobs the merged pack is its own tree pack
+		CHECK_EQ(read_manifest(storage).packs[0].name, read_manifest(storage).packs[0].tree_pack);
+		CHECK_EQ(7, count_objects(storage, githlpr::manifest::packs_dir, ".pack"));
+		CHECK_EQ(7, count_objects(storage, githlpr::manifest::packs_dir, ".idx"));
+		CHECK_EQ(src / ".git", std::getenv("GIT_DIR"));
+
+		SUBCASE("should keep a fetchable remote")
+		{
+			const std::filesystem::path dst = setup_git_dir("compact_dst");
+			std::stringstream cmd_strm{}, reply_strm{};
+			cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+			githlpr::process_git_cmds(cmd_strm, reply_strm, storage);
+			CHECK(testutils::git::git_cmd("rev-list --objects --quiet " + sha1, dst));
+		}
+
+		SUBCASE("should delete superseded packs after the grace period")
+		{
+			CHECK_EQ(0, githlpr::compact::compact(storage, {2, 3600}).deleted);
+			CHECK_EQ(6, githlpr::compact::compact(storage, {2, 0}).deleted);
+			CHECK_EQ(1, count_objects(storage, githlpr::manifest::packs_dir, ".pack"));
+			CHECK_EQ(1, count_objects(storage, githlpr::manifest::packs_dir, ".idx"));
+		}
+
+		SUBCASE("should delete packs abandoned by pushes after the grace period")
+		{
+			const std::string now{std::to_string(std::time(nullptr))};
+			githlpr::remote::write_object(storage, std::string(githlpr::manifest::packs_dir) + "tmp-1000-1.pack", "PACK");
+			githlpr::remote::write_object(storage, std::string(githlpr::manifest::packs_dir) + "tmp-" + now + "-2.pack", "PACK");
+			CHECK_EQ(1, githlpr::compact::compact(storage, {2, 3600}).deleted);
+			CHECK_EQ(1, count_objects(storage, std::string(githlpr::manifest::packs_dir) + "tmp-"));
+		}
+
+		SUBCASE("should leave a geometric remote alone")
+		{
+			commit_git_dir(src);
+			std::stringstream cmd_strm{}, reply_strm{};
+			cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(cmd_strm, reply_strm, storage);
+			CHECK_EQ(0, githlpr::compact::compact(storage, {2, 3600}).merged);
+			CHECK_EQ(2, read_manifest(storage).packs.size());
+		}
+
+		unset_git_dir();
+	}
+
+	TEST_CASE("compact() should merge the newest packs onto an older one")
+	{
+		storageutils::mem_storage_t storage{};
+		const std::filesystem::path src = setup_git_dir("compact_tail");
+		// One large push, then small ones the large pack is more than twice the size of
+		for (int i{}; i < 4; i++) {
+			std::ofstream{src / ("file" + std::to_string(i))} << testutils::get_rnd_hex_str(0 == i ? 128 * 1024 : 64) << std::endl;
+			REQUIRE(testutils::git::git_cmd("add --all", src));
+			commit_git_dir(src);
+			std::stringstream cmd_strm{}, reply_strm{};
+			cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(cmd_strm, reply_strm, storage);
+		}
+		const std::string sha1 = get_head_sha1();
+		const githlpr::manifest::manifest_t pushed{read_manifest(storage)};
+		REQUIRE_EQ(4, pushed.packs.size());
+		REQUIRE_EQ(1, githlpr::compact::plan(pushed.packs, 2));
+
+		CHECK_EQ(3, githlpr::compact::compact(storage, {2, 3600}).merged);
+		const githlpr::manifest::manifest_t compacted{read_manifest(storage)};
+		REQUIRE_EQ(2, compacted.packs.size());
+		CHECK_EQ(pushed.packs[0].name, compacted.packs[0].name);
+		CHECK_EQ(pushed.packs[1].prereqs, compacted.packs[1].prereqs);
+		CHECK_NE(compacted.packs[1].name, compacted.packs[1].tree_pack);
+
+		SUBCASE("should keep a fetchable remote")
+		{
+			const std::filesystem::path dst = setup_git_dir("compact_tail_dst");
+			std::stringstream cmd_strm{}, reply_strm{};
+			cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+			githlpr::process_git_cmds(cmd_strm, reply_strm, storage);
+			CHECK(testutils::git::git_cmd("rev-list --objects --quiet " + sha1, dst));
+		}
+
+		SUBCASE("should leave the blobs out of the tree pack")
+		{
+			// Object count in the pack header: commits, root trees and the blob of each merged push
+			const auto count_packed = [&storage](const std::string& name) {
+				const std::string& data = storage.objects.at(std::string(githlpr::manifest::packs_dir) + name);
+				REQUIRE(data.size() > 12);
+				std::uint32_t nobjects{};
+				for (std::size_t i{8}; i < 12; i++) {
+					nobjects = nobjects << 8 | static_cast<unsigned char>(data[i]);
+				}
+				return nobjects;
+			};
+			CHECK_EQ(9, count_packed(compacted.packs[1].name));
+			CHECK_EQ(6, count_packed(compacted.packs[1].tree_pack));
+		}
+
+		unset_git_dir();
+	}
+
+	TEST_CASE("compact() should delete chunks only once no chunk list referred to them for the grace period")
+	{
+		storageutils::mem_storage_t storage{};
+		const std::filesystem::path src = setup_git_dir("compact_chunks");
+		testutils::setup::set_env(std::string(githlpr::chunks::size_env), "64");
+		for (int i{}; i < 3; i++) {
+			std::ofstream{src / ("file" + std::to_string(i))} << testutils::get_rnd_hex_str(1024) << std::endl;
+			REQUIRE(testutils::git::git_cmd("add --all", src));
+			commit_git_dir(src);
+			std::stringstream cmd_strm{}, reply_strm{};
+			cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(cmd_strm, reply_strm, storage);
+		}
+		CHECK(read_manifest(storage).packs.at(0).chunked);
+		CHECK_EQ(3, githlpr::compact::compact(storage, {2, 3600}).merged);
+		unsetenv(std::string(githlpr::chunks::size_env).c_str());
+		REQUIRE(read_manifest(storage).packs.at(0).chunked);
+		const std::size_t nchunks{count_objects(storage, githlpr::chunks::dir)};
+
+		// The superseded packs' chunks outlive them by another grace period
+		githlpr::compact::result_t result{githlpr::compact::compact(storage, {2, 0})};
+		CHECK_EQ(6, result.deleted);
+		CHECK_EQ(0, result.deleted_chunks);
+		CHECK_EQ(nchunks, count_objects(storage, githlpr::chunks::dir));
+		const std::set<std::string> merged{githlpr::chunks::list_referenced(storage)};
+		CHECK_FALSE(merged.empty());
+		REQUIRE(nchunks > merged.size() + 1);
+
+		// A push that found one of them on the remote refers to it in its chunk list before the manifest lists its pack
+		std::string reused{};
+		for (const auto& object : storage.objects) {
+			if (0 == object.first.compare(0, githlpr::chunks::dir.length(), githlpr::chunks::dir) and not merged.count(object.first.substr(githlpr::chunks::dir.length()))) {
+				reused = object.first.substr(githlpr::chunks::dir.length());
+			}
+		}
+		githlpr::remote::write_object(storage, std::string(githlpr::manifest::packs_dir) + "pack-pushed.chunks", reused + " 64\n");
+		result = githlpr::compact::compact(storage, {2, 0});
+		CHECK_EQ(0, result.deleted);
+		CHECK_EQ(nchunks - merged.size() - 1, result.deleted_chunks);
+		CHECK_EQ(merged.size() + 1, count_objects(storage, githlpr::chunks::dir));
+		CHECK(storage.objects.count(std::string(githlpr::chunks::dir) + reused));
+		CHECK_EQ(0, githlpr::compact::compact(storage, {2, 0}).deleted_chunks);
+
+		unset_git_dir();
+	}
+}
+
+/* After "stats": updates count uploaded bytes */
+TEST_SUITE("manifest")
+{
+	TEST_CASE("read()/update()")
+	{
+		storageutils::mem_storage_t storage{};
+		githlpr::manifest::manifest_t manifest{};
+		const auto add_ref = [](const std::string& ref) {
+			return [ref](githlpr::manifest::manifest_t& latest) {
+				latest.refs[ref] = test_sha1;
+				return true;
+			};
+		};
+
+		SUBCASE("should commit each update as a new generation")
+		{
+			REQUIRE(githlpr::manifest::update(storage, manifest, add_ref("refs/heads/a")));
+			REQUIRE(githlpr::manifest::update(storage, manifest, add_ref("refs/heads/b")));
+			CHECK_EQ(2, manifest.generation);
+			CHECK_EQ(1, storage.objects.count(std::string(githlpr::manifest::dir) + "00000000000000000001"));
+			CHECK_EQ(std::string(githlpr::manifest::dir) + "00000000000000000002", get_manifest_path(storage));
+			CHECK_EQ(2, read_manifest(storage).refs.size());
+			CHECK_EQ(2, githlpr::manifest::read(storage).generation);
+			CHECK_FALSE(githlpr::manifest::update(storage, manifest, [](githlpr::manifest::manifest_t&) noexcept { return false; }));
+			CHECK_EQ(2, githlpr::manifest::read(storage).generation);
+		}
+
+		SUBCASE("should read the manifest from before generations until the first update")
+		{
+			manifest.refs[std::string(test_ref)] = test_sha1;
+			storage.objects[std::string(githlpr::manifest::path)] = githlpr::manifest::serialize(manifest);
+			manifest = githlpr::manifest::read(storage);
+			CHECK_EQ(0, manifest.generation);
+			REQUIRE(githlpr::manifest::update(storage, manifest, add_ref("refs/heads/a")));
+			CHECK_EQ(2, githlpr::manifest::read(storage).refs.size());
+		}
+
+		SUBCASE("should rebase on a generation committed since the manifest was read")
+		{
+			githlpr::manifest::manifest_t other{};
+			REQUIRE(githlpr::manifest::update(storage, other, add_ref("refs/heads/a")));
+			int nchanges{};
+			REQUIRE(githlpr::manifest::update(storage, manifest, [&nchanges](githlpr::manifest::manifest_t& latest) {
+				nchanges++;
+				latest.refs["refs/heads/b"] = test_sha1;
+				return true;
+			}));
+			CHECK_EQ(2, nchanges);
+			CHECK_EQ(2, manifest.generation);
+			CHECK_EQ(2, githlpr::manifest::read(storage).refs.size());
+		}
+
+		SUBCASE("should not lose any of many concurrent updates")
+		{
+			constexpr int nthreads{8}, nupdates{8};
+			std::vector<std::future<void>> threads{};
+			for (int i{}; i < nthreads; i++) {
+				threads.push_back(std::async(std::launch::async, [&storage, &add_ref, i]() {
+					githlpr::manifest::manifest_t local{githlpr::manifest::read(storage)};
+					for (int j{}; j < nupdates; j++) {
+						githlpr::manifest::update(storage, local, add_ref("refs/heads/t" + std::to_string(i) + "-" + std::to_string(j)));
+					}
+				}));
+			}
+			for (std::future<void>& thread : threads) {
+				thread.get();
+			}
+			const githlpr::manifest::manifest_t merged{githlpr::manifest::read(storage)};
+			CHECK_EQ(nthreads * nupdates, merged.refs.size());
+			CHECK_EQ(nthreads * nupdates, merged.generation);
+			CHECK_EQ(merged.generation, count_objects(storage, githlpr::manifest::dir)); // losing candidates are removed
+		}
+
+		SUBCASE("should prune all but the newest generations and candidates of dead pushes")
+		{
+			storage.objects[std::string(githlpr::manifest::path)] = githlpr::manifest::serialize(manifest);
+			for (int i{}; i < 10; i++) {
+				REQUIRE(githlpr::manifest::update(storage, manifest, add_ref("refs/heads/b" + std::to_string(i))));
+			}
+			storage.objects[std::string(githlpr::manifest::dir) + "00000000000000000011-1000000000-1"] = githlpr::manifest::serialize(manifest);
+			CHECK_EQ(4, githlpr::manifest::prune(storage));
+			CHECK_EQ(githlpr::manifest::kept_generations, count_objects(storage, githlpr::manifest::dir));
+			CHECK_EQ(10, githlpr::manifest::read(storage).refs.size());
+		}
+	}
+}
+
 TEST_SUITE("process_git_cmds()")
 {
 	TEST_CASE("line protocol tests") {
 		std::stringstream git_cmd_strm{};
 		std::stringstream git_reply_strm{};
+		storageutils::mem_storage_t storage{};
 		REQUIRE(git_cmd_strm.str().empty());
 		REQUIRE(git_reply_strm.str().empty());
 
 		SUBCASE("should reply nothing when no cmds were given")
 		{
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(testutils::is_strm_eof(git_reply_strm));
 		}
 
@@ -73,7 +1104,7 @@ TEST_SUITE("process_git_cmds()")
 			for (int i{}; i <= 3; i++) {
 				git_cmd_strm << std::endl;
 			}
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(testutils::is_strm_eof(git_reply_strm));
 		}
 
@@ -84,7 +1115,7 @@ TEST_SUITE("process_git_cmds()")
 			}
 			git_cmd_strm << githlpr::cmds::ping << std::endl;
 			git_cmd_strm << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(is_ping_reply(git_reply_strm));
 		}
 
@@ -94,14 +1125,14 @@ TEST_SUITE("process_git_cmds()")
 			// cmds are not terminated by a blank line and should be
 			// processed/replied to immediately when received
 			git_cmd_strm << githlpr::cmds::ping << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(is_ping_reply(git_reply_strm));
 		}
 
 		SUBCASE("should terminate single reply with a blank line")
 		{
 			git_cmd_strm << githlpr::cmds::ping << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			// Discard current reply block until its end
 			CHECK(testutils::skip_to_blank_or_eof(git_reply_strm).empty());
 			CHECK(testutils::is_strm_eof(git_reply_strm));
@@ -113,7 +1144,7 @@ TEST_SUITE("process_git_cmds()")
 				git_cmd_strm << githlpr::cmds::ping << std::endl;
 				git_cmd_strm << githlpr::cmds::ping << std::endl;
 			}
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			for (int i{}; i <= 3; i++) {
 				CHECK(is_ping_reply(git_reply_strm));
 				CHECK(testutils::getline(git_reply_strm).empty());
@@ -124,7 +1155,7 @@ TEST_SUITE("process_git_cmds()")
 		{
 			git_cmd_strm << githlpr::cmds::ping << std::endl;
 			git_cmd_strm << githlpr::cmds::caps << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(is_ping_reply(git_reply_strm));
 			testutils::skip_to_blank_or_eof(git_reply_strm); // skip over blank line
 			CHECK(is_caps_reply(git_reply_strm));
@@ -135,7 +1166,7 @@ TEST_SUITE("process_git_cmds()")
 			for (int i{}; i <= 3; i++) {
 				git_cmd_strm << githlpr::cmds::ping << std::endl;
 			}
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			for (int i{}; i <= 3; i++) {
 				CHECK(is_ping_reply(git_reply_strm));
 				testutils::skip_to_blank_or_eof(git_reply_strm); // skip over blank line
@@ -148,6 +1179,7 @@ TEST_SUITE("process_git_cmds()")
 	{
 		std::stringstream git_cmd_strm{};
 		std::stringstream git_reply_strm{};
+		storageutils::mem_storage_t storage{};
 
 		REQUIRE(git_cmd_strm.str().empty());
 		REQUIRE(git_reply_strm.str().empty());
@@ -155,7 +1187,7 @@ TEST_SUITE("process_git_cmds()")
 		SUBCASE("should throw on unknown command")
 		{
 			git_cmd_strm << "foo bar" << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "unknown command: foo bar");
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "unknown command: foo bar");
 		}
 
 		SUBCASE("should throw on unknown command even when other cmds were valid")
@@ -163,13 +1195,13 @@ TEST_SUITE("process_git_cmds()")
 			git_cmd_strm << githlpr::cmds::ping << std::endl;
 			git_cmd_strm << "foo bar" << std::endl;
 			git_cmd_strm << githlpr::cmds::ping << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "unknown command: foo bar");
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "unknown command: foo bar");
 		}
 
 		SUBCASE("should reply 'pong' on 'ping' cmd")
 		{
 			git_cmd_strm << githlpr::cmds::ping << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(is_ping_reply(git_reply_strm));
 			CHECK(is_last_reply(git_reply_strm));
 		}
@@ -179,6 +1211,7 @@ TEST_SUITE("process_git_cmds()")
 	{
 		std::stringstream git_cmd_strm{};
 		std::stringstream git_reply_strm{};
+		storageutils::mem_storage_t storage{};
 
 		REQUIRE(git_cmd_strm.str().empty());
 		REQUIRE(git_reply_strm.str().empty());
@@ -186,16 +1219,38 @@ TEST_SUITE("process_git_cmds()")
 		SUBCASE("should reply its capabilities on 'capabilities' cmd")
 		{
 			git_cmd_strm << githlpr::cmds::caps << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(is_caps_reply(git_reply_strm));
 			CHECK(is_last_reply(git_reply_strm));
 		}
 	}
 
+	TEST_CASE("option cmd")
+	{
+		std::stringstream git_cmd_strm{};
+		std::stringstream git_reply_strm{};
+		storageutils::mem_storage_t storage{};
+
+		SUBCASE("should reply 'ok', 'unsupported' or 'error <msg>' without a blank line")
+		{
+			git_cmd_strm << "option depth 1" << std::endl;
+			git_cmd_strm << "option deepen-since 1 year ago" << std::endl;
+			git_cmd_strm << "option followtags true" << std::endl;
+			git_cmd_strm << "option depth x" << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			CHECK_EQ("ok", testutils::getline(git_reply_strm));
+			CHECK_EQ("ok", testutils::getline(git_reply_strm));
+			CHECK_EQ("unsupported", testutils::getline(git_reply_strm));
+			CHECK_EQ("error invalid depth: x", testutils::getline(git_reply_strm));
+			CHECK(testutils::is_strm_eof(git_reply_strm));
+		}
+	}
+
 	TEST_CASE("push cmd")
 	{
 		std::stringstream git_cmd_strm{};
 		std::stringstream git_reply_strm{};
+		storageutils::mem_storage_t storage{};
 
 		REQUIRE(git_cmd_strm.str().empty());
 		REQUIRE(git_reply_strm.str().empty());
@@ -203,104 +1258,374 @@ TEST_SUITE("process_git_cmds()")
 		SUBCASE("should throw on invalid 'push' cmd")
 		{
 			git_cmd_strm << githlpr::cmds::push << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "could not parse dst-ref from push argument");
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "could not parse dst-ref from push argument");
+		}
+
+		SUBCASE("should not reply before the push batch is terminated by a blank line")
+		{
+			setup_git_dir("push_unterminated");
+			git_cmd_strm << "push refs/heads/master:refs/heads/master" << std::endl;
+			git_cmd_strm << "push HEAD:refs/heads/branch" << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			CHECK(testutils::is_strm_eof(git_reply_strm));
+			CHECK_EQ(0, storage.nwrites);
 		}
 
-		SUBCASE("should reply 'ok <dst>' for each 'push' cmd")
+		SUBCASE("should reply 'ok <dst>' for each 'push' cmd of a batch")
 		{
+			setup_git_dir("push_batch");
 			git_cmd_strm << "push refs/heads/master:refs/heads/master" << std::endl;
 			git_cmd_strm << "push HEAD:refs/heads/branch" << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			git_cmd_strm << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK_EQ("ok refs/heads/master", testutils::getline(git_reply_strm));
-			testutils::skip_to_blank_or_eof(git_reply_strm);
 			CHECK_EQ("ok refs/heads/branch", testutils::getline(git_reply_strm));
 			CHECK(is_last_reply(git_reply_strm));
 		}
+
+		SUBCASE("should upload one pack for the whole batch")
+		{
+			setup_git_dir("push_one_pack");
+			for (int i{}; i < 16; i++) {
+				git_cmd_strm << "push HEAD:refs/heads/branch" << i << std::endl;
+			}
+			git_cmd_strm << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			CHECK_EQ(16, testutils::get_current_strm_block(git_reply_strm).size());
+			CHECK_EQ(1, count_objects(storage, githlpr::manifest::packs_dir, ".pack")); // without blobs it is its own tree pack
+			CHECK_EQ(5, storage.nwrites); // pack and manifest candidate, each moved into place, + index
+		}
+
+		SUBCASE("should only upload objects missing on the remote")
+		{
+			const std::filesystem::path repo = setup_git_dir("push_incremental");
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			const std::string first = get_head_sha1();
+			commit_git_dir(repo);
+			git_cmd_strm.clear();
+			git_cmd_strm << "list for-push" << std::endl;
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			const githlpr::manifest::manifest_t manifest = read_manifest(storage);
+			REQUIRE_EQ(2, manifest.packs.size());
+			CHECK(manifest.packs[0].prereqs.empty());
+			CHECK_EQ(std::vector<std::string>{first}, manifest.packs[1].prereqs);
+			CHECK_EQ(std::vector<std::string>{get_head_sha1()}, manifest.packs[1].tips);
+			CHECK_EQ(get_head_sha1(), manifest.refs.at("refs/heads/master"));
+		}
+
+		SUBCASE("should not upload a pack if the remote has all objects")
+		{
+			setup_git_dir("push_no_new_objects");
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			git_cmd_strm << "push HEAD:refs/heads/branch" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			CHECK_EQ(1, count_objects(storage, githlpr::manifest::packs_dir, ".pack"));
+			CHECK_EQ(2, read_manifest(storage).refs.size());
+		}
+
+		SUBCASE("should reject non-fast-forward updates unless forced")
+		{
+			const std::filesystem::path repo = setup_git_dir("push_non_ff");
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			REQUIRE(testutils::git::git_cmd("checkout -q --orphan other", repo));
+			commit_git_dir(repo);
+			git_cmd_strm.clear();
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			git_cmd_strm << "push +HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			testutils::skip_to_blank_or_eof(git_reply_strm);
+			CHECK_EQ("error refs/heads/master non-fast-forward", testutils::getline(git_reply_strm));
+			CHECK(testutils::getline(git_reply_strm).empty());
+			CHECK_EQ("ok refs/heads/master", testutils::getline(git_reply_strm));
+			CHECK_EQ(get_head_sha1(), read_manifest(storage).refs.at("refs/heads/master"));
+		}
+
+		SUBCASE("should rebase onto pushes committed since the remote refs were listed")
+		{
+			setup_git_dir("push_rebase");
+			githlpr::manifest::manifest_t listed{githlpr::manifest::read(storage)};
+			githlpr::manifest::manifest_t other{listed};
+			REQUIRE(githlpr::manifest::update(storage, other, [](githlpr::manifest::manifest_t& latest) {
+				latest.refs["refs/heads/other"] = test_sha1;
+				return true;
+			}));
+			const std::vector<githlpr::push::result_t> results{githlpr::push::push_batch(storage, {{"HEAD", "refs/heads/master", false}}, listed)};
+			CHECK(results.at(0).error.empty());
+			CHECK_EQ(2, listed.generation);
+			CHECK_EQ(2, read_manifest(storage).refs.size());
+			CHECK_EQ(1, read_manifest(storage).packs.size());
+		}
+
+		SUBCASE("should reply 'fetch first' for refs another push moved since they were listed")
+		{
+			setup_git_dir("push_rebase_conflict");
+			githlpr::manifest::manifest_t listed{githlpr::manifest::read(storage)};
+			githlpr::manifest::manifest_t other{listed};
+			REQUIRE(githlpr::manifest::update(storage, other, [](githlpr::manifest::manifest_t& latest) {
+				latest.refs[std::string(test_ref)] = test_sha1;
+				return true;
+			}));
+			const std::vector<githlpr::push::result_t> results{githlpr::push::push_batch(storage, {{"HEAD", std::string(test_ref), false}, {"HEAD", "refs/heads/b", false}}, listed)};
+			CHECK_EQ("fetch first", results.at(0).error);
+			CHECK(results.at(1).error.empty());
+			CHECK_EQ(test_sha1, read_manifest(storage).refs.at(std::string(test_ref)));
+		}
+
+		SUBCASE("should reply 'error <dst>' for unknown src and push the rest")
+		{
+			setup_git_dir("push_unknown_src");
+			git_cmd_strm << "push refs/heads/unknown:refs/heads/unknown" << std::endl;
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl;
+			git_cmd_strm << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			CHECK_EQ("error refs/heads/unknown src refspec refs/heads/unknown does not match any", testutils::getline(git_reply_strm));
+			CHECK_EQ("ok refs/heads/master", testutils::getline(git_reply_strm));
+			CHECK(is_last_reply(git_reply_strm));
+		}
+
+		SUBCASE("should delete dst on empty src")
+		{
+			setup_git_dir("push_delete");
+			git_cmd_strm << "push HEAD:refs/heads/branch" << std::endl;
+			git_cmd_strm << std::endl;
+			git_cmd_strm << "push :refs/heads/branch" << std::endl;
+			git_cmd_strm << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			CHECK_EQ("ok refs/heads/branch", testutils::getline(git_reply_strm));
+			CHECK(testutils::getline(git_reply_strm).empty());
+			CHECK_EQ("ok refs/heads/branch", testutils::getline(git_reply_strm));
+			CHECK(read_manifest(storage).refs.empty());
+			CHECK(read_manifest(storage).head.empty());
+		}
+
+		SUBCASE("should replicate pushes to mirrors, with the packs they missed")
+		{
+			const std::filesystem::path repo = setup_git_dir("push_mirrors");
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage); // before the mirrors were added
+			commit_git_dir(repo);
+			std::vector<std::unique_ptr<githlpr::remote::storage_t>> mirrors{};
+			std::vector<const storageutils::mem_storage_t*> mems{};
+			for (int i{}; i < 2; i++) {
+				auto mirror = std::make_unique<storageutils::mem_storage_t>();
+				mems.push_back(mirror.get());
+				mirrors.push_back(std::move(mirror));
+			}
+			githlpr::mirror::fanout_t fanout{storage, std::move(mirrors), 3};
+			std::stringstream cmd_strm{}, reply_strm{};
+			cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(cmd_strm, reply_strm, storage, &fanout);
+			CHECK_EQ("ok refs/heads/master", testutils::getline(reply_strm));
+			const githlpr::manifest::manifest_t manifest = read_manifest(storage);
+			REQUIRE_EQ(2, manifest.packs.size());
+			for (const storageutils::mem_storage_t* mirror : mems) {
+				const githlpr::manifest::manifest_t replica = read_manifest(*mirror);
+				CHECK_EQ(manifest.refs, replica.refs);
+				CHECK_EQ(manifest.packs.size(), replica.packs.size());
+				CHECK_EQ(count_objects(storage, githlpr::manifest::packs_dir), count_objects(*mirror, githlpr::manifest::packs_dir));
+			}
+		}
+
+		SUBCASE("should only reply 'ok' once the quorum of remotes has the push")
+		{
+			setup_git_dir("push_quorum");
+			for (const std::size_t quorum : {std::size_t{2}, std::size_t{3}}) {
+				std::vector<std::unique_ptr<githlpr::remote::storage_t>> mirrors{};
+				mirrors.push_back(std::make_unique<storageutils::mem_storage_t>());
+				mirrors.push_back(std::make_unique<unreachable_storage_t>());
+				githlpr::mirror::fanout_t fanout{storage, std::move(mirrors), quorum};
+				std::stringstream cmd_strm{}, reply_strm{};
+				cmd_strm << "push HEAD:refs/heads/branch" << quorum << std::endl << std::endl;
+				githlpr::process_git_cmds(cmd_strm, reply_strm, storage, &fanout);
+				CHECK_EQ(2 == quorum ? "ok refs/heads/branch2" : "error refs/heads/branch3 pushed to 2 of 3 remotes, quorum is 3", testutils::getline(reply_strm));
+			}
+		}
+
+		SUBCASE("should throw on a quorum that is not a count")
+		{
+			const std::filesystem::path repo = setup_git_dir("push_invalid_quorum");
+			REQUIRE(testutils::git::git_cmd("config remote.origin.rcloneMirror rclone://mirror:repo", repo));
+			for (const std::string quorum : {"two", "99999999999999999999999"}) {
+				REQUIRE(testutils::git::git_cmd("config remote.origin.rcloneQuorum " + quorum, repo));
+				CHECK_THROWS_WITH(githlpr::mirror::open(storage, "origin"), ("invalid remote.origin.rclonequorum: " + quorum).c_str());
+			}
+		}
+
+		SUBCASE("should upload the same chunks again when retrying an interrupted chunked push")
+		{
+			const std::filesystem::path repo = setup_git_dir("push_retry");
+			std::ofstream{repo / "file"} << testutils::get_rnd_hex_str(4096) << std::endl;
+			REQUIRE(testutils::git::git_cmd("add file", repo));
+			commit_git_dir(repo);
+			testutils::setup::set_env(std::string(githlpr::chunks::size_env), "64");
+			dropping_storage_t dropping{storage, 10};
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, dropping);
+			const std::filesystem::path tmp_dir{githlpr::git::get_helper_dir() / "tmp"};
+			const auto count_kept = [&tmp_dir]() {
+				std::size_t count{};
+				for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(tmp_dir)) {
+					count += 0 == entry.path().filename().string().rfind("keep-", 0);
+				}
+				return count;
+			};
+			const std::map<std::string, std::uint64_t> uploaded{storage.list(std::string(githlpr::chunks::dir))};
+			CHECK_EQ(1, count_kept());
+
+			std::stringstream cmd_strm{}, reply_strm{};
+			cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(cmd_strm, reply_strm, storage);
+			unsetenv(std::string(githlpr::chunks::size_env).c_str());
+			CHECK_EQ("error refs/heads/master link dropped", testutils::getline(git_reply_strm));
+			CHECK_EQ("ok refs/heads/master", testutils::getline(reply_strm));
+			CHECK_EQ(10, uploaded.size());
+			const std::set<std::string> referenced{githlpr::chunks::list_referenced(storage)};
+			for (const auto& chunk : uploaded) {
+				CHECK(referenced.count(chunk.first));
+			}
+			CHECK_EQ(0, count_kept());
+		}
+
+		unset_git_dir();
 	}
 
 	TEST_CASE("list cmd")
 	{
 		std::stringstream git_cmd_strm{};
 		std::stringstream git_reply_strm{};
+		storageutils::mem_storage_t storage{};
 
 		REQUIRE(git_cmd_strm.str().empty());
 		REQUIRE(git_reply_strm.str().empty());
 
-		SUBCASE("should reply dummy refs on 'list for-push' cmd")
+		SUBCASE("should reply a blank line only for an empty remote")
 		{
 			git_cmd_strm << "list for-push" << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
-			CHECK_EQ("2a569a9e9e5a0d8e4ce829bbdd84904633024f86 refs/heads/master", testutils::getline(git_reply_strm));
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(is_last_reply(git_reply_strm));
 		}
+
+		SUBCASE("should reply remote refs and default branch on 'list' cmd")
+		{
+			githlpr::manifest::manifest_t manifest{};
+			manifest.head = test_ref;
+			manifest.refs[std::string(test_ref)] = test_sha1;
+			manifest.refs["refs/tags/v1"] = test_sha1;
+			storage.objects[std::string(githlpr::manifest::path)] = githlpr::manifest::serialize(manifest);
+			git_cmd_strm << githlpr::cmds::list << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			CHECK_EQ(std::string(test_sha1) + " " + std::string(test_ref), testutils::getline(git_reply_strm));
+			CHECK_EQ(std::string(test_sha1) + " refs/tags/v1", testutils::getline(git_reply_strm));
+			CHECK_EQ("@" + std::string(test_ref) + " HEAD", testutils::getline(git_reply_strm));
+			CHECK(is_last_reply(git_reply_strm));
+			CHECK_EQ(2, storage.nreads); // listing of the manifests, then the newest
+		}
+
+		SUBCASE("should only list the remote while the newest manifest is kept locally")
+		{
+			setup_git_dir("list");
+			githlpr::manifest::manifest_t manifest{};
+			const auto add_ref = [](const std::string& ref) {
+				return [ref](githlpr::manifest::manifest_t& next) {
+					next.refs[ref] = test_sha1;
+					return true;
+				};
+			};
+			REQUIRE(githlpr::manifest::update(storage, manifest, add_ref(std::string(test_ref))));
+			for (int i{}; i < 3; i++) {
+				if (2 == i) {
+					REQUIRE(githlpr::manifest::update(storage, manifest, add_ref("refs/tags/v1")));
+				}
+				std::stringstream list_cmd_strm{}, list_reply_strm{};
+				list_cmd_strm << githlpr::cmds::list << std::endl;
+				storage.nreads = 0;
+				githlpr::process_git_cmds(list_cmd_strm, list_reply_strm, storage);
+				CHECK_EQ(1 == i ? 1 : 2, storage.nreads); // the manifest is read again once another generation is committed
+				CHECK_EQ(std::string(test_sha1) + " " + std::string(test_ref), testutils::getline(list_reply_strm));
+				if (2 == i) {
+					CHECK_EQ(std::string(test_sha1) + " refs/tags/v1", testutils::getline(list_reply_strm));
+				}
+				CHECK(is_last_reply(list_reply_strm));
+			}
+			unset_git_dir();
+		}
 	}
 
-	TEST_CASE("fetch cmd" * doctest::skip())
+	TEST_CASE("fetch cmd")
 	{
 		std::stringstream git_cmd_strm{};
 		std::stringstream git_reply_strm{};
+		storageutils::mem_storage_t storage{};
 
 		REQUIRE(git_cmd_strm.str().empty());
 		REQUIRE(git_reply_strm.str().empty());
 
 		SUBCASE("should wait until single fetch cmd is terminated by blank line")
 		{
-			testutils::safe_sstream cmd{}, reply{};
-			// TODO
+			git_cmd_strm << githlpr::cmds::fetch << " " << test_sha1 << " " << test_ref << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			CHECK(testutils::is_strm_eof(git_reply_strm));
 		}
 
 		SUBCASE("should wait until fetch cmd block is terminated by blank line")
 		{
-			testutils::safe_sstream cmd{}, reply{};
-			// TODO
+			git_cmd_strm << githlpr::cmds::fetch << " " << test_sha1 << " " << test_ref << std::endl;
+			git_cmd_strm << githlpr::cmds::fetch << " " << test_sha1 << " HEAD" << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			CHECK(testutils::is_strm_eof(git_reply_strm));
+			CHECK_EQ(0, storage.nreads);
 		}
 
 		SUBCASE("should throw on parameterless fetch cmd")
 		{
 			git_cmd_strm << githlpr::cmds::fetch << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "could not parse fetch parameters");
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "could not parse fetch parameters");
 		}
 
 		SUBCASE("should throw on invalid fetch cmd (missing ref)")
 		{
-			git_cmd_strm << githlpr::cmds::fetch << test_sha1 << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "could not parse fetch parameters");
+			git_cmd_strm << githlpr::cmds::fetch << " " << test_sha1 << std::endl;
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "could not parse fetch parameters");
 		}
 
 		SUBCASE("should throw on invalid fetch cmd (missing sha1 hash)")
 		{
 			git_cmd_strm << githlpr::cmds::fetch << " " << test_ref << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "could not parse fetch parameters");
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "could not parse fetch parameters");
 		}
 
 		SUBCASE("should throw on invalid fetch cmd (too short sha1 hash)")
 		{
 			git_cmd_strm << githlpr::cmds::fetch << " " << test_sha1.substr(2) << " " << test_ref << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "could not parse fetch parameters");
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "could not parse fetch parameters");
 		}
 
 		SUBCASE("should throw on invalid fetch cmd (too long sha1 hash)")
 		{
 			git_cmd_strm << githlpr::cmds::fetch << " " << test_sha1 << "729 " << test_ref << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "could not parse fetch parameters");
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "could not parse fetch parameters");
 		}
 
 		SUBCASE("should throw on invalid fetch cmd (invalid sha1 hash)")
 		{
 			git_cmd_strm << githlpr::cmds::fetch << " k/2js3yzklohs$sd" << test_sha1.substr(16) << " " << test_ref << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "could not parse fetch parameters");
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "could not parse fetch parameters");
 		}
 
 		SUBCASE("should throw on invalid fetch cmd (parameters in wrong order)")
 		{
 			git_cmd_strm << githlpr::cmds::fetch << " " << test_ref << " " << test_sha1 << std::endl;
-			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm), "could not parse fetch parameters");
+			CHECK_THROWS_WITH(githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage), "could not parse fetch parameters");
 		}
 
 		SUBCASE("should reply blank line on single fetch cmd")
 		{
 			git_cmd_strm << githlpr::cmds::fetch << " " << test_sha1 << " " << test_ref << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			git_cmd_strm << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(testutils::getline(git_reply_strm).empty());
 			CHECK(testutils::is_strm_eof(git_reply_strm));
 		}
@@ -310,9 +1635,268 @@ TEST_SUITE("process_git_cmds()")
 			git_cmd_strm << githlpr::cmds::fetch << " " << test_sha1 << " " << test_ref << std::endl;
 			git_cmd_strm << githlpr::cmds::fetch << " " << test_sha1 << " " << test_ref << std::endl;
 			git_cmd_strm << std::endl;
-			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm);
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
 			CHECK(testutils::getline(git_reply_strm).empty());
 			CHECK(testutils::is_strm_eof(git_reply_strm));
 		}
+
+		SUBCASE("should index the remote packs into GIT_DIR")
+		{
+			setup_git_dir("fetch_src");
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			const std::string sha1 = get_head_sha1();
+			const std::filesystem::path repo = setup_git_dir("fetch_dst");
+			git_cmd_strm.clear();
+			git_cmd_strm << githlpr::cmds::list << std::endl;
+			git_cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl;
+			git_cmd_strm << std::endl;
+			std::stringstream fetch_reply_strm{};
+			githlpr::process_git_cmds(git_cmd_strm, fetch_reply_strm, storage);
+			testutils::skip_to_blank_or_eof(fetch_reply_strm); // list reply
+			CHECK(is_last_reply(fetch_reply_strm));
+			CHECK(testutils::git::git_cmd("cat-file -e " + sha1, repo));
+		}
+
+		SUBCASE("should skip packs whose objects are already present on a second fetch")
+		{
+			commit_git_dir(setup_git_dir("fetch_src"));
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			const std::string sha1 = get_head_sha1();
+			setup_git_dir("fetch_dst");
+			for (int i{}; i < 2; i++) {
+				std::stringstream fetch_cmd_strm{}, fetch_reply_strm{};
+				fetch_cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+				storage.nreads = 0;
+				githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+				CHECK_EQ(i ? 1 : 4, storage.nreads); // manifest listing, its read, the pack index and the pack only while they are not kept locally
+			}
+			const githlpr::cache::stats_t stats{githlpr::cache::open().get_stats()};
+			CHECK_EQ(1, stats.hits);
+			CHECK_EQ(2, stats.misses);
+		}
+
+		SUBCASE("should skip packs without an index whose tips are reachable from local refs")
+		{
+			commit_git_dir(setup_git_dir("fetch_src"));
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			const std::string sha1 = get_head_sha1();
+			githlpr::manifest::manifest_t manifest{read_manifest(storage)};
+			manifest.packs.at(0).tree_pack.clear(); // as pushed before packs had indexes
+			storage.objects[get_manifest_path(storage)] = githlpr::manifest::serialize(manifest);
+			const std::filesystem::path repo = setup_git_dir("fetch_dst");
+			for (int i{}; i < 2; i++) {
+				std::stringstream fetch_cmd_strm{}, fetch_reply_strm{};
+				fetch_cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+				storage.nreads = 0;
+				githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+				CHECK_EQ(i ? 1 : 3, storage.nreads); // manifest listing, its read only while not kept locally, then the pack only while its tip is unknown
+				REQUIRE(testutils::git::git_cmd("update-ref " + std::string(test_ref) + " " + sha1, repo)); // as git does after the fetch
+			}
+			const githlpr::cache::stats_t stats{githlpr::cache::open().get_stats()};
+			CHECK_EQ(0, stats.hits); // not even indexed from the cache
+			CHECK_EQ(1, stats.misses);
+		}
+
+		SUBCASE("should fetch only the packs between those present and the last one holding a want")
+		{
+			const std::filesystem::path src = setup_git_dir("fetch_src");
+			std::vector<std::string> sha1s{};
+			for (int i{}; i < 2; i++) {
+				commit_git_dir(src);
+				std::stringstream push_cmd_strm{}, push_reply_strm{};
+				push_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+				githlpr::process_git_cmds(push_cmd_strm, push_reply_strm, storage);
+				sha1s.push_back(get_head_sha1());
+			}
+			REQUIRE_EQ(2, read_manifest(storage).packs.size());
+			const std::filesystem::path repo = setup_git_dir("fetch_dst");
+			for (const std::string& sha1 : sha1s) {
+				std::stringstream fetch_cmd_strm{}, fetch_reply_strm{};
+				fetch_cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+				storage.nreads = 0;
+				githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+				CHECK_EQ(sha1 == sha1s.front() ? 4 : 3, storage.nreads); // manifest listing, its read the first time, one pack index and one pack
+				CHECK(testutils::git::git_cmd("cat-file -e " + sha1, repo));
+			}
+			const githlpr::cache::stats_t stats{githlpr::cache::open().get_stats()};
+			CHECK_EQ(1, stats.hits); // the first pack's index; the first pack itself is skipped
+			CHECK_EQ(4, stats.misses);
+		}
+
+		SUBCASE("should only fetch the history within 'option depth'")
+		{
+			const std::filesystem::path src = setup_git_dir("fetch_src");
+			commit_git_dir(src);
+			commit_git_dir(src);
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			const std::string sha1 = get_head_sha1();
+			const std::string parent = githlpr::git::resolve({"HEAD~1"}).at(0).value();
+			const std::filesystem::path repo = setup_git_dir("fetch_dst");
+			std::stringstream fetch_cmd_strm{}, fetch_reply_strm{};
+			fetch_cmd_strm << "option depth 1" << std::endl;
+			fetch_cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+			githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+			CHECK_EQ("ok", testutils::getline(fetch_reply_strm));
+			CHECK(is_last_reply(fetch_reply_strm));
+			CHECK(testutils::git::git_cmd("cat-file -e " + sha1, repo));
+			CHECK_FALSE(testutils::git::git_cmd("cat-file -e " + parent, repo));
+			std::ifstream shallow{repo / ".git" / "shallow"};
+			CHECK_EQ(sha1, testutils::getline(shallow));
+		}
+
+		SUBCASE("should read only tree packs and the blobs within 'option depth', up to the pack of the want")
+		{
+			const std::filesystem::path src = setup_git_dir("fetch_src");
+			std::vector<std::string> sha1s{}, blobs{};
+			for (int i{}; i < 3; i++) {
+				std::ofstream{src / "file"} << testutils::get_rnd_hex_str(16 * 1024) << std::endl;
+				REQUIRE(testutils::git::git_cmd("add file", src));
+				commit_git_dir(src);
+				std::stringstream push_cmd_strm{}, push_reply_strm{};
+				push_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+				githlpr::process_git_cmds(push_cmd_strm, push_reply_strm, storage);
+				sha1s.push_back(get_head_sha1());
+				blobs.push_back(githlpr::git::resolve({"HEAD:file"}).at(0).value());
+			}
+			const std::vector<githlpr::manifest::pack_t> packs{read_manifest(storage).packs};
+			REQUIRE_EQ(3, packs.size());
+
+			const std::filesystem::path repo = setup_git_dir("fetch_dst");
+			std::stringstream fetch_cmd_strm{}, fetch_reply_strm{};
+			fetch_cmd_strm << "option depth 1" << std::endl;
+			fetch_cmd_strm << githlpr::cmds::fetch << " " << sha1s[1] << " " << test_ref << std::endl << std::endl;
+			githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+			CHECK_EQ("ok", testutils::getline(fetch_reply_strm));
+			CHECK(testutils::git::git_cmd("cat-file -e " + blobs[1], repo));
+			CHECK_FALSE(testutils::git::git_cmd("cat-file -e " + blobs[0], repo));
+			CHECK_FALSE(testutils::git::git_cmd("cat-file -e " + sha1s[2], repo));
+			githlpr::cache::cache_t cache{githlpr::cache::open()};
+			for (const githlpr::manifest::pack_t& pack : packs) {
+				CHECK_FALSE(cache.lookup(pack.name)); // the blobs were read by byte range
+			}
+			CHECK(cache.lookup(packs[0].tree_pack));
+			CHECK(cache.lookup(packs[1].tree_pack));
+			CHECK_FALSE(cache.lookup(packs[2].tree_pack));
+		}
+
+		SUBCASE("should fetch only tree packs with 'option filter blob:none' and single blobs lazily")
+		{
+			const std::filesystem::path src = setup_git_dir("fetch_src");
+			std::ofstream{src / "file"} << "lazily fetched" << std::endl;
+			REQUIRE(testutils::git::git_cmd("add file", src));
+			commit_git_dir(src);
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			const std::string sha1 = get_head_sha1();
+			const std::string blob = githlpr::git::resolve({"HEAD:file"}).at(0).value();
+			const githlpr::manifest::pack_t pack = read_manifest(storage).packs.at(0);
+			REQUIRE_NE(pack.name, pack.tree_pack);
+			REQUIRE_LT(pack.tree_pack_size, pack.size);
+
+			const std::filesystem::path repo = setup_git_dir("fetch_dst");
+			std::stringstream fetch_cmd_strm{}, fetch_reply_strm{};
+			fetch_cmd_strm << "option filter blob:none" << std::endl << "option from-promisor true" << std::endl;
+			fetch_cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+			fetch_cmd_strm << githlpr::cmds::fetch << " " << blob << " " << blob << std::endl << std::endl;
+			storage.nreads = 0;
+			githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+			CHECK_EQ("ok", testutils::getline(fetch_reply_strm));
+			CHECK_EQ("ok", testutils::getline(fetch_reply_strm));
+			CHECK(testutils::git::git_cmd("cat-file -e " + sha1, repo));
+			CHECK(testutils::git::git_cmd("cat-file -e " + blob, repo));
+			CHECK_EQ(5, storage.nreads); // manifest (listing and read), tree pack, then the pack index and one byte range of the pack
+		}
+
+		SUBCASE("should read the blobs of a lazy fetch and their delta bases as few byte ranges")
+		{
+			const std::filesystem::path src = setup_git_dir("fetch_src");
+			const std::string shared{testutils::get_rnd_hex_str(4096)};
+			std::vector<std::string> paths{};
+			for (int i{}; i < 20; i++) {
+				paths.push_back("file" + std::to_string(i));
+				std::ofstream{src / paths.back()} << shared << i << std::endl; // similar enough to be stored as deltas
+			}
+			REQUIRE(testutils::git::git_cmd("add --all", src));
+			commit_git_dir(src);
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			const std::string sha1 = get_head_sha1();
+			std::vector<std::string> revs{};
+			for (const std::string& path : paths) {
+				revs.push_back("HEAD:" + path);
+			}
+			std::vector<std::string> blobs{};
+			for (const std::optional<std::string>& blob : githlpr::git::resolve(revs)) {
+				blobs.push_back(blob.value());
+			}
+
+			const std::filesystem::path repo = setup_git_dir("fetch_dst");
+			std::stringstream fetch_cmd_strm{}, fetch_reply_strm{};
+			fetch_cmd_strm << "option filter blob:none" << std::endl << "option from-promisor true" << std::endl;
+			fetch_cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+			githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+			fetch_cmd_strm.clear();
+			fetch_cmd_strm << "option from-promisor true" << std::endl;
+			for (const std::string& blob : blobs) {
+				fetch_cmd_strm << githlpr::cmds::fetch << " " << blob << " " << blob << std::endl;
+			}
+			fetch_cmd_strm << std::endl;
+			storage.nreads = 0;
+			githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+			for (const std::string& blob : blobs) {
+				CHECK(testutils::git::git_cmd("cat-file -e " + blob, repo));
+			}
+			CHECK_EQ(2, storage.nreads); // manifest listing and one byte range of the pack for every blob and delta base; the index is cached
+		}
+
+		SUBCASE("should fetch packs pushed as chunks")
+		{
+			const std::filesystem::path src = setup_git_dir("fetch_src");
+			std::ofstream{src / "file"} << "chunked" << std::endl;
+			REQUIRE(testutils::git::git_cmd("add file", src));
+			commit_git_dir(src);
+			testutils::setup::set_env(std::string(githlpr::chunks::size_env), "64");
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			unsetenv(std::string(githlpr::chunks::size_env).c_str());
+			const std::string sha1 = get_head_sha1();
+			const githlpr::manifest::pack_t pack = read_manifest(storage).packs.at(0);
+			REQUIRE(pack.chunked);
+			CHECK_FALSE(storage.objects.count("packs/" + pack.name));
+			CHECK_GT(count_objects(storage, "chunks/"), 2);
+
+			for (const char *const jobs : {"1", "4"}) {
+				const std::filesystem::path repo = setup_git_dir("fetch_dst");
+				testutils::setup::set_env(std::string(githlpr::download::jobs_env), jobs);
+				std::stringstream fetch_cmd_strm{}, fetch_reply_strm{};
+				fetch_cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+				githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+				unsetenv(std::string(githlpr::download::jobs_env).c_str());
+				CHECK(testutils::git::git_cmd("cat-file -e " + sha1 + ":file", repo));
+			}
+		}
+
+		SUBCASE("should index packs downloaded as byte ranges")
+		{
+			commit_git_dir(setup_git_dir("fetch_src")); // the init commit alone may already be in fetch_dst
+			git_cmd_strm << "push HEAD:refs/heads/master" << std::endl << std::endl;
+			githlpr::process_git_cmds(git_cmd_strm, git_reply_strm, storage);
+			const std::string sha1 = get_head_sha1();
+			const std::filesystem::path repo = setup_git_dir("fetch_dst");
+			testutils::setup::set_env(std::string(githlpr::download::chunk_size_env), "64");
+			std::stringstream fetch_cmd_strm{}, fetch_reply_strm{};
+			fetch_cmd_strm << githlpr::cmds::fetch << " " << sha1 << " " << test_ref << std::endl << std::endl;
+			storage.nreads = 0;
+			githlpr::process_git_cmds(fetch_cmd_strm, fetch_reply_strm, storage);
+			unsetenv(std::string(githlpr::download::chunk_size_env).c_str());
+			CHECK_GT(storage.nreads, 2);
+			CHECK(testutils::git::git_cmd("cat-file -e " + sha1, repo));
+		}
+
+		unset_git_dir();
 	}
 }
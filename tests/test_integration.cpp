@@ -1,4 +1,9 @@
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <string>
+#include <vector>
 
 #define DOCTEST_CONFIG_IMPLEMENT
 
@@ -24,3 +29,64 @@ TEST_CASE("walking_skeleton")
 	// Test clone repo from remote
 	git::git_repo clone_repo = git::clone_repo(test_case_dir / "clone_repo");
 }
+
+TEST_CASE("concurrent_pushes")
+{
+	const std::filesystem::path test_case_dir = SETUP_TEST_CASE("concurrent_pushes");
+	testutils::setup::set_env("RCLONE_CONFIG", (test_case_dir / "rclone.conf").string());
+	constexpr int npushers{8};
+	constexpr int npushes{3};
+
+	// Every pusher pushes its own branch, all at once, against one local rclone backend
+	std::vector<git::git_repo> repos{};
+	for (int i{}; i < npushers; i++) {
+		repos.push_back(git::init_repo(test_case_dir / ("pusher" + std::to_string(i))));
+		REQUIRE(git::add_remote(repos.back()));
+	}
+	std::vector<std::future<bool>> pushers{};
+	for (int i{}; i < npushers; i++) {
+		pushers.push_back(std::async(std::launch::async, [&repo = repos[static_cast<std::size_t>(i)], i]() {
+			bool pushed{true};
+			for (int j{}; j < npushes; j++) {
+				git::append_test_data(repo);
+				pushed = git::add_all(repo) and git::commit(repo) and git::git_cmd("push origin master:refs/heads/pusher" + std::to_string(i), repo) and pushed;
+			}
+			return pushed;
+		}));
+	}
+	for (std::future<bool>& pusher : pushers) {
+		CHECK(pusher.get());
+	}
+
+	// No push lost another's ref update
+	git::git_repo clone_repo = git::clone_repo(test_case_dir / "clone_repo");
+	for (int i{}; i < npushers; i++) {
+		const git::git_repo& repo = repos[static_cast<std::size_t>(i)];
+		CHECK(git::git_cmd("fetch -q origin", repo));
+		CHECK(git::git_cmd("diff --quiet master origin/pusher" + std::to_string(i), repo));
+	}
+}
+
+TEST_CASE("daemon")
+{
+	const std::filesystem::path test_case_dir = SETUP_TEST_CASE("daemon");
+	testutils::setup::set_env("RCLONE_CONFIG", (test_case_dir / "rclone.conf").string());
+	testutils::setup::set_env("GIT_REMOTE_RCLONE_DAEMON", "1");
+	testutils::setup::set_env("GIT_REMOTE_RCLONE_DAEMON_IDLE", "5");
+
+	// Helpers started by git hand their work to the daemon, which the first one starts
+	git::git_repo init_repo = git::init_repo(test_case_dir / "init_repo");
+	git::add_remote(init_repo);
+	git::append_test_data(init_repo);
+	git::add_all(init_repo);
+	git::commit(init_repo);
+	CHECK(git::push(init_repo));
+	std::ifstream sockets{"/proc/net/unix"};
+	const std::string listed{std::istreambuf_iterator<char>(sockets), std::istreambuf_iterator<char>()};
+	CHECK_NE(std::string::npos, listed.find("@git-remote-rclone-"));
+
+	git::git_repo clone_repo = git::clone_repo(test_case_dir / "clone_repo");
+	CHECK(git::git_cmd("fetch -q origin", init_repo));
+	CHECK(git::git_cmd("diff --quiet master origin/master", init_repo));
+	testutils::setup::set_env("GIT_REMOTE_RCLONE_DAEMON", "0");
+}